@@ -0,0 +1,747 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#include <tbb/enumerable_thread_specific.h>
+
+#include "amg_preconditioner.h"
+
+namespace yapfs
+{
+
+    // Pivot of the coarse LDL^T below this fraction of its diagonal entry is a null direction of the matrix:
+    // the closed components are singular and the float Galerkin products leave their null pivots well above 0
+    #define AMG_NULL_PIVOT 1e-2
+    // A level with more aggregates than this fraction of its rows is not coarsened further
+    #define AMG_MAX_COARSE_RATIO 0.8
+
+    // C = A*B, two parallel passes over the rows of A: number of non zero of each row, then columns and values.
+    // A marker of the columns of B for each thread finds the repeated columns of a row
+    static void multiply(const AMGMatrix &A, const AMGMatrix &B, AMGMatrix &C)
+    {
+        C.mNumRows = A.mNumRows;
+        C.mNumCols = B.mNumCols;
+        C.mI.assign(A.mNumRows + 1, 0);
+
+        tbb::enumerable_thread_specific< vector<int> > countMarkers(vector<int>(B.mNumCols, -1));
+        tbb::parallel_for(tbb::blocked_range<int>(0, A.mNumRows, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                vector<int> &marker = countMarkers.local();
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    int count = 0;
+                    for (int idxA = A.mI[i]; idxA < A.mI[i+1]; idxA++)
+                    {
+                        int k = A.mJ[idxA];
+                        for (int idxB = B.mI[k]; idxB < B.mI[k+1]; idxB++)
+                        {
+                            if (marker[B.mJ[idxB]] != i)
+                            {
+                                marker[B.mJ[idxB]] = i;
+                                count++;
+                            }
+                        }
+                    }
+                    C.mI[i+1] = count;
+                }
+            });
+
+        for (int i = 0; i < A.mNumRows; i++)
+        {
+            C.mI[i+1] += C.mI[i];
+        }
+        C.mJ.resize(C.mI[A.mNumRows]);
+        C.mVal.resize(C.mI[A.mNumRows]);
+
+        // position of each column in the row of C being filled
+        tbb::enumerable_thread_specific< vector<int> > fillMarkers(vector<int>(B.mNumCols, -1));
+        tbb::enumerable_thread_specific< vector<int> > fillPositions(vector<int>(B.mNumCols, 0));
+        tbb::parallel_for(tbb::blocked_range<int>(0, A.mNumRows, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                vector<int> &marker = fillMarkers.local();
+                vector<int> &position = fillPositions.local();
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    int pos = C.mI[i];
+                    for (int idxA = A.mI[i]; idxA < A.mI[i+1]; idxA++)
+                    {
+                        int k = A.mJ[idxA];
+                        float a = A.mVal[idxA];
+                        for (int idxB = B.mI[k]; idxB < B.mI[k+1]; idxB++)
+                        {
+                            int col = B.mJ[idxB];
+                            if (marker[col] != i)
+                            {
+                                marker[col] = i;
+                                position[col] = pos;
+                                C.mJ[pos] = col;
+                                C.mVal[pos] = a * B.mVal[idxB];
+                                pos++;
+                            }
+                            else
+                            {
+                                C.mVal[position[col]] += a * B.mVal[idxB];
+                            }
+                        }
+                    }
+                }
+            });
+    }
+
+    // T = A^T, columns of each row of T sorted
+    static void transpose(const AMGMatrix &A, AMGMatrix &T)
+    {
+        T.mNumRows = A.mNumCols;
+        T.mNumCols = A.mNumRows;
+        T.mI.assign(A.mNumCols + 1, 0);
+        T.mJ.resize(A.mJ.size());
+        T.mVal.resize(A.mVal.size());
+
+        for (size_t idx = 0; idx < A.mJ.size(); idx++)
+        {
+            T.mI[A.mJ[idx] + 1]++;
+        }
+        for (int col = 0; col < A.mNumCols; col++)
+        {
+            T.mI[col+1] += T.mI[col];
+        }
+        vector<int> next(T.mI.begin(), T.mI.end() - 1);
+        for (int row = 0; row < A.mNumRows; row++)
+        {
+            for (int idx = A.mI[row]; idx < A.mI[row+1]; idx++)
+            {
+                int pos = next[A.mJ[idx]]++;
+                T.mJ[pos] = row;
+                T.mVal[pos] = A.mVal[idx];
+            }
+        }
+    }
+
+    static void assembleLaplacian(const LaplacianOperator &A, AMGMatrix &M)
+    {
+        int nz = A.getNumNonZero();
+        M.mNumRows = M.mNumCols = A.size();
+        M.mI.resize(A.size() + 1);
+        M.mJ.resize(nz);
+        M.mVal.resize(nz);
+        A.toCSR(M.mI.data(), M.mJ.data(), M.mVal.data());
+    }
+
+    // x = x + omega * D^-1 * (b - A*x), res is a work vector
+    static void smoothJacobi(AMGLevel &level, const float *b, float *x)
+    {
+        level.mA.getCSR().apply(x, level.mRes.data());
+        const float *invDiag = level.mInvDiag.data();
+        const float *Ax = level.mRes.data();
+        float omega = level.mOmega;
+        tbb::parallel_for(tbb::blocked_range<int>(0, level.mA.mNumRows, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    x[i] += omega * invDiag[i] * (b[i] - Ax[i]);
+                }
+            });
+    }
+
+    AMGPreconditioner::AMGPreconditioner(const LaplacianOperator &A, int numSmooth, float strength)
+    {
+        mA = &A;
+        mNumSmooth = numSmooth;
+        mStrength = strength;
+        mLevels.resize(1);
+        assembleLaplacian(A, mLevels[0].mA);
+        build();
+    }
+
+    AMGPreconditioner::AMGPreconditioner(const CSRMatrix &A, int numSmooth, float strength)
+    {
+        mA = NULL;
+        mNumSmooth = numSmooth;
+        mStrength = strength;
+        mLevels.resize(1);
+        AMGMatrix &fine = mLevels[0].mA;
+        fine.mNumRows = fine.mNumCols = A.mN;
+        fine.mI.assign(A.mI, A.mI + A.mN + 1);
+        fine.mJ.assign(A.mJ, A.mJ + A.mNz);
+        fine.mVal.assign(A.mVal, A.mVal + A.mNz);
+        build();
+    }
+
+    void AMGPreconditioner::build()
+    {
+        findClosedComponents();
+        setupSmoother(mLevels[0]);
+
+        // coarsen until the level is small enough for the dense solve, or it doesn't coarsen anymore
+        // (only isolated rows, or weak connections)
+        while ( (mLevels.back().mA.mNumRows > AMG_COARSE_SIZE) && ((int)mLevels.size() < AMG_MAX_LEVELS) )
+        {
+            vector<int> aggregateOfRow;
+            float strength = mStrength * std::pow(0.5f, (float)(mLevels.size() - 1));
+            int numAggregates = aggregate(mLevels.back().mA, strength, aggregateOfRow);
+            if ( (numAggregates == 0) || (numAggregates > AMG_MAX_COARSE_RATIO * mLevels.back().mA.mNumRows) )
+            {
+                break;
+            }
+            buildProlongation(mLevels.back(), aggregateOfRow, numAggregates);
+            mLevels.push_back(AMGLevel());
+            buildCoarseLevel((int)mLevels.size() - 2);
+        }
+
+        factorCoarse();
+    }
+
+    int AMGPreconditioner::aggregate(const AMGMatrix &A, float strength, vector<int> &aggregateOfRow)
+    {
+        int N = A.mNumRows;
+        vector<float> diag(N);
+        A.getCSR().diagonal(diag.data());
+
+        auto isStrong = [&](int i, int idx)
+        {
+            int j = A.mJ[idx];
+            return (j != i) && (std::fabs(A.mVal[idx]) > strength * std::sqrt(std::fabs(diag[i] * diag[j])));
+        };
+
+        // 1: a row whose strong neighbours are all free is the root of a new aggregate with its neighbours.
+        // A row without strong neighbours (a droplet of one voxel) stays out of the coarse levels, the smoother
+        // alone solves it
+        aggregateOfRow.assign(N, -1);
+        int numAggregates = 0;
+        for (int i = 0; i < N; i++)
+        {
+            if (aggregateOfRow[i] >= 0)
+            {
+                continue;
+            }
+            bool free = true;
+            bool isolated = true;
+            for (int idx = A.mI[i]; (idx < A.mI[i+1]) && free; idx++)
+            {
+                if (isStrong(i, idx))
+                {
+                    free = aggregateOfRow[A.mJ[idx]] < 0;
+                    isolated = false;
+                }
+            }
+            if (free && !isolated)
+            {
+                aggregateOfRow[i] = numAggregates;
+                for (int idx = A.mI[i]; idx < A.mI[i+1]; idx++)
+                {
+                    if (isStrong(i, idx))
+                    {
+                        aggregateOfRow[A.mJ[idx]] = numAggregates;
+                    }
+                }
+                numAggregates++;
+            }
+        }
+
+        // 2: the rows left join the aggregate of their strongest neighbour, they all have one aggregated in 1
+        vector<int> rootAggregate(aggregateOfRow);
+        for (int i = 0; i < N; i++)
+        {
+            if (aggregateOfRow[i] >= 0)
+            {
+                continue;
+            }
+            bool isolated = true;
+            float strongest = 0.0f;
+            for (int idx = A.mI[i]; idx < A.mI[i+1]; idx++)
+            {
+                if ( isStrong(i, idx) && (rootAggregate[A.mJ[idx]] >= 0) && (std::fabs(A.mVal[idx]) > strongest) )
+                {
+                    strongest = std::fabs(A.mVal[idx]);
+                    aggregateOfRow[i] = rootAggregate[A.mJ[idx]];
+                }
+                isolated &= !isStrong(i, idx);
+            }
+            if ( (aggregateOfRow[i] < 0) && !isolated )
+            {
+                aggregateOfRow[i] = numAggregates++;
+            }
+        }
+
+        return numAggregates;
+    }
+
+    // P = (I - omega * D^-1 * A) * P0, P0 is 1 in the column of the aggregate of each row (0 for the isolated rows)
+    void AMGPreconditioner::buildProlongation(AMGLevel &level, const vector<int> &aggregateOfRow, int numAggregates)
+    {
+        const AMGMatrix &A = level.mA;
+        int N = A.mNumRows;
+        AMGMatrix &P = level.mP;
+        P.mNumRows = N;
+        P.mNumCols = numAggregates;
+        P.mI.assign(N + 1, 0);
+
+        // the row i of P has at most the columns of the row i of A plus i: computed in a temporary with this
+        // bound, then packed
+        vector<int> tempJ(A.mJ.size() + N);
+        vector<float> tempVal(A.mJ.size() + N);
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    int start = A.mI[i] + i;
+                    int count = 0;
+                    if (aggregateOfRow[i] >= 0)
+                    {
+                        tempJ[start] = aggregateOfRow[i];
+                        tempVal[start] = 1.0f;
+                        count++;
+                    }
+                    float invDiag = level.mInvDiag[i];
+                    if (invDiag == 0.0f)
+                    {
+                        P.mI[i+1] = count;
+                        continue;
+                    }
+                    for (int idx = A.mI[i]; idx < A.mI[i+1]; idx++)
+                    {
+                        int col = aggregateOfRow[A.mJ[idx]];
+                        if (col < 0)
+                        {
+                            continue;
+                        }
+                        float coef = -level.mOmega * invDiag * A.mVal[idx];
+                        int pos = start;
+                        while ( (pos < start + count) && (tempJ[pos] != col) )
+                        {
+                            pos++;
+                        }
+                        if (pos == start + count)
+                        {
+                            tempJ[pos] = col;
+                            tempVal[pos] = 0.0f;
+                            count++;
+                        }
+                        tempVal[pos] += coef;
+                    }
+                    P.mI[i+1] = count;
+                }
+            });
+
+        for (int i = 0; i < N; i++)
+        {
+            P.mI[i+1] += P.mI[i];
+        }
+        P.mJ.resize(P.mI[N]);
+        P.mVal.resize(P.mI[N]);
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    int start = A.mI[i] + i;
+                    std::copy(tempJ.begin() + start, tempJ.begin() + start + (P.mI[i+1] - P.mI[i]), P.mJ.begin() + P.mI[i]);
+                    std::copy(tempVal.begin() + start, tempVal.begin() + start + (P.mI[i+1] - P.mI[i]), P.mVal.begin() + P.mI[i]);
+                }
+            });
+    }
+
+    void AMGPreconditioner::buildCoarseLevel(int idxLevel)
+    {
+        AMGLevel &fine = mLevels[idxLevel];
+        AMGLevel &coarse = mLevels[idxLevel + 1];
+
+        transpose(fine.mP, fine.mR);
+        AMGMatrix AP;
+        multiply(fine.mA, fine.mP, AP);
+        multiply(fine.mR, AP, coarse.mA);
+
+        setupSmoother(coarse);
+        coarse.mX.resize(coarse.mA.mNumRows);
+        coarse.mB.resize(coarse.mA.mNumRows);
+    }
+
+    void AMGPreconditioner::setupSmoother(AMGLevel &level)
+    {
+        AMGMatrix &A = level.mA;
+        int N = A.mNumRows;
+        level.mInvDiag.resize(N);
+        level.mRes.resize(N);
+        A.getCSR().diagonal(level.mInvDiag.data());
+
+        float rho = tbb::parallel_reduce(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE), 0.0f,
+            [&](const tbb::blocked_range<int> &range, float maxSum)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    float diag = level.mInvDiag[i];
+                    level.mInvDiag[i] = (diag != 0.0f) ? 1.0f / diag : 0.0f;
+                    float sum = 0.0f;
+                    for (int idx = A.mI[i]; idx < A.mI[i+1]; idx++)
+                    {
+                        sum += std::fabs(A.mVal[idx]);
+                    }
+                    maxSum = std::max(maxSum, sum * std::fabs(level.mInvDiag[i]));
+                }
+                return maxSum;
+            },
+            [](float a, float b) { return std::max(a, b); });
+
+        level.mOmega = (rho > 0.0f) ? (4.0f / 3.0f) / rho : 1.0f;
+    }
+
+    void AMGPreconditioner::factorCoarse()
+    {
+        const AMGMatrix &A = mLevels.back().mA;
+        int n = A.mNumRows;
+        mCoarseL.assign((size_t)n * n, 0.0);
+        mCoarseInvD.assign(n, 0.0);
+        mCoarseX.resize(n);
+        vector<double> D(n, 0.0);
+
+        for (int i = 0; i < n; i++)
+        {
+            for (int idx = A.mI[i]; idx < A.mI[i+1]; idx++)
+            {
+                if (A.mJ[idx] <= i)
+                {
+                    mCoarseL[(size_t)i * n + A.mJ[idx]] += A.mVal[idx];
+                }
+            }
+        }
+
+        // column k: pivot D[k], then L[i][k] for i > k, the lower triangle of A is overwritten by L
+        for (int k = 0; k < n; k++)
+        {
+            double *rowK = &mCoarseL[(size_t)k * n];
+            double diag = rowK[k];
+            double pivot = diag;
+            for (int m = 0; m < k; m++)
+            {
+                pivot -= rowK[m] * rowK[m] * D[m];
+            }
+            rowK[k] = 1.0;
+            if ( !(pivot > AMG_NULL_PIVOT * std::fabs(diag)) )
+            {
+                // null direction: the column of L is 0 and the coarse solution has 0 along it. A large
+                // correction along the constant of a closed component would only add rounding to x.
+                // The V-cycle is still positive definite, its smoothing part is
+                for (int i = k + 1; i < n; i++)
+                {
+                    mCoarseL[(size_t)i * n + k] = 0.0;
+                }
+                continue;
+            }
+            D[k] = pivot;
+            mCoarseInvD[k] = 1.0 / pivot;
+            for (int i = k + 1; i < n; i++)
+            {
+                double *rowI = &mCoarseL[(size_t)i * n];
+                double sum = rowI[k];
+                for (int m = 0; m < k; m++)
+                {
+                    sum -= rowI[m] * rowK[m] * D[m];
+                }
+                rowI[k] = sum / pivot;
+            }
+        }
+    }
+
+    void AMGPreconditioner::solveCoarse(const float *b, float *x)
+    {
+        int n = (int)mCoarseInvD.size();
+        double *y = mCoarseX.data();
+        for (int i = 0; i < n; i++)
+        {
+            const double *rowI = &mCoarseL[(size_t)i * n];
+            double sum = b[i];
+            for (int m = 0; m < i; m++)
+            {
+                sum -= rowI[m] * y[m];
+            }
+            y[i] = sum;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            y[i] *= mCoarseInvD[i];
+        }
+        for (int i = n - 1; i >= 0; i--)
+        {
+            for (int m = i + 1; m < n; m++)
+            {
+                y[i] -= mCoarseL[(size_t)m * n + i] * y[m];
+            }
+            x[i] = (float)y[i];
+        }
+    }
+
+    void AMGPreconditioner::vCycle(int idxLevel, const float *b, float *x)
+    {
+        if (idxLevel == (int)mLevels.size() - 1)
+        {
+            solveCoarse(b, x);
+            return;
+        }
+
+        AMGLevel &level = mLevels[idxLevel];
+        AMGLevel &coarse = mLevels[idxLevel + 1];
+        int N = level.mA.mNumRows;
+        float *res = level.mRes.data();
+
+        // pre smoothing, the first sweep from x = 0
+        const float *invDiag = level.mInvDiag.data();
+        float omega = level.mOmega;
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    x[i] = omega * invDiag[i] * b[i];
+                }
+            });
+        for (int sweep = 1; sweep < mNumSmooth; sweep++)
+        {
+            smoothJacobi(level, b, x);
+        }
+
+        // coarse correction of the residual
+        level.mA.getCSR().apply(x, res);
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    res[i] = b[i] - res[i];
+                }
+            });
+        level.mR.getCSR().apply(res, coarse.mB.data());
+        vCycle(idxLevel + 1, coarse.mB.data(), coarse.mX.data());
+        level.mP.getCSR().apply(coarse.mX.data(), res);
+        cpuAxpy(1.0f, res, x, N);
+
+        // post smoothing
+        for (int sweep = 0; sweep < mNumSmooth; sweep++)
+        {
+            smoothJacobi(level, b, x);
+        }
+    }
+
+    void AMGPreconditioner::findClosedComponents()
+    {
+        const AMGMatrix &A = mLevels[0].mA;
+        int N = A.mNumRows;
+        mClosedComponentOfRow.assign(N, -1);
+        mClosedComponentSize.clear();
+
+        // depth first visit of each component, numbered only if all its row sums are 0
+        vector<uint8_t> visited(N, 0);
+        vector<int> stack;
+        vector<int> rows;
+        for (int seed = 0; seed < N; seed++)
+        {
+            if (visited[seed])
+            {
+                continue;
+            }
+            bool closed = true;
+            rows.clear();
+            stack.push_back(seed);
+            visited[seed] = 1;
+            while (!stack.empty())
+            {
+                int row = stack.back();
+                stack.pop_back();
+                rows.push_back(row);
+                float rowSum = 0.0f;
+                float diag = 0.0f;
+                for (int idx = A.mI[row]; idx < A.mI[row+1]; idx++)
+                {
+                    int col = A.mJ[idx];
+                    rowSum += A.mVal[idx];
+                    if (col == row)
+                    {
+                        diag = A.mVal[idx];
+                    }
+                    else if (!visited[col])
+                    {
+                        visited[col] = 1;
+                        stack.push_back(col);
+                    }
+                }
+                closed &= std::fabs(rowSum) <= 1e-6f * std::fabs(diag);
+            }
+            if (closed)
+            {
+                for (size_t idx = 0; idx < rows.size(); idx++)
+                {
+                    mClosedComponentOfRow[rows[idx]] = (int)mClosedComponentSize.size();
+                }
+                mClosedComponentSize.push_back((int)rows.size());
+            }
+        }
+
+        if (!mClosedComponentSize.empty())
+        {
+            mProjectedRhs.resize(N);
+        }
+    }
+
+    void AMGPreconditioner::removeClosedMean(float *v)
+    {
+        int N = mLevels[0].mA.mNumRows;
+        int numClosed = (int)mClosedComponentSize.size();
+        const int *componentOfRow = mClosedComponentOfRow.data();
+
+        vector<double> sum = tbb::parallel_reduce(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE), vector<double>(numClosed, 0.0),
+            [&](const tbb::blocked_range<int> &range, vector<double> partial)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    if (componentOfRow[i] >= 0)
+                    {
+                        partial[componentOfRow[i]] += v[i];
+                    }
+                }
+                return partial;
+            },
+            [](vector<double> a, const vector<double> &b)
+            {
+                for (size_t c = 0; c < a.size(); c++)
+                {
+                    a[c] += b[c];
+                }
+                return a;
+            });
+
+        vector<float> mean(numClosed);
+        for (int c = 0; c < numClosed; c++)
+        {
+            mean[c] = (float)(sum[c] / mClosedComponentSize[c]);
+        }
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    if (componentOfRow[i] >= 0)
+                    {
+                        v[i] -= mean[componentOfRow[i]];
+                    }
+                }
+            });
+    }
+
+    void AMGPreconditioner::apply(const float *r, float *z)
+    {
+        if (mClosedComponentSize.empty())
+        {
+            vCycle(0, r, z);
+            return;
+        }
+
+        // z = Q*V*Q*r, Q the projection out of the constants of the closed components, still symmetric
+        std::copy(r, r + mLevels[0].mA.mNumRows, mProjectedRhs.begin());
+        removeClosedMean(mProjectedRhs.data());
+        vCycle(0, mProjectedRhs.data(), z);
+        removeClosedMean(z);
+    }
+
+    // all the prolongation rows are copied from their source row, so the changed rows are not needed
+    bool AMGPreconditioner::update(const vector<int> &oldRowOfRow, const vector<int> &)
+    {
+        if ( (mA == NULL) || (mLevels.size() < 2) )
+        {
+            return false;
+        }
+
+        AMGLevel &fine = mLevels[0];
+        AMGMatrix oldP;
+        std::swap(oldP, fine.mP);
+        assembleLaplacian(*mA, fine.mA);
+        findClosedComponents();
+        setupSmoother(fine);
+        int N = fine.mA.mNumRows;
+
+        // old row whose prolongation row is taken by each row, -1 for none (only smoothed)
+        vector<int> sourceRow(N);
+        AMGMatrix &P = fine.mP;
+        P.mNumRows = N;
+        P.mNumCols = oldP.mNumCols;
+        P.mI.assign(N + 1, 0);
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    int source = oldRowOfRow[row];
+                    for (int idx = fine.mA.mI[row]; (idx < fine.mA.mI[row+1]) && (source < 0); idx++)
+                    {
+                        source = oldRowOfRow[fine.mA.mJ[idx]];
+                    }
+                    sourceRow[row] = source;
+                    P.mI[row+1] = (source >= 0) ? oldP.mI[source+1] - oldP.mI[source] : 0;
+                }
+            });
+        for (int row = 0; row < N; row++)
+        {
+            P.mI[row+1] += P.mI[row];
+        }
+        P.mJ.resize(P.mI[N]);
+        P.mVal.resize(P.mI[N]);
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    int source = sourceRow[row];
+                    if (source >= 0)
+                    {
+                        std::copy(oldP.mJ.begin() + oldP.mI[source], oldP.mJ.begin() + oldP.mI[source+1], P.mJ.begin() + P.mI[row]);
+                        std::copy(oldP.mVal.begin() + oldP.mI[source], oldP.mVal.begin() + oldP.mI[source+1], P.mVal.begin() + P.mI[row]);
+                    }
+                }
+            });
+
+        for (int idxLevel = 0; idxLevel < (int)mLevels.size() - 1; idxLevel++)
+        {
+            buildCoarseLevel(idxLevel);
+        }
+        factorCoarse();
+        return true;
+    }
+
+    float AMGPreconditioner::getOperatorComplexity() const
+    {
+        size_t nz = 0;
+        for (size_t idx = 0; idx < mLevels.size(); idx++)
+        {
+            nz += mLevels[idx].mA.mJ.size();
+        }
+        return mLevels[0].mA.mJ.empty() ? 1.0f : (float)nz / mLevels[0].mA.mJ.size();
+    }
+
+}
@@ -0,0 +1,150 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef AMG_PRECONDITIONER_H_
+#define AMG_PRECONDITIONER_H_
+
+#include <vector>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+
+#include "common.h"
+#include "log.h"
+#include "sparse_solver_cpu.h"
+#include "laplacian.h"
+
+// Connection a_ij is strong when |a_ij| > AMG_STRENGTH * sqrt(|a_ii * a_jj|)
+#define AMG_STRENGTH 0.08f
+// The coarsest level is solved with a dense factorization when it has at most these rows
+#define AMG_COARSE_SIZE 400
+// Maximum number of levels, the finest included
+#define AMG_MAX_LEVELS 16
+
+using namespace std;
+
+namespace yapfs
+{
+
+    // Sparse matrix of an algebraic multigrid level in CSR format, it owns its arrays.
+    // The matrices are rectangular for the prolongation and the restriction
+    struct AMGMatrix
+    {
+        vector<int>   mI;
+        vector<int>   mJ;
+        vector<float> mVal;
+        int           mNumRows;
+        int           mNumCols;
+
+        AMGMatrix(): mNumRows(0), mNumCols(0) {}
+
+        // wrapper used for the parallel product y = M*x, x of size mNumCols and y of size mNumRows
+        CSRMatrix getCSR() const
+        {
+            return CSRMatrix(const_cast<int *>(mI.data()), const_cast<int *>(mJ.data()), const_cast<float *>(mVal.data()), mNumRows, (int)mJ.size());
+        }
+    };
+
+    // Level of the algebraic multigrid hierarchy: matrix, damped Jacobi smoother and the transfer to the next level
+    struct AMGLevel
+    {
+        AMGMatrix     mA;
+        AMGMatrix     mP; // prolongation from the next level, mA.mNumRows x next mA.mNumRows
+        AMGMatrix     mR; // restriction, transpose of mP
+        vector<float> mInvDiag; // 0 for the empty rows
+        float         mOmega; // Jacobi weight 4/3 / rho(D^-1 * A), rho bounded by the largest absolute row sum of D^-1 * A
+        vector<float> mX; // solution, rhs and residual of the coarse levels
+        vector<float> mB;
+        vector<float> mRes;
+    };
+
+    // Smoothed aggregation algebraic multigrid V-cycle used as preconditioner of the conjugate gradient
+    // (Vanek, Mandel and Brezina, Computing 1996). Works on the matrix only, so fragmented fluid (thin sheets,
+    // splashes, droplets) coarsens as well as bulk water, where the geometric multigrid merges the voxels
+    // of different components. Each level groups the strongly connected rows in aggregates around a root row,
+    // the tentative prolongation is the piecewise constant on the aggregates, smoothed by one damped Jacobi step,
+    // and the coarse matrix is the Galerkin product R*A*P with R = P^T. Pre and post smoothing are the same
+    // damped Jacobi sweeps, so the V-cycle is symmetric; the coarsest level is solved by a dense LDL^T that
+    // skips the null pivots; the constant of the closed components (pure Neumann, singular) is projected out.
+    class AMGPreconditioner : public Preconditioner
+    {
+        public:
+            const LaplacianOperator *mA; // NULL when built from a CSR matrix, then it can't be updated
+            vector<AMGLevel> mLevels;
+            int mNumSmooth; // Jacobi sweeps before and after the coarse correction
+            float mStrength; // strength threshold of the finest level, halved at each coarser level
+
+            // dense LDL^T of the coarsest matrix, L stored by rows below the unit diagonal
+            vector<double> mCoarseL;
+            vector<double> mCoarseInvD;
+            vector<double> mCoarseX;
+
+            // connected components of the finest matrix without air (zero row sums): the constant of each is
+            // removed from the rhs and from the result of the V-cycle, that would amplify it in float
+            vector<int>   mClosedComponentOfRow; // -1 for the rows of the components with air
+            vector<int>   mClosedComponentSize;
+            vector<float> mProjectedRhs;
+
+            AMGPreconditioner(const LaplacianOperator &A, int numSmooth = 2, float strength = AMG_STRENGTH);
+            // A is copied, columns of each row in any order
+            AMGPreconditioner(const CSRMatrix &A, int numSmooth = 2, float strength = AMG_STRENGTH);
+
+            // z = V-cycle(r) starting from z = 0
+            void apply(const float *r, float *z);
+
+            // The aggregates and the prolongations are kept: the fine matrix is assembled again from mA, the
+            // prolongation rows follow their voxel (a new row takes the row of an old fluid neighbour) and the
+            // coarse matrices are the Galerkin products of the kept prolongations, cheaper than a new setup
+            bool update(const vector<int> &oldRowOfRow, const vector<int> &changedRows);
+
+            int getNumLevels() const { return (int)mLevels.size(); }
+            // total non zero of all the levels over the non zero of the finest
+            float getOperatorComplexity() const;
+
+        private:
+            void build();
+            void findClosedComponents();
+            // v = v - mean of v on each closed component
+            void removeClosedMean(float *v);
+            // aggregate of each row of the level, returns the number of aggregates
+            int aggregate(const AMGMatrix &A, float strength, vector<int> &aggregateOfRow);
+            void buildProlongation(AMGLevel &level, const vector<int> &aggregateOfRow, int numAggregates);
+            // A, smoother and work vectors of level idxLevel + 1 from the Galerkin product of level idxLevel
+            void buildCoarseLevel(int idxLevel);
+            void setupSmoother(AMGLevel &level);
+            void factorCoarse();
+            void solveCoarse(const float *b, float *x);
+            void vCycle(int idxLevel, const float *b, float *x);
+    };
+
+}
+
+#endif /* AMG_PRECONDITIONER_H_ */
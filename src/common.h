@@ -30,8 +30,16 @@
 // Enable log on debug level, comment to switch off debug level log
 #define LOG_DEBUG
 
-#define LReal double
-//#define LReal float
+// Scalar of the computations and of the configs
+typedef double LReal;
+
+// Scalar stored in the grids and in the particles of the solver: float with -DUSE_SINGLE_PRECISION=ON, half the
+// memory and the bandwidth of the stages, while the computations on the values read stay in LReal
+#ifdef YAPFS_SINGLE_PRECISION
+typedef float LStoreReal;
+#else
+typedef double LStoreReal;
+#endif
 
 #define MIN_CONST 1e-16
 #define PI_CONST 3.14159265358979323846
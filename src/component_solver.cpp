@@ -0,0 +1,254 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#include <algorithm>
+
+#include "component_solver.h"
+
+namespace yapfs
+{
+
+    void FluidComponents::build(const LaplacianOperator &A)
+    {
+        int N = A.size();
+        int numComponents = A.labelComponents(mComponentOfRow);
+
+        // rows grouped by component in row order
+        mStart.assign(numComponents + 1, 0);
+        for (int row = 0; row < N; row++)
+        {
+            mStart[mComponentOfRow[row] + 1]++;
+        }
+        for (int c = 0; c < numComponents; c++)
+        {
+            mStart[c+1] += mStart[c];
+        }
+        mRows.resize(N);
+        vector<int> next(mStart.begin(), mStart.end() - 1);
+        for (int row = 0; row < N; row++)
+        {
+            mRows[next[mComponentOfRow[row]]++] = row;
+        }
+    }
+
+    ComponentSystems::~ComponentSystems()
+    {
+        clear();
+    }
+
+    void ComponentSystems::clear()
+    {
+        for (size_t c = 0; c < mA.size(); c++)
+        {
+            delete mPreconditioner[c];
+            delete mA[c];
+        }
+        mA.clear();
+        mPreconditioner.clear();
+    }
+
+    // worse stop reason first: max iterations, breakdown, converged, converged initially
+    static int getStopReasonRank(SolverStopReason reason)
+    {
+        switch (reason)
+        {
+            case SOLVER_MAX_ITERATIONS: return 3;
+            case SOLVER_BREAKDOWN: return 2;
+            case SOLVER_CONVERGED: return 1;
+            default: return 0;
+        }
+    }
+
+    int solveComponentsCPU(const LaplacianOperator &A, const FluidComponents &components, float *x, const float *rhs,
+                           PreconditionerFactory createPreconditioner, const SolverTolerance &tolerance,
+                           bool singleReduction, bool verify, SolverStats *stats, ComponentSystems *systems)
+    {
+        int N = A.size();
+        int numComponents = components.size();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        if ( (systems != NULL) && ((int)systems->mA.size() != numComponents) )
+        {
+            systems->clear();
+            systems->mA.assign(numComponents, NULL);
+            systems->mPreconditioner.assign(numComponents, NULL);
+        }
+
+        // rhs norm of each component
+        vector<double> rhsNorm(numComponents);
+        tbb::parallel_for(tbb::blocked_range<int>(0, numComponents),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int c = range.begin(); c != range.end(); ++c)
+                {
+                    double sum = 0.0;
+                    for (int idx = components.mStart[c]; idx < components.mStart[c+1]; idx++)
+                    {
+                        sum += (double)rhs[components.mRows[idx]] * rhs[components.mRows[idx]];
+                    }
+                    rhsNorm[c] = sqrt(sum);
+                }
+            });
+
+        // largest components first, so the long solves don't start last
+        vector<int> order(numComponents);
+        for (int c = 0; c < numComponents; c++)
+        {
+            order[c] = c;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](int c1, int c2) { return components.getNumRows(c1) > components.getNumRows(c2); });
+
+        vector<SolverStats> componentStats(numComponents);
+        vector<uint8_t> solved(numComponents, 0);
+        tbb::parallel_for(tbb::blocked_range<int>(0, numComponents, 1),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int idx = range.begin(); idx != range.end(); ++idx)
+                {
+                    int c = order[idx];
+                    int Nc = components.getNumRows(c);
+                    const int *rows = &components.mRows[components.mStart[c]];
+                    SolverStats &cStats = componentStats[c];
+                    SolverTolerance cTolerance(tolerance.mRelative, tolerance.mAbsolute * (float)sqrt((double)Nc / N), tolerance.mMaxIterations);
+                    float tol = cTolerance.getTolerance(rhsNorm[c]);
+                    cStats.mTolerance = tol;
+
+                    if (rhsNorm[c] <= tol)
+                    {
+                        // no divergence to remove here
+                        for (int r = 0; r < Nc; r++)
+                        {
+                            x[rows[r]] = 0.0f;
+                        }
+                        cStats.mInitialResidual = cStats.mFinalResidual = rhsNorm[c];
+                        cStats.mStopReason = SOLVER_CONVERGED_INITIAL;
+                        continue;
+                    }
+
+                    std::chrono::steady_clock::time_point setupStart = std::chrono::steady_clock::now();
+                    LaplacianOperator *componentAPtr = (systems != NULL) ? systems->mA[c] : NULL;
+                    Preconditioner *precond = (systems != NULL) ? systems->mPreconditioner[c] : NULL;
+                    if (componentAPtr == NULL)
+                    {
+                        componentAPtr = new LaplacianOperator(0, 0, 0);
+                        componentAPtr->extractRows(A, rows, Nc);
+                        precond = createPreconditioner(*componentAPtr);
+                        if (systems != NULL)
+                        {
+                            systems->mA[c] = componentAPtr;
+                            systems->mPreconditioner[c] = precond;
+                        }
+                    }
+                    const LaplacianOperator &componentA = *componentAPtr;
+                    vector<float> xc(Nc), rhsc(Nc);
+                    for (int r = 0; r < Nc; r++)
+                    {
+                        xc[r] = x[rows[r]];
+                        rhsc[r] = rhs[rows[r]];
+                    }
+                    cStats.mSetupTime = getElapsedSeconds(setupStart);
+
+                    float residual;
+                    CGWorkspace workspace;
+                    if (singleReduction)
+                    {
+                        singleReductionConjugateGradientCPU(componentA, precond, xc.data(), rhsc.data(), tol, cTolerance.mMaxIterations, residual, &workspace, &cStats);
+                    }
+                    else
+                    {
+                        conjugateGradientCPU(componentA, precond, xc.data(), rhsc.data(), tol, cTolerance.mMaxIterations, residual, &workspace, &cStats);
+                    }
+                    cStats.mError = verify ? cpuMaxError(componentA, xc.data(), rhsc.data(), workspace.mAp.data()) : -1.0f;
+                    if (systems == NULL)
+                    {
+                        delete precond;
+                        delete componentAPtr;
+                    }
+
+                    for (int r = 0; r < Nc; r++)
+                    {
+                        x[rows[r]] = xc[r];
+                    }
+                    solved[c] = 1;
+                }
+            });
+
+        // the residual of the whole system is the 2-norm of the residuals of the components
+        int numSolved = 0;
+        if (stats != NULL)
+        {
+            double initial2 = 0.0, final2 = 0.0, rhs2 = 0.0;
+            int longest = -1;
+            if (stats->mSolver.empty())
+            {
+                stats->mSolver = "cpu";
+            }
+            stats->mN = N;
+            stats->mIterations = 0;
+            stats->mStopReason = SOLVER_CONVERGED_INITIAL;
+            stats->mError = verify ? 0.0f : -1.0f;
+            for (int c = 0; c < numComponents; c++)
+            {
+                const SolverStats &cStats = componentStats[c];
+                initial2 += cStats.mInitialResidual * cStats.mInitialResidual;
+                final2 += cStats.mFinalResidual * cStats.mFinalResidual;
+                rhs2 += rhsNorm[c] * rhsNorm[c];
+                stats->mSetupTime += cStats.mSetupTime;
+                if (getStopReasonRank(cStats.mStopReason) > getStopReasonRank(stats->mStopReason))
+                {
+                    stats->mStopReason = cStats.mStopReason;
+                }
+                if ( solved[c] && ((longest < 0) || (cStats.mIterations > stats->mIterations)) )
+                {
+                    longest = c;
+                    stats->mIterations = cStats.mIterations;
+                }
+                if (verify)
+                {
+                    stats->mError = std::max(stats->mError, cStats.mError);
+                }
+            }
+            stats->mInitialResidual = sqrt(initial2);
+            stats->mFinalResidual = sqrt(final2);
+            stats->mTolerance = tolerance.getTolerance(sqrt(rhs2));
+            if (longest >= 0)
+            {
+                stats->mResidualHistory = componentStats[longest].mResidualHistory;
+            }
+            // the setup times overlap with the solves of the other components, the solve time is the elapsed one
+            stats->mSolveTime += getElapsedSeconds(start);
+        }
+        for (int c = 0; c < numComponents; c++)
+        {
+            numSolved += solved[c];
+        }
+        return numSolved;
+    }
+
+}
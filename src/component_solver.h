@@ -0,0 +1,94 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef COMPONENT_SOLVER_H_
+#define COMPONENT_SOLVER_H_
+
+#include <vector>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+
+#include "common.h"
+#include "log.h"
+#include "sparse_solver_cpu.h"
+#include "laplacian.h"
+
+using namespace std;
+
+namespace yapfs
+{
+
+    // Connected components of the fluid rows of a LaplacianOperator, the rows grouped by component
+    struct FluidComponents
+    {
+        vector<int> mComponentOfRow;
+        vector<int> mStart; // rows of component c are mRows[mStart[c]]..mRows[mStart[c+1]-1], increasing
+        vector<int> mRows;
+
+        int size() const { return mStart.empty() ? 0 : (int)mStart.size() - 1; }
+        int getNumRows(int component) const { return mStart[component+1] - mStart[component]; }
+
+        void build(const LaplacianOperator &A);
+    };
+
+    // Builds the preconditioner of the system of a component
+    typedef std::function<Preconditioner *(const LaplacianOperator &A)> PreconditionerFactory;
+
+    // Extracted system and preconditioner of each component, NULL until the component is solved: kept by the
+    // caller between the solves of the same components, cleared when the components change
+    struct ComponentSystems
+    {
+        vector<LaplacianOperator *> mA;
+        vector<Preconditioner *>    mPreconditioner; // built on mA
+
+        ~ComponentSystems();
+        void clear();
+    };
+
+    // Solve A*x = rhs with an independent preconditioned conjugate gradient on each component, the components
+    // are solved concurrently (largest first) on their own extracted system and preconditioner, so a droplet stops
+    // at its own iteration count instead of the one of the whole fluid. Component c stops at
+    // max(tolerance.mAbsolute * sqrt(Nc/N), tolerance.mRelative * |rhs_c|): the residual of all the rows is within
+    // sqrt(2) of the tolerance of the whole system. A component whose rhs is already under its tolerance is skipped
+    // with x = 0 there. stats, if not NULL, gets the sum of the residuals, the largest number of iterations and the
+    // residual history of its component. systems, if not NULL, keeps the systems and the preconditioners of the
+    // components for the next solves, otherwise they are built for this solve only. Returns the number of
+    // components solved
+    int solveComponentsCPU(const LaplacianOperator &A, const FluidComponents &components, float *x, const float *rhs,
+                           PreconditionerFactory createPreconditioner, const SolverTolerance &tolerance,
+                           bool singleReduction = false, bool verify = true, SolverStats *stats = NULL,
+                           ComponentSystems *systems = NULL);
+
+}
+
+#endif /* COMPONENT_SOLVER_H_ */
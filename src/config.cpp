@@ -82,6 +82,24 @@ namespace yapfs
             desc.add_options() ("max_z",        boost::program_options::value<LReal>());
             desc.add_options() ("frames_per_sec", boost::program_options::value<uint32_t>());
             desc.add_options() ("num_frames",     boost::program_options::value<uint32_t>());
+            desc.add_options() ("pressure_solver", boost::program_options::value<std::string>()->default_value("cuda")); // cuda, cpu, sor or jacobi
+            desc.add_options() ("pressure_warm_start", boost::program_options::value<bool>()->default_value(false));
+            desc.add_options() ("pressure_preconditioner", boost::program_options::value<std::string>()->default_value("mic")); // cpu only: jacobi, mic, mic_serial, multigrid, dct or amg
+            desc.add_options() ("pressure_refactor_threshold", boost::program_options::value<LReal>()->default_value(0.02));
+            desc.add_options() ("pressure_precision", boost::program_options::value<std::string>()->default_value("float")); // float or mixed
+            desc.add_options() ("pressure_refinement_tol", boost::program_options::value<LReal>()->default_value(1e-10));
+            desc.add_options() ("pressure_relaxation_omega", boost::program_options::value<LReal>()->default_value(0.0)); // sor and jacobi only, 0: default of the method
+            desc.add_options() ("pressure_relaxation_sweeps", boost::program_options::value<uint32_t>()->default_value(200));
+            desc.add_options() ("pressure_relaxation_tol", boost::program_options::value<LReal>()->default_value(0.0)); // 0: always pressure_relaxation_sweeps
+            desc.add_options() ("pressure_cg", boost::program_options::value<std::string>()->default_value("standard")); // cpu only: standard or single_reduction
+            desc.add_options() ("pressure_operator", boost::program_options::value<std::string>()->default_value("matrix_free")); // cpu only: matrix_free, csr, symmetric_csr or sell
+            desc.add_options() ("pressure_ordering", boost::program_options::value<std::string>()->default_value("lexicographic")); // lexicographic, morton or rcm
+            desc.add_options() ("pressure_components", boost::program_options::value<bool>()->default_value(false)); // cpu only
+            desc.add_options() ("pressure_tol_relative", boost::program_options::value<LReal>()->default_value(1e-5));
+            desc.add_options() ("pressure_tol_divergence", boost::program_options::value<LReal>()->default_value(1e-4)); // volume fraction per step, 0: relative only
+            desc.add_options() ("pressure_max_iterations", boost::program_options::value<uint32_t>()->default_value(10000));
+            desc.add_options() ("pressure_verify", boost::program_options::value<bool>()->default_value(false));
+            desc.add_options() ("pressure_metrics_file", boost::program_options::value<std::string>()->default_value("")); // empty: no metrics file
 
             // reading configs
             std::ifstream settings_file( configFile.c_str() );
@@ -0,0 +1,366 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#include "dct_preconditioner.h"
+
+namespace yapfs
+{
+
+    // complex product without the inf/nan checks of std::complex operator*, the values here are always finite
+    static inline complex<double> mulComplex(const complex<double> &a, const complex<double> &b)
+    {
+        return complex<double>(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+    }
+
+    DCTPlan::DCTPlan(int n)
+    {
+        mN = n;
+        mBluestein = (n & (n - 1)) != 0;
+        mM = 1;
+        while (mM < (mBluestein ? 2 * n - 1 : n))
+        {
+            mM *= 2;
+        }
+
+        mShift.resize(n);
+        mScale.resize(n);
+        for (int k = 0; k < n; k++)
+        {
+            mShift[k] = std::polar(1.0, -M_PI * k / (2.0 * n));
+            mScale[k] = sqrt(((k == 0) ? 1.0 : 2.0) / n);
+        }
+
+        mRoots.resize(std::max(1, mM / 2));
+        for (int k = 0; k < mM / 2; k++)
+        {
+            mRoots[k] = std::polar(1.0, -2.0 * M_PI * k / mM);
+        }
+        mBitReverse.resize(mM);
+        for (int i = 0, j = 0; i < mM; i++)
+        {
+            mBitReverse[i] = j;
+            int bit = mM >> 1;
+            for (; j & bit; bit >>= 1)
+            {
+                j ^= bit;
+            }
+            j ^= bit;
+        }
+
+        if (mBluestein)
+        {
+            // k^2 mod 2n keeps the angle of the chirp exact for large k
+            mChirp.resize(n);
+            for (int64_t k = 0; k < n; k++)
+            {
+                mChirp[k] = std::polar(1.0, -M_PI * (double)((k * k) % (2 * n)) / n);
+            }
+            mChirpFFT.assign(mM, complex<double>(0.0, 0.0));
+            mChirpFFT[0] = std::conj(mChirp[0]);
+            for (int k = 1; k < n; k++)
+            {
+                mChirpFFT[k] = mChirpFFT[mM - k] = std::conj(mChirp[k]);
+            }
+            fftPow2(mChirpFFT.data(), false);
+        }
+    }
+
+    // iterative radix-2 FFT of length mM, not scaled
+    void DCTPlan::fftPow2(complex<double> *a, bool inverse) const
+    {
+        for (int i = 1; i < mM; i++)
+        {
+            if (i < mBitReverse[i])
+            {
+                std::swap(a[i], a[mBitReverse[i]]);
+            }
+        }
+
+        // the inverse uses the conjugate roots
+        double sign = inverse ? -1.0 : 1.0;
+        for (int len = 2; len <= mM; len <<= 1)
+        {
+            int half = len / 2;
+            int step = mM / len;
+            for (int k = 0; k < half; k++)
+            {
+                complex<double> w(mRoots[k * step].real(), sign * mRoots[k * step].imag());
+                for (int i = 0; i < mM; i += len)
+                {
+                    complex<double> u = a[i + k];
+                    complex<double> v = mulComplex(a[i + k + half], w);
+                    a[i + k] = u + v;
+                    a[i + k + half] = u - v;
+                }
+            }
+        }
+    }
+
+    void DCTPlan::fft(complex<double> *a, bool inverse, complex<double> *work) const
+    {
+        if (!mBluestein)
+        {
+            fftPow2(a, inverse);
+            return;
+        }
+
+        // the inverse transform is the conjugate of the forward transform of the conjugate
+        if (inverse)
+        {
+            for (int k = 0; k < mN; k++)
+            {
+                a[k] = std::conj(a[k]);
+            }
+        }
+
+        // X_k = chirp_k * sum_n (a_n * chirp_n) * conj(chirp_(k-n)): a circular convolution of length mM
+        for (int k = 0; k < mM; k++)
+        {
+            work[k] = (k < mN) ? mulComplex(a[k], mChirp[k]) : complex<double>(0.0, 0.0);
+        }
+        fftPow2(work, false);
+        for (int k = 0; k < mM; k++)
+        {
+            work[k] = mulComplex(work[k], mChirpFFT[k]);
+        }
+        fftPow2(work, true);
+        for (int k = 0; k < mN; k++)
+        {
+            a[k] = mulComplex(mChirp[k], work[k]) / (double)mM;
+        }
+
+        if (inverse)
+        {
+            for (int k = 0; k < mN; k++)
+            {
+                a[k] = std::conj(a[k]);
+            }
+        }
+    }
+
+    void DCTPlan::forward(double *data, int64_t stride, complex<double> *work) const
+    {
+        // even values in order, then the odd values reversed
+        complex<double> *v = work;
+        for (int m = 0; 2 * m < mN; m++)
+        {
+            v[m] = data[2 * m * stride];
+        }
+        for (int m = 0; 2 * m + 1 < mN; m++)
+        {
+            v[mN - 1 - m] = data[(2 * m + 1) * stride];
+        }
+
+        fft(v, false, work + mN);
+
+        for (int k = 0; k < mN; k++)
+        {
+            data[k * stride] = mScale[k] * (mShift[k].real() * v[k].real() - mShift[k].imag() * v[k].imag());
+        }
+    }
+
+    void DCTPlan::inverse(double *data, int64_t stride, complex<double> *work) const
+    {
+        // FFT of the shuffled values from the coefficients: V_k = exp(i*pi*k/(2n)) * (y_k - i*y_(n-k)), y_n = 0
+        complex<double> *v = work;
+        for (int k = 0; k < mN; k++)
+        {
+            double y = data[k * stride] / mScale[k];
+            double yReverse = (k == 0) ? 0.0 : data[(mN - k) * stride] / mScale[mN - k];
+            v[k] = mulComplex(std::conj(mShift[k]), complex<double>(y, -yReverse));
+        }
+
+        fft(v, true, work + mN);
+
+        for (int m = 0; 2 * m < mN; m++)
+        {
+            data[2 * m * stride] = v[m].real() / mN;
+        }
+        for (int m = 0; 2 * m + 1 < mN; m++)
+        {
+            data[(2 * m + 1) * stride] = v[mN - 1 - m].real() / mN;
+        }
+    }
+
+    DCTPreconditioner::DCTPreconditioner(const LaplacianOperator &A)
+    {
+        mA = &A;
+        int N = A.size();
+
+        // bounding box of the fluid rows
+        int64_t maxVoxel[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            mMin[axis] = std::numeric_limits<int64_t>::max();
+            maxVoxel[axis] = -1;
+        }
+        mExact = (N > 0);
+        for (int row = 0; row < N; row++)
+        {
+            int64_t ijk[3];
+            A.getVoxel(row, ijk[0], ijk[1], ijk[2]);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                mMin[axis] = std::min(mMin[axis], ijk[axis]);
+                maxVoxel[axis] = std::max(maxVoxel[axis], ijk[axis]);
+            }
+            // an air neighbour is not in the Neumann box operator
+            NeighbourMask m = A.mMask[row];
+            mExact &= (m & 0x3F) == ((m >> 8) & 0x3F);
+        }
+        int64_t volume = 1;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            mDim[axis] = (N > 0) ? maxVoxel[axis] - mMin[axis] + 1 : 1;
+            mMin[axis] = (N > 0) ? mMin[axis] : 0;
+            volume *= mDim[axis];
+        }
+        mExact &= (volume == N);
+
+        mBoxOfRow.resize(N);
+        for (int row = 0; row < N; row++)
+        {
+            int64_t i, j, k;
+            A.getVoxel(row, i, j, k);
+            mBoxOfRow[row] = ((i - mMin[0]) * mDim[1] + (j - mMin[1])) * mDim[2] + (k - mMin[2]);
+        }
+        mBox.resize(volume);
+
+        // 1D Neumann Laplacian of n voxels: eigenvalues 2 - 2*cos(pi*p/n) of the DCT-II basis
+        for (int axis = 0; axis < 3; axis++)
+        {
+            mPlans.push_back(DCTPlan((int)mDim[axis]));
+            mEigen[axis].resize(mDim[axis]);
+            for (int64_t p = 0; p < mDim[axis]; p++)
+            {
+                mEigen[axis][p] = 2.0 - 2.0 * cos(M_PI * p / mDim[axis]);
+            }
+        }
+    }
+
+    void DCTPreconditioner::transformAxis(int axis, bool inverse)
+    {
+        // lines along axis: stride between their values and start of line l
+        int64_t stride = (axis == 2) ? 1 : ((axis == 1) ? mDim[2] : mDim[1] * mDim[2]);
+        int64_t numLines = mBox.size() / mDim[axis];
+        const DCTPlan &plan = mPlans[axis];
+        tbb::parallel_for(tbb::blocked_range<int64_t>(0, numLines, std::max((int64_t)1, CPU_SOLVER_GRAIN_SIZE / mDim[axis])),
+            [&](const tbb::blocked_range<int64_t> &range)
+            {
+                vector<complex<double> > work(plan.getWorkSize());
+                for (int64_t line = range.begin(); line != range.end(); ++line)
+                {
+                    int64_t start;
+                    if (axis == 2)
+                    {
+                        start = line * mDim[2];
+                    }
+                    else if (axis == 1)
+                    {
+                        start = (line / mDim[2]) * mDim[1] * mDim[2] + line % mDim[2];
+                    }
+                    else
+                    {
+                        start = line;
+                    }
+
+                    if (inverse)
+                    {
+                        plan.inverse(mBox.data() + start, stride, work.data());
+                    }
+                    else
+                    {
+                        plan.forward(mBox.data() + start, stride, work.data());
+                    }
+                }
+            });
+    }
+
+    void DCTPreconditioner::apply(const float *r, float *z)
+    {
+        int N = mA->size();
+        std::fill(mBox.begin(), mBox.end(), 0.0);
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    mBox[mBoxOfRow[row]] = r[row];
+                }
+            });
+
+        for (int axis = 2; axis >= 0; axis--)
+        {
+            transformAxis(axis, false);
+        }
+
+        // the constant mode: 0 for the pseudo-inverse, otherwise the smallest non zero eigenvalue
+        double minEigen = std::numeric_limits<double>::max();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (mDim[axis] > 1)
+            {
+                minEigen = std::min(minEigen, mEigen[axis][1]);
+            }
+        }
+        double invConstant = mExact ? 0.0 : ((minEigen < std::numeric_limits<double>::max()) ? 1.0 / minEigen : 1.0);
+
+        tbb::parallel_for(tbb::blocked_range<int64_t>(0, mDim[0]),
+            [&](const tbb::blocked_range<int64_t> &range)
+            {
+                for (int64_t i = range.begin(); i != range.end(); ++i)
+                {
+                    double *slab = mBox.data() + i * mDim[1] * mDim[2];
+                    for (int64_t j = 0; j < mDim[1]; j++)
+                    {
+                        for (int64_t k = 0; k < mDim[2]; k++)
+                        {
+                            double eigen = mEigen[0][i] + mEigen[1][j] + mEigen[2][k];
+                            slab[j * mDim[2] + k] *= (eigen > 0.0) ? 1.0 / eigen : invConstant;
+                        }
+                    }
+                }
+            });
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            transformAxis(axis, true);
+        }
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    z[row] = (float)mBox[mBoxOfRow[row]];
+                }
+            });
+    }
+
+}
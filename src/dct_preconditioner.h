@@ -0,0 +1,118 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef DCT_PRECONDITIONER_H_
+#define DCT_PRECONDITIONER_H_
+
+#include <vector>
+#include <complex>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+
+#include "common.h"
+#include "log.h"
+#include "sparse_solver_cpu.h"
+#include "laplacian.h"
+
+using namespace std;
+
+namespace yapfs
+{
+
+    // Orthonormal DCT-II of length n and its inverse (DCT-III), computed with one complex FFT of length n
+    // (Makhoul, IEEE Trans. ASSP 1980). The FFT is radix-2, other lengths use the chirp-z algorithm of Bluestein
+    // on a power of two, so every length costs O(n log n)
+    class DCTPlan
+    {
+        public:
+            int mN;
+
+            DCTPlan(int n);
+
+            // in place on n values of data, spaced by stride; work must have getWorkSize() elements
+            void forward(double *data, int64_t stride, complex<double> *work) const;
+            void inverse(double *data, int64_t stride, complex<double> *work) const;
+
+            int getWorkSize() const { return mN + 2 * mM; }
+
+        private:
+            int mM; // length of the power of two FFT: mN, or the convolution length of Bluestein
+            bool mBluestein;
+            vector<complex<double> > mShift;  // exp(-i*pi*k/(2n)), DCT twiddles
+            vector<double> mScale;            // orthonormal scaling of the coefficients
+            vector<complex<double> > mRoots;  // exp(-2*pi*i*k/mM), k < mM/2
+            vector<int> mBitReverse;          // permutation of the radix-2 FFT
+            vector<complex<double> > mChirp;  // Bluestein: exp(-i*pi*k^2/n)
+            vector<complex<double> > mChirpFFT; // Bluestein: FFT of the conjugate chirp, wrapped on mM
+
+            void fftPow2(complex<double> *a, bool inverse) const;
+            // FFT of length mN, in place on a, work has 2 * mM elements
+            void fft(complex<double> *a, bool inverse, complex<double> *work) const;
+    };
+
+    // Preconditioner for tank and pool scenes: the inverse of the 7-point Laplacian on the bounding box of the fluid
+    // with Neumann walls, diagonalized by the 3D DCT-II: z = DCT^-1 * Lambda^-1 * DCT * r, O(N log N) per apply.
+    // The rows of r are placed in their voxels of the box, the other voxels are 0. When every voxel of the box is
+    // FLUID with only solid walls around (isExact) the box operator is the matrix of the system itself, and the
+    // preconditioner is its pseudo-inverse: the constant mode is set to 0, the conjugate gradient ends in one
+    // iteration. Otherwise (air, solid voxels inside the box) the constant mode gets the smallest non zero
+    // eigenvalue, so M stays symmetric positive definite.
+    class DCTPreconditioner : public Preconditioner
+    {
+        public:
+            const LaplacianOperator *mA;
+            int64_t mMin[3]; // bounding box of the fluid rows in the box of mA
+            int64_t mDim[3];
+            bool mExact;
+            vector<DCTPlan> mPlans; // one for each axis
+            vector<double> mEigen[3]; // eigenvalues of the 1D Neumann Laplacian of each axis
+            vector<double> mBox; // dense values of the bounding box, (i*mDim[1] + j)*mDim[2] + k
+            vector<int64_t> mBoxOfRow;
+
+            DCTPreconditioner(const LaplacianOperator &A);
+
+            // z = M^-1 * r
+            void apply(const float *r, float *z);
+
+            // the preconditioner is the pseudo-inverse of the system matrix
+            bool isExact() const { return mExact; }
+
+        private:
+            // DCT (or its inverse) of all the lines of mBox along axis
+            void transformAxis(int axis, bool inverse);
+    };
+
+}
+
+#endif /* DCT_PRECONDITIONER_H_ */
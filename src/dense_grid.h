@@ -0,0 +1,429 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef DENSE_GRID_H_
+#define DENSE_GRID_H_
+
+#include <vector>
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <openvdb/openvdb.h>
+
+#include <tbb/blocked_range.h>
+#include <tbb/blocked_range2d.h>
+#include <tbb/parallel_for.h>
+
+#include "common.h"
+#include "grid.h"
+
+// Layers of voxels around the box of a dense grid: the particles splat their velocity one voxel out of the box
+#define DENSE_GRID_PADDING 2
+// Minimum size in i and j of the blocks of forEachBlock, each block runs its rows of k to the end of the box
+#define DENSE_GRID_BLOCK 4
+
+using namespace openvdb;
+using namespace std;
+
+namespace yapfs
+{
+
+    // Scalar components of the values of a dense grid, stored each in its own array: one for a scalar grid,
+    // three for a Vec3 grid
+    template<typename ValueT>
+    struct DenseComponents
+    {
+        typedef ValueT ScalarT;
+        static const int Size = 1;
+
+        static ScalarT get(const ValueT &value, int c) { return value; }
+        static void set(ValueT &value, int c, ScalarT scalar) { value = scalar; }
+    };
+
+    template<typename S>
+    struct DenseComponents< openvdb::math::Vec3<S> >
+    {
+        typedef S ScalarT;
+        static const int Size = 3;
+
+        static ScalarT get(const openvdb::math::Vec3<S> &value, int c) { return value[c]; }
+        static void set(openvdb::math::Vec3<S> &value, int c, ScalarT scalar) { value[c] = scalar; }
+    };
+
+    // Handles of a dense grid, with the interface of the handles of the OpenVDB grids: the voxels are read
+    // straight from the arrays, so a handle is only the pointer to the grid
+    template<typename GridT, typename ValueT>
+    class DenseGridAccessor
+    {
+
+        GridT *mGrid;
+
+        public:
+
+            DenseGridAccessor(GridT *grid): mGrid(grid) {}
+
+            ValueT getValue(int64_t i, int64_t j, int64_t k)
+            {
+                return mGrid->getValue(i, j, k);
+            }
+
+            void setValue(ValueT value, int64_t i, int64_t j, int64_t k)
+            {
+                mGrid->setValue(value, i, j, k);
+            }
+
+    };
+
+    template<typename GridT, typename ValueT>
+    class DenseGridConstAccessor
+    {
+
+        const GridT *mGrid;
+
+        public:
+
+            DenseGridConstAccessor(const GridT *grid): mGrid(grid) {}
+
+            ValueT getValue(int64_t i, int64_t j, int64_t k)
+            {
+                return mGrid->getValue(i, j, k);
+            }
+
+    };
+
+    // Block of the dense Grid::forEachBlock: the voxels [begin, end), read and written in the arrays of the grid
+    // without the bounds check of the handles (the voxels must be inside the block)
+    template<typename GridT, typename ValueT>
+    class DenseGridBlock
+    {
+
+        GridT *mGrid;
+        Vec3i mBegin;
+        Vec3i mEnd;
+
+        public:
+
+            DenseGridBlock(GridT *grid, const Vec3i &begin, const Vec3i &end): mGrid(grid), mBegin(begin), mEnd(end) {}
+
+            const Vec3i &getBegin() const
+            {
+                return mBegin;
+            }
+
+            const Vec3i &getEnd() const
+            {
+                return mEnd;
+            }
+
+            ValueT getValue(int64_t i, int64_t j, int64_t k) const
+            {
+                return mGrid->getValueAt(mGrid->getIndex(i, j, k));
+            }
+
+            void setValue(ValueT value, int64_t i, int64_t j, int64_t k)
+            {
+                mGrid->setValueAt(value, mGrid->getIndex(i, j, k));
+            }
+
+            // the grid, for its arrays getData and getIndex
+            GridT *getGrid()
+            {
+                return mGrid;
+            }
+
+    };
+
+    // Grid stored in arrays over the box [minN, maxN] of the simulation grown by DENSE_GRID_PADDING voxels,
+    // k is the fastest index as in the box order of LaplacianOperator. Each scalar component of the values has
+    // its own array (structure of arrays), so the loops of the stages read contiguous doubles. The voxels out
+    // of the padded box read the background zero and their writes are dropped. Writes of different voxels from
+    // different threads are safe. The grid becomes an OpenVDB grid only for the export of a frame
+    template<typename T>
+    class Grid<T, DenseStorage>
+    {
+
+        typedef typename T::ValueType ValueT;
+        typedef DenseComponents<ValueT> Components;
+
+        public:
+
+            typedef typename Components::ScalarT ScalarT;
+            typedef DenseGridAccessor<Grid, ValueT> Accessor;
+            typedef DenseGridConstAccessor<Grid, ValueT> ConstAccessor;
+            typedef DenseGridBlock<Grid, ValueT> Block;
+
+            openvdb::math::Transform::Ptr mLinearTransform;
+            LReal mVoxelSize;
+
+            Grid(LReal voxelSize, const Vec3i &minN, const Vec3i &maxN)
+            {
+                mVoxelSize = voxelSize;
+                mLinearTransform =  openvdb::math::Transform::createLinearTransform(mVoxelSize);
+
+                mOrigin = Vec3i(minN.x() - DENSE_GRID_PADDING, minN.y() - DENSE_GRID_PADDING, minN.z() - DENSE_GRID_PADDING);
+                mDim = Vec3i(maxN.x() - minN.x() + 1 + 2 * DENSE_GRID_PADDING,
+                             maxN.y() - minN.y() + 1 + 2 * DENSE_GRID_PADDING,
+                             maxN.z() - minN.z() + 1 + 2 * DENSE_GRID_PADDING);
+                for (int c = 0; c < Components::Size; ++c)
+                {
+                    mData[c].assign((size_t)mDim.x() * mDim.y() * mDim.z(), ScalarT(0));
+                }
+            }
+
+            bool isInside(int64_t i, int64_t j, int64_t k) const
+            {
+                return ((uint64_t)(i - mOrigin.x()) < (uint64_t)mDim.x())
+                    && ((uint64_t)(j - mOrigin.y()) < (uint64_t)mDim.y())
+                    && ((uint64_t)(k - mOrigin.z()) < (uint64_t)mDim.z());
+            }
+
+            // Position of the voxel in the arrays, the voxel must be in the padded box
+            int64_t getIndex(int64_t i, int64_t j, int64_t k) const
+            {
+                return ((i - mOrigin.x()) * mDim.y() + (j - mOrigin.y())) * mDim.z() + (k - mOrigin.z());
+            }
+
+            void setValueAt(ValueT value, int64_t index)
+            {
+                for (int c = 0; c < Components::Size; ++c)
+                {
+                    mData[c][index] = Components::get(value, c);
+                }
+            }
+
+            ValueT getValueAt(int64_t index) const
+            {
+                ValueT value;
+                for (int c = 0; c < Components::Size; ++c)
+                {
+                    Components::set(value, c, mData[c][index]);
+                }
+                return value;
+            }
+
+            void setValue(ValueT value, int64_t i, int64_t j, int64_t k)
+            {
+                if (isInside(i, j, k))
+                {
+                    setValueAt(value, getIndex(i, j, k));
+                }
+            }
+
+            ValueT getValue(int64_t i, int64_t j, int64_t k) const
+            {
+                if (isInside(i, j, k))
+                {
+                    return getValueAt(getIndex(i, j, k));
+                }
+                return openvdb::zeroVal<ValueT>();
+            }
+
+            Accessor getAccessor()
+            {
+                return Accessor(this);
+            }
+
+            ConstAccessor getConstAccessor() const
+            {
+                return ConstAccessor(this);
+            }
+
+            // Runs kernel(block) in parallel over blocks of the box [begin, end) of voxels, that must be inside the
+            // padded box: tiles of i and j with the whole rows of k, contiguous in the arrays. A kernel writes the
+            // voxels of its block through the block and reads the other grids and the neighbours out of the block
+            // with handles, but not the voxels of other blocks of this grid
+            template<typename KernelT>
+            void forEachBlock(const Vec3i &begin, const Vec3i &end, const KernelT &kernel)
+            {
+                tbb::parallel_for(tbb::blocked_range2d<int64_t>(begin.x(), end.x(), DENSE_GRID_BLOCK, begin.y(), end.y(), DENSE_GRID_BLOCK),
+                    [&](const tbb::blocked_range2d<int64_t> &range)
+                    {
+                        Block block(this, Vec3i(range.rows().begin(), range.cols().begin(), begin.z()),
+                                    Vec3i(range.rows().end(), range.cols().end(), end.z()));
+                        kernel(block);
+                    });
+            }
+
+            // The arrays for the kernels of the stages: component c of the voxel (i, j, k) is
+            // getData(c)[getIndex(i, j, k)], the neighbours in i, j and k are getStrideX(), getStrideY() and 1 away
+            ScalarT *getData(int c)
+            {
+                return mData[c].data();
+            }
+
+            const ScalarT *getData(int c) const
+            {
+                return mData[c].data();
+            }
+
+            // lower corner and dimensions of the padded box
+            Vec3i getOrigin() const
+            {
+                return mOrigin;
+            }
+
+            Vec3i getDim() const
+            {
+                return mDim;
+            }
+
+            int64_t getStrideX() const
+            {
+                return (int64_t)mDim.y() * mDim.z();
+            }
+
+            int64_t getStrideY() const
+            {
+                return mDim.z();
+            }
+
+            Vec3d getIndexToWorld(int64_t i, int64_t j, int64_t k)
+            {
+                openvdb::Coord ijk(i, j, k);
+                return mLinearTransform->indexToWorld(ijk);
+            }
+
+            Vec3d getIndexToWorld(Vec3d indexSpacePoint)
+            {
+                return mLinearTransform->indexToWorld(indexSpacePoint);
+            }
+
+            // returns i, j, k
+            Vec3d getWorldToIndex(Vec3d worldSpacePoint)
+            {
+                return mLinearTransform->worldToIndex(worldSpacePoint);
+            }
+
+            // Trilinear interpolation of the voxel values at an index space point, as tools::BoxSampler
+            ValueT sample(const Vec3d &indexSpacePoint) const
+            {
+                int64_t i = (int64_t)std::floor(indexSpacePoint.x());
+                int64_t j = (int64_t)std::floor(indexSpacePoint.y());
+                int64_t k = (int64_t)std::floor(indexSpacePoint.z());
+                LReal fx = indexSpacePoint.x() - i;
+                LReal fy = indexSpacePoint.y() - j;
+                LReal fz = indexSpacePoint.z() - k;
+
+                ValueT value = openvdb::zeroVal<ValueT>();
+                for (int c = 0; c < Components::Size; ++c)
+                {
+                    LReal result = 0.0;
+                    for (int cx = 0; cx < 2; ++cx)
+                        for (int cy = 0; cy < 2; ++cy)
+                            for (int cz = 0; cz < 2; ++cz)
+                            {
+                                LReal weight = (cx ? fx : 1 - fx) * (cy ? fy : 1 - fy) * (cz ? fz : 1 - fz);
+                                if ((weight != 0) && isInside(i + cx, j + cy, k + cz))
+                                {
+                                    result += weight * mData[c][getIndex(i + cx, j + cy, k + cz)];
+                                }
+                            }
+                    Components::set(value, c, (ScalarT)result);
+                }
+                return value;
+            }
+
+            // All the voxels back to zero
+            void clear()
+            {
+                for (int c = 0; c < Components::Size; ++c)
+                {
+                    std::fill(mData[c].begin(), mData[c].end(), ScalarT(0));
+                }
+            }
+
+            void deepCopyFromGrid(Grid *grid)
+            {
+                mLinearTransform = grid->mLinearTransform;
+                mVoxelSize = grid->mVoxelSize;
+                mOrigin = grid->mOrigin;
+                mDim = grid->mDim;
+                for (int c = 0; c < Components::Size; ++c)
+                {
+                    mData[c] = grid->mData[c];
+                }
+            }
+
+            // The non zero voxels as the active voxels of an OpenVDB grid, for the export of a frame
+            // (the writes of a tree are not thread safe, one accessor for the whole box)
+            void exportToGrid(Grid<T> &grid) const
+            {
+                grid.clear();
+                grid.mLinearTransform = mLinearTransform;
+                grid.mVoxelSize = mVoxelSize;
+                grid.mGrid->setTransform(mLinearTransform);
+                typename Grid<T>::Accessor accessor = grid.getAccessor();
+                ValueT zero = openvdb::zeroVal<ValueT>();
+                for (int64_t i = mOrigin.x(); i < mOrigin.x() + mDim.x(); ++i)
+                    for (int64_t j = mOrigin.y(); j < mOrigin.y() + mDim.y(); ++j)
+                        for (int64_t k = mOrigin.z(); k < mOrigin.z() + mDim.z(); ++k)
+                        {
+                            ValueT value = getValue(i, j, k);
+                            if (value != zero)
+                            {
+                                accessor.setValue(value, i, j, k);
+                            }
+                        }
+            }
+
+            // The voxels of the padded box read from an OpenVDB grid, the slabs of constant i in parallel
+            void importFromGrid(const Grid<T> &grid)
+            {
+                tbb::parallel_for(tbb::blocked_range<int64_t>(mOrigin.x(), mOrigin.x() + mDim.x()),
+                    [&](const tbb::blocked_range<int64_t> &range)
+                    {
+                        typename Grid<T>::ConstAccessor accessor = grid.getConstAccessor();
+                        for (int64_t i = range.begin(); i != range.end(); ++i)
+                            for (int64_t j = mOrigin.y(); j < mOrigin.y() + mDim.y(); ++j)
+                                for (int64_t k = mOrigin.z(); k < mOrigin.z() + mDim.z(); ++k)
+                                {
+                                    setValue(accessor.getValue(i, j, k), i, j, k);
+                                }
+                    });
+            }
+
+            uint64_t getMemUsage()
+            {
+                return Components::Size * mData[0].size() * sizeof(ScalarT);
+            }
+
+        private:
+
+            Vec3i mOrigin;
+            Vec3i mDim;
+            vector<ScalarT> mData[Components::Size];
+
+    };
+
+}
+
+#endif /* DENSE_GRID_H_ */
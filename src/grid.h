@@ -37,16 +37,22 @@
 #include <chrono>
 #include <cstdlib>
 #include <cstdint>
+#include <memory>
 
 #include <sys/time.h>
 
 #include <openvdb/openvdb.h>
+#include <openvdb/tools/Interpolation.h>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/spin_mutex.h>
 
 #include "common.h"
 #include "log.h"
 #include "config.h"
 #include "utils.h"
-#include "particles.h"
 
 using namespace openvdb;
 using namespace std;
@@ -54,16 +60,130 @@ using namespace std;
 namespace yapfs
 {
 
-    template<typename T>
+    // Handle of a Grid for the loops over many voxels: it keeps the node cache of its OpenVDB accessor between
+    // the calls. A handle belongs to one thread, parallel loops take one handle for each task
+    template<typename AccessorT, typename ValueT>
+    class GridAccessor
+    {
+
+        AccessorT mAccessor;
+
+        public:
+
+            GridAccessor(const AccessorT &accessor): mAccessor(accessor) {}
+
+            ValueT getValue(int64_t i, int64_t j, int64_t k)
+            {
+                return mAccessor.getValue(openvdb::Coord(i, j, k));
+            }
+
+            void setValue(ValueT value, int64_t i, int64_t j, int64_t k)
+            {
+                mAccessor.setValue(openvdb::Coord(i, j, k), value);
+            }
+
+    };
+
+    template<typename AccessorT, typename ValueT>
+    class GridConstAccessor
+    {
+
+        AccessorT mAccessor;
+
+        public:
+
+            GridConstAccessor(const AccessorT &accessor): mAccessor(accessor) {}
+
+            ValueT getValue(int64_t i, int64_t j, int64_t k)
+            {
+                return mAccessor.getValue(openvdb::Coord(i, j, k));
+            }
+
+    };
+
+    // Block of Grid::forEachBlock: the voxels [begin, end) of a leaf node, read and written straight in the
+    // buffer of the leaf (the voxels must be inside the block)
+    template<typename LeafT, typename ValueT>
+    class GridLeafBlock
+    {
+
+        LeafT *mLeaf;
+        Vec3i mBegin;
+        Vec3i mEnd;
+
+        public:
+
+            GridLeafBlock(LeafT *leaf, const Vec3i &begin, const Vec3i &end): mLeaf(leaf), mBegin(begin), mEnd(end) {}
+
+            const Vec3i &getBegin() const
+            {
+                return mBegin;
+            }
+
+            const Vec3i &getEnd() const
+            {
+                return mEnd;
+            }
+
+            ValueT getValue(int64_t i, int64_t j, int64_t k) const
+            {
+                return mLeaf->getValue(LeafT::coordToOffset(openvdb::Coord(i, j, k)));
+            }
+
+            void setValue(ValueT value, int64_t i, int64_t j, int64_t k)
+            {
+                mLeaf->setValueOn(LeafT::coordToOffset(openvdb::Coord(i, j, k)), value);
+            }
+
+            // the leaf node, its buffer holds the values of the voxels at LeafT::coordToOffset
+            LeafT *getLeaf()
+            {
+                return mLeaf;
+            }
+
+    };
+
+    // Storage of the voxels of a Grid: SparseStorage in an OpenVDB tree, DenseStorage in padded arrays over a
+    // fixed box (dense_grid.h)
+    struct SparseStorage {};
+    struct DenseStorage {};
+
+    // OpenVDB types of the values stored with the scalar RealT, float or double
+    template<typename RealT>
+    struct RealGridTypes;
+
+    template<>
+    struct RealGridTypes<float>
+    {
+        typedef openvdb::FloatGrid ScalarGrid;
+        typedef openvdb::Vec3SGrid VectorGrid;
+        typedef openvdb::Vec3s Vec3Type;
+    };
+
+    template<>
+    struct RealGridTypes<double>
+    {
+        typedef openvdb::DoubleGrid ScalarGrid;
+        typedef openvdb::Vec3DGrid VectorGrid;
+        typedef openvdb::Vec3d Vec3Type;
+    };
+
+    template<typename T, typename Storage = SparseStorage>
     class Grid
     {
 
         typedef typename T::Ptr GridTypePtr;
         typedef typename T::Accessor AccessorType;
+        typedef typename T::ConstAccessor ConstAccessorType;
         typedef typename T::ValueType ValueT;
+        typedef typename T::TreeType::LeafNodeType LeafType;
 
         public:
 
+            typedef GridAccessor<AccessorType, ValueT> Accessor;
+            typedef GridConstAccessor<ConstAccessorType, ValueT> ConstAccessor;
+            typedef GridLeafBlock<LeafType, ValueT> Block;
+
             GridTypePtr mGrid;
             openvdb::math::Transform::Ptr mLinearTransform;
             LReal mVoxelSize;
@@ -82,18 +202,86 @@ namespace yapfs
 
             }
 
+            // The box of the simulation is only needed by the dense storage, a tree grows where the voxels are set
+            Grid(LReal voxelSize, const Vec3i &minN, const Vec3i &maxN): Grid(voxelSize)
+            {
+            }
+
+            // The copy shares the tree of grid (as the copy of mGrid does), the accessors of the threads are not copied
+            Grid(const Grid &grid): mGrid(grid.mGrid), mLinearTransform(grid.mLinearTransform), mVoxelSize(grid.mVoxelSize)
+            {
+            }
+
+            Grid &operator=(const Grid &grid)
+            {
+                if (this != &grid)
+                {
+                    mThreadAccessors.clear();
+                    mGrid = grid.mGrid;
+                    mLinearTransform = grid.mLinearTransform;
+                    mVoxelSize = grid.mVoxelSize;
+                }
+                return *this;
+            }
+
+            // getValue and setValue use an accessor cached for the calling thread, so a sequence of near voxels
+            // reuses its nodes. Any number of threads can call getValue together; setValue calls are serialized
+            // by a lock since the writes of an OpenVDB tree are not thread safe, and they must not run together
+            // with getValue calls of other threads on the same grid
             void setValue(ValueT value, int64_t i, int64_t j, int64_t k)
             {
-                AccessorType accessor = mGrid->getAccessor(); //TODO: Create one accessor per thread
-                openvdb::Coord ijk(i, j, k);
-                accessor.setValue(ijk, value);
+                AccessorType &accessor = getThreadAccessor();
+                tbb::spin_mutex::scoped_lock lock(mWriteMutex);
+                accessor.setValue(openvdb::Coord(i, j, k), value);
             }
 
             ValueT getValue(int64_t i, int64_t j, int64_t k)
             {
-                AccessorType accessor = mGrid->getAccessor(); //TODO: Create one accessor per thread
-                openvdb::Coord ijk(i, j, k);
-                return accessor.getValue(ijk);
+                return getThreadAccessor().getValue(openvdb::Coord(i, j, k));
+            }
+
+            // Handles for the loops over many voxels, without the lookup of the thread and the lock of
+            // getValue and setValue: one for each thread, and the handles that write must not run together
+            // with any other access to the grid
+            Accessor getAccessor()
+            {
+                return Accessor(mGrid->getAccessor());
+            }
+
+            ConstAccessor getConstAccessor() const
+            {
+                return ConstAccessor(mGrid->getConstAccessor());
+            }
+
+            // Runs kernel(block) in parallel over the leaf nodes that cover the box [begin, end) of voxels, the block
+            // of a leaf is its part inside the box. All the leaves are created before the parallel pass, so the tasks
+            // do not change the tree and a kernel can write every voxel of its block through the block: the blocks
+            // never overlap. The other grids and the neighbours out of the block are read with handles taken in the
+            // kernel, but a kernel must not read the voxels of other blocks of this grid, they are being written
+            template<typename KernelT>
+            void forEachBlock(const Vec3i &begin, const Vec3i &end, const KernelT &kernel)
+            {
+                const int leafDim = LeafType::DIM;
+                vector<LeafType *> leaves;
+                for (int x = begin.x() & ~(leafDim - 1); x < end.x(); x += leafDim)
+                    for (int y = begin.y() & ~(leafDim - 1); y < end.y(); y += leafDim)
+                        for (int z = begin.z() & ~(leafDim - 1); z < end.z(); z += leafDim)
+                        {
+                            leaves.push_back(mGrid->tree().touchLeaf(openvdb::Coord(x, y, z)));
+                        }
+
+                tbb::parallel_for(tbb::blocked_range<size_t>(0, leaves.size()),
+                    [&](const tbb::blocked_range<size_t> &range)
+                    {
+                        for (size_t n = range.begin(); n != range.end(); ++n)
+                        {
+                            openvdb::Coord origin = leaves[n]->origin();
+                            Vec3i blockBegin(std::max(origin.x(), begin.x()), std::max(origin.y(), begin.y()), std::max(origin.z(), begin.z()));
+                            Vec3i blockEnd(std::min(origin.x() + leafDim, end.x()), std::min(origin.y() + leafDim, end.y()), std::min(origin.z() + leafDim, end.z()));
+                            Block block(leaves[n], blockBegin, blockEnd);
+                            kernel(block);
+                        }
+                    });
             }
 
             // share/doc/openvdb/html/transformsAndMaps.html
@@ -114,7 +302,14 @@ namespace yapfs
                 return mLinearTransform->worldToIndex(worldSpacePoint);
             }
 
+            // Trilinear interpolation of the voxel values at an index space point
+            ValueT sample(const Vec3d &indexSpacePoint)
+            {
+                return tools::BoxSampler::sample(mGrid->tree(), indexSpacePoint);
+            }
+
             // Empty this grid, so that all voxels become inactive background voxels
+            // (the tree clears the node caches of all its accessors)
             void clear()
             {
                 mGrid->clear();
@@ -122,19 +317,45 @@ namespace yapfs
 
             void deepCopyFromGrid(Grid *grid)
             {
+                mThreadAccessors.clear();
                 mGrid = grid->mGrid->deepCopy();
                 mLinearTransform = grid->mLinearTransform;
                 mVoxelSize = grid->mVoxelSize;
             }
 
+            // Copy of the voxels in grid for the export of a frame (the dense storage converts its arrays)
+            void exportToGrid(Grid &grid)
+            {
+                grid.deepCopyFromGrid(this);
+            }
+
             uint64_t getMemUsage()
             {
                 return mGrid->memUsage();
             }
 
+        private:
+
+            // One accessor for each thread that calls getValue or setValue, created at the first call of the
+            // thread and released when mGrid gets another tree. Declared after mGrid: the accessors unregister
+            // from the tree before it is destroyed
+            tbb::enumerable_thread_specific< std::unique_ptr<AccessorType> > mThreadAccessors;
+            tbb::spin_mutex mWriteMutex;
+
+            AccessorType &getThreadAccessor()
+            {
+                std::unique_ptr<AccessorType> &accessor = mThreadAccessors.local();
+                if (!accessor)
+                {
+                    accessor.reset(new AccessorType(mGrid->tree()));
+                }
+                return *accessor;
+            }
+
     };
 
 
+
 }
 
 #endif /* GRID_H_ */
\ No newline at end of file
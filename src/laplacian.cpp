@@ -0,0 +1,650 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#include "laplacian.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <tbb/parallel_sort.h>
+
+namespace yapfs
+{
+
+    // number of bits set in a 6 bits value
+    static const uint8_t _bitCount6[64] = {
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+        1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+        2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6 };
+
+    static inline float getDiagonal(NeighbourMask mask)
+    {
+        return (float)_bitCount6[(mask >> 8) & 0x3F];
+    }
+
+    // Count pass of a parallel assembly: the items of the blocks of blockSize rows are counted in parallel,
+    // returns their prefix sum, numBlocks + 1 values with the total at the end
+    template<typename CountRow>
+    static vector<int> countBlocks(int N, int blockSize, CountRow countRow)
+    {
+        int numBlocks = (N + blockSize - 1) / blockSize;
+        vector<int> blockStart(numBlocks + 1, 0);
+        tbb::parallel_for(tbb::blocked_range<int>(0, numBlocks),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int block = range.begin(); block != range.end(); ++block)
+                {
+                    int count = 0;
+                    int end = std::min(N, (block + 1) * blockSize);
+                    for (int row = block * blockSize; row < end; row++)
+                    {
+                        count += countRow(row);
+                    }
+                    blockStart[block + 1] = count;
+                }
+            });
+        for (int block = 0; block < numBlocks; block++)
+        {
+            blockStart[block + 1] += blockStart[block];
+        }
+        return blockStart;
+    }
+
+    // Fill pass: each block of rows is filled concurrently from its start, fillRow(row, idx) writes the items of
+    // row from idx and returns the index after them. I, if not NULL, gets the start of each row and the total
+    template<typename FillRow>
+    static void fillBlocks(int N, int blockSize, const vector<int> &blockStart, int *I, FillRow fillRow)
+    {
+        int numBlocks = (int)blockStart.size() - 1;
+        tbb::parallel_for(tbb::blocked_range<int>(0, numBlocks),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int block = range.begin(); block != range.end(); ++block)
+                {
+                    int idx = blockStart[block];
+                    int end = std::min(N, (block + 1) * blockSize);
+                    for (int row = block * blockSize; row < end; row++)
+                    {
+                        if (I != NULL)
+                        {
+                            I[row] = idx;
+                        }
+                        idx = fillRow(row, idx);
+                    }
+                }
+            });
+        if (I != NULL)
+        {
+            I[N] = blockStart[numBlocks];
+        }
+    }
+
+    LaplacianOperator::LaplacianOperator(int64_t numX, int64_t numY, int64_t numZ)
+    {
+        mNumX = mNumY = mNumZ = 0;
+        reset(numX, numY, numZ);
+    }
+
+    void LaplacianOperator::reset(int64_t numX, int64_t numY, int64_t numZ)
+    {
+        if ( (numX == mNumX) && (numY == mNumY) && (numZ == mNumZ) )
+        {
+            // same box: only the voxels of the previous rows have to be cleared
+            for (size_t row = 0; row < mVoxelOfRow.size(); row++)
+            {
+                mRowOfVoxel[mVoxelOfRow[row]] = -1;
+            }
+        }
+        else
+        {
+            mRowOfVoxel.assign(numX*numY*numZ, -1);
+        }
+        mVoxelOfRow.clear();
+        mMask.clear();
+        mOrdering = ROW_ORDER_LEXICOGRAPHIC;
+
+        mNumX = numX;
+        mNumY = numY;
+        mNumZ = numZ;
+
+        mOffset[NEIGHBOUR_XM] = -mNumY*mNumZ;
+        mOffset[NEIGHBOUR_YM] = -mNumZ;
+        mOffset[NEIGHBOUR_ZM] = -1;
+        mOffset[NEIGHBOUR_ZP] = 1;
+        mOffset[NEIGHBOUR_YP] = mNumZ;
+        mOffset[NEIGHBOUR_XP] = mNumY*mNumZ;
+    }
+
+    int LaplacianOperator::addFluidVoxel(int64_t i, int64_t j, int64_t k)
+    {
+        int64_t voxel = (i*mNumY + j)*mNumZ + k;
+        int row = (int)mVoxelOfRow.size();
+        mRowOfVoxel[voxel] = row;
+        mVoxelOfRow.push_back(voxel);
+        mMask.push_back(0);
+        return row;
+    }
+
+    void LaplacianOperator::build(const uint8_t *flags)
+    {
+        // the rows are counted and numbered by slabs of constant i, the voxels of a slab are contiguous
+        int64_t slabSize = mNumY*mNumZ;
+        vector<int> slabStart = countBlocks((int)mNumX, 1,
+            [&](int i) -> int
+            {
+                int count = 0;
+                for (int64_t voxel = i*slabSize; voxel < (i + 1)*slabSize; voxel++)
+                {
+                    count += (flags[voxel] & VOXEL_FLUID) ? 1 : 0;
+                }
+                return count;
+            });
+        int N = slabStart.back();
+        mVoxelOfRow.resize(N);
+        mMask.resize(N);
+        fillBlocks((int)mNumX, 1, slabStart, NULL,
+            [&](int i, int row) -> int
+            {
+                for (int64_t voxel = i*slabSize; voxel < (i + 1)*slabSize; voxel++)
+                {
+                    if (flags[voxel] & VOXEL_FLUID)
+                    {
+                        mRowOfVoxel[voxel] = row;
+                        mVoxelOfRow[row++] = voxel;
+                    }
+                    else
+                    {
+                        mRowOfVoxel[voxel] = -1;
+                    }
+                }
+                return row;
+            });
+
+        // neighbour masks, the neighbours out of the box are solid walls
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    int64_t i, j, k;
+                    getVoxel(row, i, j, k);
+                    bool inside[6] = { i > 0, j > 0, k > 0, k < mNumZ - 1, j < mNumY - 1, i < mNumX - 1 };
+                    int64_t voxel = mVoxelOfRow[row];
+                    NeighbourMask mask = 0;
+                    for (int dir = 0; dir < 6; dir++)
+                    {
+                        if (inside[dir])
+                        {
+                            uint8_t f = flags[voxel + mOffset[dir]];
+                            mask |= ((f & VOXEL_FLUID) ? neighbourFluidBit(dir) : 0) | ((f & VOXEL_NON_SOLID) ? neighbourNonSolidBit(dir) : 0);
+                        }
+                    }
+                    mMask[row] = mask;
+                }
+            });
+    }
+
+    // bits of v spread to every third bit, v < 2^21
+    static inline uint64_t spreadBits3(uint64_t v)
+    {
+        v &= 0x1FFFFF;
+        v = (v | (v << 32)) & 0x1F00000000FFFFULL;
+        v = (v | (v << 16)) & 0x1F0000FF0000FFULL;
+        v = (v | (v << 8))  & 0x100F00F00F00F00FULL;
+        v = (v | (v << 4))  & 0x10C30C30C30C30C3ULL;
+        v = (v | (v << 2))  & 0x1249249249249249ULL;
+        return v;
+    }
+
+    // Reverse Cuthill-McKee: breadth first visit of each connected component from a pseudo-peripheral row,
+    // the neighbours of a row are visited by increasing degree, then the whole order is reversed
+    static void getRCMOrder(const LaplacianOperator &A, vector<int> &oldRowOfNewRow)
+    {
+        int N = A.size();
+        vector<int> level(N, -1);
+        vector<uint8_t> visited(N, 0);
+        oldRowOfNewRow.clear();
+        oldRowOfNewRow.reserve(N);
+
+        // breadth first visit from start: appends the rows to order, level gets the distance from start
+        auto visit = [&](int start, vector<int> &order, bool sortByDegree)
+        {
+            size_t head = order.size();
+            order.push_back(start);
+            level[start] = 0;
+            while (head < order.size())
+            {
+                int row = order[head++];
+                NeighbourMask m = A.mMask[row];
+                int64_t voxel = A.mVoxelOfRow[row];
+                int next[6];
+                int numNext = 0;
+                for (int dir = 0; dir < 6; dir++)
+                {
+                    if (m & neighbourFluidBit(dir))
+                    {
+                        int n = A.mRowOfVoxel[voxel + A.mOffset[dir]];
+                        if (level[n] < 0)
+                        {
+                            level[n] = level[row] + 1;
+                            next[numNext++] = n;
+                        }
+                    }
+                }
+                if (sortByDegree)
+                {
+                    std::sort(next, next + numNext, [&](int a, int b) { return _bitCount6[A.mMask[a] & 0x3F] < _bitCount6[A.mMask[b] & 0x3F]; });
+                }
+                order.insert(order.end(), next, next + numNext);
+            }
+        };
+
+        vector<int> component;
+        for (int first = 0; first < N; first++)
+        {
+            if (visited[first])
+            {
+                continue;
+            }
+
+            // pseudo-peripheral start: the row of least degree among the farthest rows from the first one
+            component.clear();
+            visit(first, component, false);
+            int start = component.back();
+            int lastLevel = level[start];
+            for (int idx = (int)component.size() - 1; (idx >= 0) && (level[component[idx]] == lastLevel); idx--)
+            {
+                if (_bitCount6[A.mMask[component[idx]] & 0x3F] < _bitCount6[A.mMask[start] & 0x3F])
+                {
+                    start = component[idx];
+                }
+            }
+            for (size_t idx = 0; idx < component.size(); idx++)
+            {
+                level[component[idx]] = -1;
+                visited[component[idx]] = 1;
+            }
+
+            visit(start, oldRowOfNewRow, true);
+        }
+        std::reverse(oldRowOfNewRow.begin(), oldRowOfNewRow.end());
+    }
+
+    void LaplacianOperator::reorder(RowOrdering ordering)
+    {
+        int N = size();
+        if ( (ordering == mOrdering) || (N == 0) )
+        {
+            return;
+        }
+
+        vector<int> oldRowOfNewRow(N);
+        if (ordering == ROW_ORDER_RCM)
+        {
+            getRCMOrder(*this, oldRowOfNewRow);
+        }
+        else
+        {
+            // morton and lexicographic: sort by key, the box index is the lexicographic key
+            vector<uint64_t> key(N);
+            tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+                [&](const tbb::blocked_range<int> &range)
+                {
+                    for (int row = range.begin(); row != range.end(); ++row)
+                    {
+                        int64_t i, j, k;
+                        getVoxel(row, i, j, k);
+                        key[row] = (ordering == ROW_ORDER_MORTON) ? (spreadBits3(i) << 2) | (spreadBits3(j) << 1) | spreadBits3(k) : (uint64_t)mVoxelOfRow[row];
+                        oldRowOfNewRow[row] = row;
+                    }
+                });
+            tbb::parallel_sort(oldRowOfNewRow.begin(), oldRowOfNewRow.end(), [&](int a, int b) { return key[a] < key[b]; });
+        }
+
+        vector<int64_t> voxelOfRow(N);
+        vector<NeighbourMask> mask(N);
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    int oldRow = oldRowOfNewRow[row];
+                    voxelOfRow[row] = mVoxelOfRow[oldRow];
+                    mask[row] = mMask[oldRow];
+                    mRowOfVoxel[voxelOfRow[row]] = row;
+                }
+            });
+        mVoxelOfRow.swap(voxelOfRow);
+        mMask.swap(mask);
+        mOrdering = ordering;
+    }
+
+    void LaplacianOperator::getVoxel(int row, int64_t &i, int64_t &j, int64_t &k) const
+    {
+        int64_t voxel = mVoxelOfRow[row];
+        k = voxel % mNumZ;
+        j = (voxel / mNumZ) % mNumY;
+        i = voxel / (mNumY*mNumZ);
+    }
+
+    // Root of x in the concurrent union-find of labelComponents: the parent of a row is never larger than the row,
+    // so concurrent links can't make cycles. Path halving is a best effort, a failed exchange only leaves a longer path
+    static int findRoot(vector< std::atomic<int> > &parent, int x)
+    {
+        while (true)
+        {
+            int p = parent[x].load();
+            if (p == x)
+            {
+                return x;
+            }
+            int grandParent = parent[p].load();
+            if (grandParent != p)
+            {
+                parent[x].compare_exchange_weak(p, grandParent);
+            }
+            x = grandParent;
+        }
+    }
+
+    static void uniteRoots(vector< std::atomic<int> > &parent, int a, int b)
+    {
+        while (true)
+        {
+            a = findRoot(parent, a);
+            b = findRoot(parent, b);
+            if (a == b)
+            {
+                return;
+            }
+            // the larger root is linked to the smaller one, it fails if another thread linked it meanwhile
+            if (a < b)
+            {
+                std::swap(a, b);
+            }
+            int expected = a;
+            if (parent[a].compare_exchange_strong(expected, b))
+            {
+                return;
+            }
+        }
+    }
+
+    int LaplacianOperator::labelComponents(vector<int> &componentOfRow) const
+    {
+        int N = size();
+        vector< std::atomic<int> > parent(N);
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    parent[row].store(row);
+                }
+            });
+
+        // each fluid link once, from its row to the +x, +y, +z neighbour
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    for (int dir = NEIGHBOUR_ZP; dir <= NEIGHBOUR_XP; dir++)
+                    {
+                        if (mMask[row] & neighbourFluidBit(dir))
+                        {
+                            uniteRoots(parent, row, mRowOfVoxel[mVoxelOfRow[row] + mOffset[dir]]);
+                        }
+                    }
+                }
+            });
+
+        // the root of a component is its first row: the roots are numbered in row order
+        componentOfRow.resize(N);
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    componentOfRow[row] = findRoot(parent, row);
+                }
+            });
+        vector<int> blockStart = countBlocks(N, CPU_SOLVER_GRAIN_SIZE, [&](int row) -> int { return (componentOfRow[row] == row) ? 1 : 0; });
+        vector<int> idOfRoot(N);
+        fillBlocks(N, CPU_SOLVER_GRAIN_SIZE, blockStart, NULL,
+            [&](int row, int id) -> int
+            {
+                if (componentOfRow[row] == row)
+                {
+                    idOfRoot[row] = id++;
+                }
+                return id;
+            });
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    componentOfRow[row] = idOfRoot[componentOfRow[row]];
+                }
+            });
+        return blockStart.back();
+    }
+
+    void LaplacianOperator::extractRows(const LaplacianOperator &A, const int *rows, int numRows)
+    {
+        int64_t minIJK[3] = { A.mNumX, A.mNumY, A.mNumZ };
+        int64_t maxIJK[3] = { -1, -1, -1 };
+        for (int r = 0; r < numRows; r++)
+        {
+            int64_t ijk[3];
+            A.getVoxel(rows[r], ijk[0], ijk[1], ijk[2]);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                minIJK[axis] = std::min(minIJK[axis], ijk[axis]);
+                maxIJK[axis] = std::max(maxIJK[axis], ijk[axis]);
+            }
+        }
+        const int64_t boxDim[3] = { A.mNumX, A.mNumY, A.mNumZ };
+        for (int axis = 0; axis < 3; axis++)
+        {
+            minIJK[axis] = std::max((int64_t)0, minIJK[axis] - 1);
+            maxIJK[axis] = std::min(boxDim[axis] - 1, maxIJK[axis] + 1);
+        }
+
+        reset(maxIJK[0] - minIJK[0] + 1, maxIJK[1] - minIJK[1] + 1, maxIJK[2] - minIJK[2] + 1);
+        mVoxelOfRow.reserve(numRows);
+        mMask.reserve(numRows);
+        for (int r = 0; r < numRows; r++)
+        {
+            int64_t i, j, k;
+            A.getVoxel(rows[r], i, j, k);
+            addFluidVoxel(i - minIJK[0], j - minIJK[1], k - minIJK[2]);
+            mMask[r] = A.mMask[rows[r]];
+        }
+        mOrdering = A.mOrdering;
+    }
+
+    template<typename T>
+    static void laplacianApply(const LaplacianOperator &A, const T *x, T *y)
+    {
+        const NeighbourMask *mask = A.mMask.data();
+        const int64_t *voxelOfRow = A.mVoxelOfRow.data();
+        const int32_t *rowOfVoxel = A.mRowOfVoxel.data();
+        const int64_t *offset = A.mOffset;
+        tbb::parallel_for(tbb::blocked_range<int>(0, A.size(), CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    NeighbourMask m = mask[row];
+                    T sum = getDiagonal(m) * x[row];
+                    if (m & 0x3F)
+                    {
+                        int64_t voxel = voxelOfRow[row];
+                        for (int dir = 0; dir < 6; dir++)
+                        {
+                            if (m & neighbourFluidBit(dir))
+                            {
+                                sum -= x[rowOfVoxel[voxel + offset[dir]]];
+                            }
+                        }
+                    }
+                    y[row] = sum;
+                }
+            });
+    }
+
+    void LaplacianOperator::apply(const float *x, float *y) const
+    {
+        laplacianApply(*this, x, y);
+    }
+
+    void LaplacianOperator::apply(const double *x, double *y) const
+    {
+        laplacianApply(*this, x, y);
+    }
+
+    void LaplacianOperator::diagonal(float *d) const
+    {
+        const NeighbourMask *mask = mMask.data();
+        tbb::parallel_for(tbb::blocked_range<int>(0, size(), CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    d[row] = getDiagonal(mask[row]);
+                }
+            });
+    }
+
+    // non zero of a row of the CSR matrix
+    static inline int getRowNonZero(NeighbourMask m)
+    {
+        return _bitCount6[m & 0x3F] + (getDiagonal(m) != 0.0f ? 1 : 0);
+    }
+
+    // Columns and values of a row of the CSR matrix sorted by column, with upperOnly only the diagonal and the
+    // columns after it; cols and vals must have 7 elements, returns their number.
+    // The neighbours are sorted by row: the directions are in column order only with ROW_ORDER_LEXICOGRAPHIC
+    static int getSortedRow(const LaplacianOperator &A, int row, bool upperOnly, int *cols, float *vals)
+    {
+        NeighbourMask m = A.mMask[row];
+        int64_t voxel = A.mVoxelOfRow[row];
+        int count = 0;
+
+        float diag = getDiagonal(m);
+        if (diag != 0.0f)
+        {
+            cols[count] = row;
+            vals[count++] = diag;
+        }
+        for (int dir = 0; dir < 6; dir++)
+        {
+            if (m & neighbourFluidBit(dir))
+            {
+                int col = A.mRowOfVoxel[voxel + A.mOffset[dir]];
+                if ( !upperOnly || (col > row) )
+                {
+                    cols[count] = col;
+                    vals[count++] = -1;
+                }
+            }
+        }
+
+        // insertion sort, at most 7 columns
+        for (int idx = 1; idx < count; idx++)
+        {
+            int col = cols[idx];
+            float val = vals[idx];
+            int pos = idx;
+            while ( (pos > 0) && (cols[pos - 1] > col) )
+            {
+                cols[pos] = cols[pos - 1];
+                vals[pos] = vals[pos - 1];
+                pos--;
+            }
+            cols[pos] = col;
+            vals[pos] = val;
+        }
+        return count;
+    }
+
+    int LaplacianOperator::getNumNonZero() const
+    {
+        return tbb::parallel_reduce(tbb::blocked_range<int>(0, size(), CPU_SOLVER_GRAIN_SIZE), 0,
+            [&](const tbb::blocked_range<int> &range, int nz) -> int
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    nz += getRowNonZero(mMask[row]);
+                }
+                return nz;
+            },
+            [](int nz1, int nz2) -> int { return nz1 + nz2; });
+    }
+
+    int LaplacianOperator::toCSR(int *I, int *J, float *val) const
+    {
+        // two passes: the non zero of the rows, then the rows are filled concurrently from their prefix sum
+        vector<int> blockStart = countBlocks(size(), CPU_SOLVER_GRAIN_SIZE, [&](int row) -> int { return getRowNonZero(mMask[row]); });
+        fillBlocks(size(), CPU_SOLVER_GRAIN_SIZE, blockStart, I, [&](int row, int idxJ) -> int
+        {
+            int count = getSortedRow(*this, row, false, J + idxJ, val + idxJ);
+            return idxJ + count;
+        });
+        return blockStart.back();
+    }
+
+    void LaplacianOperator::toSymmetricCSR(SymmetricCSRMatrix &A) const
+    {
+        int N = size();
+        vector<int> blockStart = countBlocks(N, CPU_SOLVER_GRAIN_SIZE,
+            [&](int row) -> int
+            {
+                int cols[7];
+                float vals[7];
+                return getSortedRow(*this, row, true, cols, vals);
+            });
+        int nz = blockStart.back();
+
+        A.mN = N;
+        A.mI.resize(N + 1);
+        A.mJ.resize(nz);
+        A.mVal.resize(nz);
+        fillBlocks(N, CPU_SOLVER_GRAIN_SIZE, blockStart, A.mI.data(), [&](int row, int idxJ) -> int
+        {
+            int count = getSortedRow(*this, row, true, A.mJ.data() + idxJ, A.mVal.data() + idxJ);
+            return idxJ + count;
+        });
+        A.buildBlocks();
+    }
+
+}
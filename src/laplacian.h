@@ -0,0 +1,148 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LAPLACIAN_H_
+#define LAPLACIAN_H_
+
+#include <vector>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+
+#include "common.h"
+#include "log.h"
+#include "sparse_solver_cpu.h"
+
+using namespace std;
+
+namespace yapfs
+{
+
+    // Neighbours of a voxel, in the same order of the columns of a CSR row: -x, -y, -z, +z, +y, +x
+    enum NeighbourDir { NEIGHBOUR_XM=0, NEIGHBOUR_YM=1, NEIGHBOUR_ZM=2, NEIGHBOUR_ZP=3, NEIGHBOUR_YP=4, NEIGHBOUR_XP=5 };
+
+    // Neighbour mask of a fluid voxel:
+    // bit d of the low byte is set when the neighbour d is FLUID (off diagonal coefficient -1),
+    // bit d of the high byte is set when the neighbour d is not SOLID (it counts in the diagonal).
+    // Non fluid voxels have mask 0 and an empty row.
+    typedef uint16_t NeighbourMask;
+
+    inline NeighbourMask neighbourFluidBit(int dir) { return (NeighbourMask)(1 << dir); }
+    inline NeighbourMask neighbourNonSolidBit(int dir) { return (NeighbourMask)(1 << (dir + 8)); }
+
+    // Numbering of the rows of a LaplacianOperator:
+    // lexicographic is the box index order, the +-x neighbours of a row are mNumY*mNumZ rows apart;
+    // morton is the Z-order curve of i, j, k, near voxels have near rows in all the three directions;
+    // rcm is the reverse Cuthill-McKee order, the smallest bandwidth but the rows do not follow the axes.
+    // Lexicographic and morton grow along each axis, so the -x, -y, -z neighbours of a row have lower rows
+    enum RowOrdering { ROW_ORDER_LEXICOGRAPHIC=0, ROW_ORDER_MORTON=1, ROW_ORDER_RCM=2 };
+
+    // Flags of the voxels of the box given to LaplacianOperator::build, a FLUID voxel is VOXEL_FLUID | VOXEL_NON_SOLID
+    enum VoxelFlag { VOXEL_FLUID=1, VOXEL_NON_SOLID=2 };
+
+    // Matrix-free 7-point Laplacian of the pressure system on the box mNumX x mNumY x mNumZ.
+    // Only the fluid voxels are unknowns: they are numbered in the order they are added,
+    // voxels of the box are indexed as (i*mNumY + j)*mNumZ + k with i, j, k relative to the box
+    class LaplacianOperator : public LinearOperator
+    {
+        public:
+            int64_t mNumX;
+            int64_t mNumY;
+            int64_t mNumZ;
+            int64_t mOffset[6]; // box index offset of the neighbours, see NeighbourDir
+            vector<int32_t> mRowOfVoxel; // box index -> row, -1 for non fluid voxels
+            vector<int64_t> mVoxelOfRow; // row -> box index
+            vector<NeighbourMask> mMask; // one per row
+            RowOrdering mOrdering; // numbering of the rows, lexicographic after reset()
+
+            LaplacianOperator(int64_t numX, int64_t numY, int64_t numZ);
+
+            // remove all the rows and set the box, the memory is kept to be reused by the next system
+            void reset(int64_t numX, int64_t numY, int64_t numZ);
+
+            // add the fluid voxel i, j, k as a new unknown, returns its row
+            int addFluidVoxel(int64_t i, int64_t j, int64_t k);
+            // number all the fluid voxels of the box and set their neighbour masks in parallel, flags has a VoxelFlag
+            // value for each voxel of the box (the walls of the box are solid). The rows are numbered in box index
+            // order, as adding the fluid voxels with addFluidVoxel in i, j, k loops
+            void build(const uint8_t *flags);
+            // number the rows again in the given order, mRowOfVoxel, mVoxelOfRow and mMask are permuted
+            void reorder(RowOrdering ordering);
+            // the -x, -y, -z neighbours of each row have lower rows
+            bool isAxisMonotone() const { return mOrdering != ROW_ORDER_RCM; }
+            // i, j, k of the voxel of a row
+            void getVoxel(int row, int64_t &i, int64_t &j, int64_t &k) const;
+
+            // Connected components of the fluid rows (rows linked by a fluid neighbour), labeled in parallel:
+            // componentOfRow gets the component of each row, numbered in order of their first row. Returns their number
+            int labelComponents(vector<int> &componentOfRow) const;
+            // The system of the rows of A on the bounding box of their voxels grown by one voxel (the non fluid
+            // neighbours stay in the box): row r is the voxel of rows[r] of A, the rows must be increasing and
+            // a union of connected components of A. The masks and the ordering are the ones of A
+            void extractRows(const LaplacianOperator &A, const int *rows, int numRows);
+
+            int size() const { return (int)mMask.size(); }
+            void apply(const float *x, float *y) const;
+            void apply(const double *x, double *y) const;
+            void diagonal(float *d) const;
+
+            // sum of x over the fluid neighbours of row: (A*x)[row] = diagonal*x[row] - getNeighbourSum(row, x)
+            template<typename T>
+            inline T getNeighbourSum(int row, const T *x) const
+            {
+                NeighbourMask m = mMask[row];
+                T sum = 0.0;
+                if (m & 0x3F)
+                {
+                    int64_t voxel = mVoxelOfRow[row];
+                    for (int dir = 0; dir < 6; dir++)
+                    {
+                        if (m & neighbourFluidBit(dir))
+                        {
+                            sum += x[mRowOfVoxel[voxel + mOffset[dir]]];
+                        }
+                    }
+                }
+                return sum;
+            }
+
+            // number of non zero values of the equivalent CSR matrix
+            int getNumNonZero() const;
+            // Assemble the equivalent CSR matrix: I must have size()+1 elements, J and val getNumNonZero(),
+            // the columns of each row are sorted. Returns nz
+            int toCSR(int *I, int *J, float *val) const;
+            // Assemble the upper triangle of the equivalent CSR matrix
+            void toSymmetricCSR(SymmetricCSRMatrix &A) const;
+    };
+
+}
+
+#endif /* LAPLACIAN_H_ */
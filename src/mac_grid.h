@@ -0,0 +1,184 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef MAC_GRID_H_
+#define MAC_GRID_H_
+
+#include <vector>
+#include <iostream>
+#include <string>
+#include <cstdint>
+
+#include <openvdb/openvdb.h>
+
+#include "common.h"
+#include "grid.h"
+#include "dense_grid.h"
+
+using namespace openvdb;
+using namespace std;
+
+namespace yapfs
+{
+
+    // Staggered MAC velocity: a scalar grid for each component, on the faces of the voxels. The value (i, j, k)
+    // of the face grid of the component c is the velocity through the face of the voxel (i, j, k) at its lower
+    // side in the direction c, e.g. for x at the index space point (i, j + 0.5, k + 0.5). The faces store RealT,
+    // the velocities are returned in double
+    template<typename Storage = SparseStorage, typename RealT = double>
+    class MACGrid
+    {
+
+        public:
+
+            typedef Grid<typename RealGridTypes<RealT>::ScalarGrid, Storage> FaceGrid;
+
+            LReal mVoxelSize;
+
+            MACGrid(LReal voxelSize, const Vec3i &minN, const Vec3i &maxN): mVoxelSize(voxelSize), mMinN(minN), mMaxN(maxN)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    mFaces[c] = new FaceGrid(voxelSize, minN, maxN);
+                }
+            }
+
+            ~MACGrid()
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    delete mFaces[c];
+                }
+            }
+
+            // face grid of the component c: 0 x, 1 y, 2 z
+            FaceGrid *getFace(int c)
+            {
+                return mFaces[c];
+            }
+
+            // the velocities of the three lower faces of the voxel (i, j, k), each at its own face
+            Vec3d getValue(int64_t i, int64_t j, int64_t k)
+            {
+                return Vec3d(mFaces[0]->getValue(i, j, k), mFaces[1]->getValue(i, j, k), mFaces[2]->getValue(i, j, k));
+            }
+
+            // Velocity at an index space point (the voxel (i, j, k) spans [i, i + 1) x [j, j + 1) x [k, k + 1)):
+            // each component is interpolated on its face grid, shifted by half a voxel in the other two directions
+            Vec3d sample(const Vec3d &indexSpacePoint)
+            {
+                Vec3d velocity;
+                for (int c = 0; c < 3; ++c)
+                {
+                    Vec3d facePoint(indexSpacePoint.x() - 0.5, indexSpacePoint.y() - 0.5, indexSpacePoint.z() - 0.5);
+                    facePoint[c] = indexSpacePoint[c];
+                    velocity[c] = mFaces[c]->sample(facePoint);
+                }
+                return velocity;
+            }
+
+            Vec3d getIndexToWorld(int64_t i, int64_t j, int64_t k)
+            {
+                return mFaces[0]->getIndexToWorld(i, j, k);
+            }
+
+            Vec3d getIndexToWorld(Vec3d indexSpacePoint)
+            {
+                return mFaces[0]->getIndexToWorld(indexSpacePoint);
+            }
+
+            // returns i, j, k
+            Vec3d getWorldToIndex(Vec3d worldSpacePoint)
+            {
+                return mFaces[0]->getWorldToIndex(worldSpacePoint);
+            }
+
+            void clear()
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    mFaces[c]->clear();
+                }
+            }
+
+            void deepCopyFromGrid(MACGrid *grid)
+            {
+                mVoxelSize = grid->mVoxelSize;
+                mMinN = grid->mMinN;
+                mMaxN = grid->mMaxN;
+                for (int c = 0; c < 3; ++c)
+                {
+                    mFaces[c]->deepCopyFromGrid(grid->mFaces[c]);
+                }
+            }
+
+            // The three faces of each voxel of the box (and of the voxels around it, where the particles splat)
+            // in one vector grid as the viewer reads it, for the export of a frame
+            void exportToGrid(Grid<Vec3DGrid> &grid)
+            {
+                grid.clear();
+                grid.mLinearTransform = openvdb::math::Transform::createLinearTransform(mVoxelSize);
+                grid.mVoxelSize = mVoxelSize;
+                grid.mGrid->setTransform(grid.mLinearTransform);
+                Grid<Vec3DGrid>::Accessor accessor = grid.getAccessor();
+                typename FaceGrid::ConstAccessor uAccessor = mFaces[0]->getConstAccessor();
+                typename FaceGrid::ConstAccessor vAccessor = mFaces[1]->getConstAccessor();
+                typename FaceGrid::ConstAccessor wAccessor = mFaces[2]->getConstAccessor();
+                for (int64_t i = mMinN.x() - 1; i <= mMaxN.x() + 1; ++i)
+                    for (int64_t j = mMinN.y() - 1; j <= mMaxN.y() + 1; ++j)
+                        for (int64_t k = mMinN.z() - 1; k <= mMaxN.z() + 1; ++k)
+                        {
+                            Vec3d velocity(uAccessor.getValue(i, j, k), vAccessor.getValue(i, j, k), wAccessor.getValue(i, j, k));
+                            if ((velocity.x() != 0.0) || (velocity.y() != 0.0) || (velocity.z() != 0.0))
+                            {
+                                accessor.setValue(velocity, i, j, k);
+                            }
+                        }
+            }
+
+            uint64_t getMemUsage()
+            {
+                return mFaces[0]->getMemUsage() + mFaces[1]->getMemUsage() + mFaces[2]->getMemUsage();
+            }
+
+        private:
+
+            // the face grids are owned by the MAC grid, no copies
+            MACGrid(const MACGrid &grid);
+            MACGrid &operator=(const MACGrid &grid);
+
+            FaceGrid *mFaces[3];
+            Vec3i mMinN;
+            Vec3i mMaxN;
+
+    };
+
+}
+
+#endif /* MAC_GRID_H_ */
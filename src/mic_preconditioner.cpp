@@ -0,0 +1,287 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#include "mic_preconditioner.h"
+
+namespace yapfs
+{
+
+    // lower neighbours have a lower row, upper neighbours an upper row, see NeighbourDir
+    #define NEIGHBOUR_LOWER_MASK 0x07
+    #define NEIGHBOUR_UPPER_MASK 0x38
+
+    static inline int getOppositeDir(int dir)
+    {
+        return 5 - dir;
+    }
+
+    static inline int countFluidBits(NeighbourMask mask)
+    {
+        int count = 0;
+        for (int dir = 0; dir < 6; dir++)
+        {
+            if (mask & neighbourFluidBit(dir))
+            {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    MICPreconditioner::MICPreconditioner(const LaplacianOperator &A, bool levelScheduled, LReal tau, LReal sigma)
+    {
+        mA = &A;
+        mTau = tau;
+        mSigma = sigma;
+        mLevelScheduled = levelScheduled;
+
+        int N = A.size();
+        mPrecon.assign(N, 0.0f);
+        mQ.assign(N, 0.0f);
+
+        buildOrder();
+        if (mLevelScheduled)
+        {
+            for (size_t level = 0; level + 1 < mLevelStart.size(); level++)
+            {
+                tbb::parallel_for(tbb::blocked_range<int>(mLevelStart[level], mLevelStart[level+1], CPU_SOLVER_GRAIN_SIZE),
+                    [&](const tbb::blocked_range<int> &range)
+                    {
+                        for (int idx = range.begin(); idx != range.end(); ++idx)
+                        {
+                            factorRow(mLevelRows[idx]);
+                        }
+                    });
+            }
+        }
+        else
+        {
+            for (int idx = 0; idx < N; idx++)
+            {
+                factorRow(getSequentialRow(idx));
+            }
+        }
+    }
+
+    bool MICPreconditioner::update(const vector<int> &oldRowOfRow, const vector<int> &changedRows)
+    {
+        int N = mA->size();
+        vector<float> oldPrecon;
+        oldPrecon.swap(mPrecon);
+        mPrecon.resize(N);
+        for (int row = 0; row < N; row++)
+        {
+            mPrecon[row] = (oldRowOfRow[row] >= 0) ? oldPrecon[oldRowOfRow[row]] : 0.0f;
+        }
+        mQ.assign(N, 0.0f);
+
+        buildOrder();
+
+        // the upper neighbours read the factor of the changed rows: they are factored again too.
+        // The effect on the farther rows is neglected: their factor stays positive so M is still SPD
+        vector<uint8_t> refactor(N, 0);
+        for (size_t idx = 0; idx < changedRows.size(); idx++)
+        {
+            int row = changedRows[idx];
+            NeighbourMask mask = mA->mMask[row];
+            int64_t voxel = mA->mVoxelOfRow[row];
+            refactor[row] = 1;
+            for (int dir = NEIGHBOUR_ZP; dir <= NEIGHBOUR_XP; dir++)
+            {
+                if (mask & neighbourFluidBit(dir))
+                {
+                    refactor[mA->mRowOfVoxel[voxel + mA->mOffset[dir]]] = 1;
+                }
+            }
+        }
+
+        // the lower neighbours are factored first
+        for (int idx = 0; idx < N; idx++)
+        {
+            int row = getSequentialRow(idx);
+            if (refactor[row])
+            {
+                factorRow(row);
+            }
+        }
+
+        return true;
+    }
+
+    void MICPreconditioner::buildOrder()
+    {
+        if (mLevelScheduled || !mA->isAxisMonotone())
+        {
+            buildLevels();
+        }
+        else
+        {
+            mLevelStart.clear();
+            mLevelRows.clear();
+        }
+    }
+
+    void MICPreconditioner::buildLevels()
+    {
+        int N = mA->size();
+        int numLevels = mA->mNumX + mA->mNumY + mA->mNumZ - 2;
+        vector<int> rowLevel(N);
+        mLevelStart.assign(numLevels + 1, 0);
+
+        // counting sort of the rows by level i+j+k
+        for (int row = 0; row < N; row++)
+        {
+            int64_t i, j, k;
+            mA->getVoxel(row, i, j, k);
+            rowLevel[row] = i + j + k;
+            mLevelStart[rowLevel[row] + 1]++;
+        }
+        for (int level = 0; level < numLevels; level++)
+        {
+            mLevelStart[level + 1] += mLevelStart[level];
+        }
+        vector<int> levelPos(mLevelStart.begin(), mLevelStart.end() - 1);
+        mLevelRows.resize(N);
+        for (int row = 0; row < N; row++)
+        {
+            mLevelRows[levelPos[rowLevel[row]]++] = row;
+        }
+    }
+
+    inline void MICPreconditioner::factorRow(int row)
+    {
+        NeighbourMask mask = mA->mMask[row];
+        int64_t voxel = mA->mVoxelOfRow[row];
+        LReal diag = countFluidBits(mask >> 8);
+
+        // off diagonal coefficients are -1: (Aplus*precon)^2 = precon^2 and
+        // Aplus*(sum of the other Aplus of the neighbour)*precon^2 = (number of other upper fluid neighbours)*precon^2
+        LReal e = diag;
+        for (int dir = NEIGHBOUR_XM; dir <= NEIGHBOUR_ZM; dir++)
+        {
+            if (mask & neighbourFluidBit(dir))
+            {
+                int n = mA->mRowOfVoxel[voxel + mA->mOffset[dir]];
+                LReal precon2 = (LReal)mPrecon[n] * (LReal)mPrecon[n];
+                NeighbourMask upper = mA->mMask[n] & NEIGHBOUR_UPPER_MASK & ~neighbourFluidBit(getOppositeDir(dir));
+                e -= precon2 + mTau * countFluidBits(upper) * precon2;
+            }
+        }
+
+        if (e < mSigma * diag)
+        {
+            e = diag;
+        }
+        mPrecon[row] = (e > 0.0) ? 1.0 / sqrt(e) : 0.0;
+    }
+
+    // solve L*q = r
+    inline void MICPreconditioner::forwardRow(int row, const float *r)
+    {
+        NeighbourMask mask = mA->mMask[row];
+        int64_t voxel = mA->mVoxelOfRow[row];
+        float t = r[row];
+        if (mask & NEIGHBOUR_LOWER_MASK)
+        {
+            for (int dir = NEIGHBOUR_XM; dir <= NEIGHBOUR_ZM; dir++)
+            {
+                if (mask & neighbourFluidBit(dir))
+                {
+                    int n = mA->mRowOfVoxel[voxel + mA->mOffset[dir]];
+                    t += mPrecon[n] * mQ[n];
+                }
+            }
+        }
+        mQ[row] = t * mPrecon[row];
+    }
+
+    // solve L^T*z = q
+    inline void MICPreconditioner::backwardRow(int row, float *z)
+    {
+        NeighbourMask mask = mA->mMask[row];
+        int64_t voxel = mA->mVoxelOfRow[row];
+        float t = mQ[row];
+        if (mask & NEIGHBOUR_UPPER_MASK)
+        {
+            float sum = 0.0f;
+            for (int dir = NEIGHBOUR_ZP; dir <= NEIGHBOUR_XP; dir++)
+            {
+                if (mask & neighbourFluidBit(dir))
+                {
+                    sum += z[mA->mRowOfVoxel[voxel + mA->mOffset[dir]]];
+                }
+            }
+            t += mPrecon[row] * sum;
+        }
+        z[row] = t * mPrecon[row];
+    }
+
+    void MICPreconditioner::apply(const float *r, float *z)
+    {
+        int N = mA->size();
+        if (mLevelScheduled)
+        {
+            int numLevels = (int)mLevelStart.size() - 1;
+            for (int level = 0; level < numLevels; level++)
+            {
+                tbb::parallel_for(tbb::blocked_range<int>(mLevelStart[level], mLevelStart[level+1], CPU_SOLVER_GRAIN_SIZE),
+                    [&](const tbb::blocked_range<int> &range)
+                    {
+                        for (int idx = range.begin(); idx != range.end(); ++idx)
+                        {
+                            forwardRow(mLevelRows[idx], r);
+                        }
+                    });
+            }
+            for (int level = numLevels - 1; level >= 0; level--)
+            {
+                tbb::parallel_for(tbb::blocked_range<int>(mLevelStart[level], mLevelStart[level+1], CPU_SOLVER_GRAIN_SIZE),
+                    [&](const tbb::blocked_range<int> &range)
+                    {
+                        for (int idx = range.begin(); idx != range.end(); ++idx)
+                        {
+                            backwardRow(mLevelRows[idx], z);
+                        }
+                    });
+            }
+        }
+        else
+        {
+            for (int idx = 0; idx < N; idx++)
+            {
+                forwardRow(getSequentialRow(idx), r);
+            }
+            for (int idx = N - 1; idx >= 0; idx--)
+            {
+                backwardRow(getSequentialRow(idx), z);
+            }
+        }
+    }
+
+}
@@ -0,0 +1,91 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef MIC_PRECONDITIONER_H_
+#define MIC_PRECONDITIONER_H_
+
+#include <vector>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+
+#include "common.h"
+#include "log.h"
+#include "sparse_solver_cpu.h"
+#include "laplacian.h"
+
+using namespace std;
+
+namespace yapfs
+{
+
+    // Modified Incomplete Cholesky MIC(0) preconditioner of the pressure Laplacian,
+    // algorithm described in chapter 5 of Fluid Simulation for Computer Graphics by Robert Bridson (second edition 2015).
+    // The factorization and the triangular solves follow the row order of the LaplacianOperator.
+    // With levelScheduled the rows are grouped in levels i+j+k: a row only depends on its -x, -y, -z neighbours
+    // that are all in the previous level, so the rows of a level are processed in parallel.
+    // The result is the same of the sequential sweep. The sequential sweep follows the row order when the lower
+    // neighbours have lower rows (LaplacianOperator::isAxisMonotone), the level order otherwise.
+    class MICPreconditioner : public Preconditioner
+    {
+        public:
+            const LaplacianOperator *mA;
+            LReal mTau;   // modification parameter: 0 is IC(0), 1 is full MIC(0)
+            LReal mSigma; // safety parameter against small pivots
+            bool  mLevelScheduled;
+
+            vector<float> mPrecon; // 1/sqrt of the diagonal of the factor L
+            vector<float> mQ;      // result of the forward solve
+            vector<int>   mLevelStart; // rows of level l are mLevelRows[mLevelStart[l]..mLevelStart[l+1]]
+            vector<int>   mLevelRows; // empty when the rows are swept sequentially in row order
+
+            MICPreconditioner(const LaplacianOperator &A, bool levelScheduled, LReal tau = 0.97, LReal sigma = 0.25);
+
+            // z = (L*L^T)^-1 * r
+            void apply(const float *r, float *z);
+
+            // keep the factor of the unchanged rows, factor again only the changed rows and their upper neighbours
+            bool update(const vector<int> &oldRowOfRow, const vector<int> &changedRows);
+
+        private:
+            void buildLevels();
+            // rows in an order valid for the factorization: built when level scheduled or the row order isn't valid
+            void buildOrder();
+            // row of the sequential sweep at position idx
+            inline int getSequentialRow(int idx) const { return mLevelRows.empty() ? idx : mLevelRows[idx]; }
+            inline void factorRow(int row);
+            inline void forwardRow(int row, const float *r);
+            inline void backwardRow(int row, float *z);
+    };
+
+}
+
+#endif /* MIC_PRECONDITIONER_H_ */
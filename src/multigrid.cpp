@@ -0,0 +1,299 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#include "multigrid.h"
+
+namespace yapfs
+{
+
+    // Coarse rhs is MULTIGRID_RESTRICT_SCALE times the sum of the fine residual of the 8 children:
+    // the average scaled by (2h/h)^2 = 4, since the stencil is not divided by h^2
+    #define MULTIGRID_RESTRICT_SCALE 0.5f
+
+    // Loop over all the voxels of a level in parallel, one task per line of voxels along z
+    template<typename OpT>
+    static void forEachLine(const MultigridLevel &level, const OpT &op)
+    {
+        tbb::parallel_for(tbb::blocked_range<int64_t>(0, level.mNumX * level.mNumY),
+            [&](const tbb::blocked_range<int64_t> &range)
+            {
+                for (int64_t line = range.begin(); line != range.end(); ++line)
+                {
+                    op(line / level.mNumY, line % level.mNumY);
+                }
+            });
+    }
+
+    // sum of the FLUID neighbours of x and number of non SOLID neighbours (the diagonal)
+    static inline float getNeighbourSum(const MultigridLevel &level, const float *x, int64_t i, int64_t j, int64_t k, float &diag)
+    {
+        const int64_t strideX = level.mNumY * level.mNumZ;
+        const int64_t strideY = level.mNumZ;
+        const int64_t idx = (i*level.mNumY + j)*level.mNumZ + k;
+        const uint8_t *cell = level.mCell.data();
+
+        float sum = 0.0f;
+        diag = 0.0f;
+
+        #define MULTIGRID_NEIGHBOUR(inside, offset) \
+            if ( inside ) \
+            { \
+                uint8_t c = cell[idx + (offset)]; \
+                if ( c == MG_FLUID ) { sum += x[idx + (offset)]; diag += 1.0f; } \
+                else if ( c == MG_AIR ) { diag += 1.0f; } \
+            }
+
+        MULTIGRID_NEIGHBOUR(i > 0, -strideX)
+        MULTIGRID_NEIGHBOUR(j > 0, -strideY)
+        MULTIGRID_NEIGHBOUR(k > 0, -1)
+        MULTIGRID_NEIGHBOUR(k < level.mNumZ - 1, 1)
+        MULTIGRID_NEIGHBOUR(j < level.mNumY - 1, strideY)
+        MULTIGRID_NEIGHBOUR(i < level.mNumX - 1, strideX)
+
+        #undef MULTIGRID_NEIGHBOUR
+
+        return sum;
+    }
+
+    MultigridPreconditioner::MultigridPreconditioner(const LaplacianOperator &A, int numSmooth, int numCoarseSmooth)
+    {
+        mA = &A;
+        mNumSmooth = numSmooth;
+        mNumCoarseSmooth = numCoarseSmooth;
+
+        // finest level: FLUID voxels are the rows of A, SOLID the faces missing in the masks, AIR all the rest
+        mLevels.push_back(MultigridLevel());
+        MultigridLevel &fine = mLevels.back();
+        fine.mNumX = A.mNumX;
+        fine.mNumY = A.mNumY;
+        fine.mNumZ = A.mNumZ;
+        fine.mCell.assign(fine.mNumX * fine.mNumY * fine.mNumZ, MG_AIR);
+        for (int row = 0; row < A.size(); row++)
+        {
+            fine.mCell[A.mVoxelOfRow[row]] = MG_FLUID;
+        }
+        for (int row = 0; row < A.size(); row++)
+        {
+            int64_t i, j, k;
+            A.getVoxel(row, i, j, k);
+            const bool inside[6] = { i > 0, j > 0, k > 0, k < A.mNumZ - 1, j < A.mNumY - 1, i < A.mNumX - 1 };
+            for (int dir = 0; dir < 6; dir++)
+            {
+                if ( inside[dir] && !(A.mMask[row] & neighbourNonSolidBit(dir)) )
+                {
+                    fine.mCell[A.mVoxelOfRow[row] + A.mOffset[dir]] = MG_SOLID;
+                }
+            }
+        }
+
+        // coarser levels
+        while ( (mLevels.back().mNumX > MULTIGRID_MIN_DIM) && (mLevels.back().mNumY > MULTIGRID_MIN_DIM) && (mLevels.back().mNumZ > MULTIGRID_MIN_DIM) )
+        {
+            MultigridLevel coarse;
+            coarsen(mLevels.back(), coarse);
+            mLevels.push_back(coarse);
+        }
+
+        for (size_t idxLevel = 0; idxLevel < mLevels.size(); idxLevel++)
+        {
+            MultigridLevel &level = mLevels[idxLevel];
+            int64_t numVoxels = level.mNumX * level.mNumY * level.mNumZ;
+            level.mX.assign(numVoxels, 0.0f);
+            level.mB.assign(numVoxels, 0.0f);
+            level.mR.assign(numVoxels, 0.0f);
+        }
+
+        L_LOG_DEBUG("Multigrid levels: " + to_string(mLevels.size()));
+    }
+
+    void MultigridPreconditioner::coarsen(const MultigridLevel &fine, MultigridLevel &coarse)
+    {
+        coarse.mNumX = (fine.mNumX + 1) / 2;
+        coarse.mNumY = (fine.mNumY + 1) / 2;
+        coarse.mNumZ = (fine.mNumZ + 1) / 2;
+        coarse.mCell.assign(coarse.mNumX * coarse.mNumY * coarse.mNumZ, MG_SOLID);
+
+        forEachLine(coarse, [&](int64_t ci, int64_t cj)
+            {
+                for (int64_t ck = 0; ck < coarse.mNumZ; ck++)
+                {
+                    bool hasFluid = false;
+                    bool hasAir = false;
+                    for (int64_t i = 2*ci; i < std::min(2*ci + 2, fine.mNumX); i++)
+                        for (int64_t j = 2*cj; j < std::min(2*cj + 2, fine.mNumY); j++)
+                            for (int64_t k = 2*ck; k < std::min(2*ck + 2, fine.mNumZ); k++)
+                            {
+                                uint8_t c = fine.mCell[(i*fine.mNumY + j)*fine.mNumZ + k];
+                                hasFluid |= (c == MG_FLUID);
+                                hasAir |= (c == MG_AIR);
+                            }
+                    coarse.mCell[(ci*coarse.mNumY + cj)*coarse.mNumZ + ck] = hasAir ? MG_AIR : (hasFluid ? MG_FLUID : MG_SOLID);
+                }
+            });
+    }
+
+    void MultigridPreconditioner::smooth(MultigridLevel &level, int numSweeps, bool redFirst)
+    {
+        float *x = level.mX.data();
+        const float *b = level.mB.data();
+        for (int sweep = 0; sweep < numSweeps; sweep++)
+        {
+            for (int color = 0; color < 2; color++)
+            {
+                // red voxels have i+j+k even
+                int parity = (redFirst ? color : 1 - color);
+                forEachLine(level, [&](int64_t i, int64_t j)
+                    {
+                        int64_t lineIdx = (i*level.mNumY + j)*level.mNumZ;
+                        for (int64_t k = (i + j + parity) & 1; k < level.mNumZ; k += 2)
+                        {
+                            if ( level.mCell[lineIdx + k] != MG_FLUID )
+                            {
+                                continue;
+                            }
+                            float diag;
+                            float sum = getNeighbourSum(level, x, i, j, k, diag);
+                            x[lineIdx + k] = (diag > 0.0f) ? (b[lineIdx + k] + sum) / diag : 0.0f;
+                        }
+                    });
+            }
+        }
+    }
+
+    void MultigridPreconditioner::computeResidual(MultigridLevel &level)
+    {
+        const float *x = level.mX.data();
+        forEachLine(level, [&](int64_t i, int64_t j)
+            {
+                int64_t lineIdx = (i*level.mNumY + j)*level.mNumZ;
+                for (int64_t k = 0; k < level.mNumZ; k++)
+                {
+                    float r = 0.0f;
+                    if ( level.mCell[lineIdx + k] == MG_FLUID )
+                    {
+                        float diag;
+                        float sum = getNeighbourSum(level, x, i, j, k, diag);
+                        r = level.mB[lineIdx + k] - (diag * x[lineIdx + k] - sum);
+                    }
+                    level.mR[lineIdx + k] = r;
+                }
+            });
+    }
+
+    void MultigridPreconditioner::restrictResidual(const MultigridLevel &fine, MultigridLevel &coarse)
+    {
+        forEachLine(coarse, [&](int64_t ci, int64_t cj)
+            {
+                for (int64_t ck = 0; ck < coarse.mNumZ; ck++)
+                {
+                    int64_t coarseIdx = (ci*coarse.mNumY + cj)*coarse.mNumZ + ck;
+                    coarse.mX[coarseIdx] = 0.0f;
+                    if ( coarse.mCell[coarseIdx] != MG_FLUID )
+                    {
+                        coarse.mB[coarseIdx] = 0.0f;
+                        continue;
+                    }
+                    float sum = 0.0f;
+                    for (int64_t i = 2*ci; i < std::min(2*ci + 2, fine.mNumX); i++)
+                        for (int64_t j = 2*cj; j < std::min(2*cj + 2, fine.mNumY); j++)
+                            for (int64_t k = 2*ck; k < std::min(2*ck + 2, fine.mNumZ); k++)
+                            {
+                                sum += fine.mR[(i*fine.mNumY + j)*fine.mNumZ + k];
+                            }
+                    coarse.mB[coarseIdx] = MULTIGRID_RESTRICT_SCALE * sum;
+                }
+            });
+    }
+
+    void MultigridPreconditioner::prolongateCorrection(const MultigridLevel &coarse, MultigridLevel &fine)
+    {
+        forEachLine(fine, [&](int64_t i, int64_t j)
+            {
+                int64_t lineIdx = (i*fine.mNumY + j)*fine.mNumZ;
+                int64_t coarseLineIdx = ((i/2)*coarse.mNumY + j/2)*coarse.mNumZ;
+                for (int64_t k = 0; k < fine.mNumZ; k++)
+                {
+                    if ( fine.mCell[lineIdx + k] == MG_FLUID )
+                    {
+                        fine.mX[lineIdx + k] += coarse.mX[coarseLineIdx + k/2];
+                    }
+                }
+            });
+    }
+
+    void MultigridPreconditioner::vCycle(int idxLevel)
+    {
+        MultigridLevel &level = mLevels[idxLevel];
+
+        if ( idxLevel == (int)mLevels.size() - 1 )
+        {
+            // coarsest level: symmetric sequence of sweeps
+            smooth(level, mNumCoarseSmooth, true);
+            smooth(level, mNumCoarseSmooth, false);
+            return;
+        }
+
+        smooth(level, mNumSmooth, true);
+        computeResidual(level);
+        restrictResidual(level, mLevels[idxLevel + 1]);
+        vCycle(idxLevel + 1);
+        prolongateCorrection(mLevels[idxLevel + 1], level);
+        smooth(level, mNumSmooth, false);
+    }
+
+    void MultigridPreconditioner::apply(const float *r, float *z)
+    {
+        MultigridLevel &fine = mLevels[0];
+        int N = mA->size();
+        const int64_t *voxelOfRow = mA->mVoxelOfRow.data();
+
+        // rows of A to the dense finest level
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    fine.mB[voxelOfRow[row]] = r[row];
+                }
+            });
+        std::fill(fine.mX.begin(), fine.mX.end(), 0.0f);
+
+        vCycle(0);
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    z[row] = fine.mX[voxelOfRow[row]];
+                }
+            });
+    }
+
+}
@@ -0,0 +1,98 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef MULTIGRID_H_
+#define MULTIGRID_H_
+
+#include <vector>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+
+#include "common.h"
+#include "log.h"
+#include "sparse_solver_cpu.h"
+#include "laplacian.h"
+
+// Minimum number of voxels of the coarsest level on each axis
+#define MULTIGRID_MIN_DIM 4
+
+using namespace std;
+
+namespace yapfs
+{
+
+    // Classification of the voxels of a multigrid level
+    enum MultigridCell { MG_SOLID=0, MG_FLUID=1, MG_AIR=2 };
+
+    // Dense voxel box of a multigrid level, voxels are indexed as (i*mNumY + j)*mNumZ + k
+    struct MultigridLevel
+    {
+        int64_t mNumX;
+        int64_t mNumY;
+        int64_t mNumZ;
+        vector<uint8_t> mCell; // MultigridCell
+        vector<float> mX; // solution
+        vector<float> mB; // rhs
+        vector<float> mR; // residual
+    };
+
+    // Geometric multigrid V-cycle used as preconditioner of the conjugate gradient (MGPCG).
+    // The finest level is the fluid/air/solid classification encoded in the LaplacianOperator masks,
+    // each coarser level halves the box: a coarse voxel is AIR if any child is AIR, otherwise FLUID if any
+    // child is FLUID, otherwise SOLID. Every level is rediscretized with the same 7-point stencil and
+    // smoothed with parallel red-black Gauss-Seidel; pre and post smoothing run in opposite color order
+    // and restriction is the transpose of the prolongation, so the V-cycle is symmetric as CG requires.
+    class MultigridPreconditioner : public Preconditioner
+    {
+        public:
+            const LaplacianOperator *mA;
+            vector<MultigridLevel> mLevels;
+            int mNumSmooth;       // red-black sweeps before and after the coarse correction
+            int mNumCoarseSmooth; // red-black sweeps on the coarsest level
+
+            MultigridPreconditioner(const LaplacianOperator &A, int numSmooth = 2, int numCoarseSmooth = 32);
+
+            // z = V-cycle(r) starting from z = 0
+            void apply(const float *r, float *z);
+
+        private:
+            void coarsen(const MultigridLevel &fine, MultigridLevel &coarse);
+            void smooth(MultigridLevel &level, int numSweeps, bool redFirst);
+            void computeResidual(MultigridLevel &level);
+            void restrictResidual(const MultigridLevel &fine, MultigridLevel &coarse);
+            void prolongateCorrection(const MultigridLevel &coarse, MultigridLevel &fine);
+            void vCycle(int idxLevel);
+    };
+
+}
+
+#endif /* MULTIGRID_H_ */
@@ -34,29 +34,34 @@ namespace yapfs
 
     // TODO: rewrite completely using Dneg's OpenVDBPoints
 
-    Particles::Particles(LReal voxelSize)
+    template<typename RealT>
+    Particles<RealT>::Particles(LReal voxelSize)
     {
         mVoxelSize = voxelSize;
     }
 
     // add 8 particles
-    void Particles::addParticlesInVoxel(Vec3d worldVoxelCenter)
+    template<typename RealT>
+    void Particles<RealT>::addParticlesInVoxel(Vec3d worldVoxelCenter)
     {
         LReal ds = mVoxelSize / 2.0;
 
         // TODO: put in place a better solution with jitter costant
         //mPosition.push_back(Vec3d( worldVoxelCenter.x(), worldVoxelCenter.y(), worldVoxelCenter.z() ));
         
-        mPosition.push_back(Vec3d( worldVoxelCenter.x() + ds * getRnd_0_1(), worldVoxelCenter.y() + ds * getRnd_0_1(), worldVoxelCenter.z() + ds * getRnd_0_1() ));
-        mPosition.push_back(Vec3d( worldVoxelCenter.x() + ds * getRnd_0_1(), worldVoxelCenter.y() + ds * getRnd_0_1(), worldVoxelCenter.z() - ds * getRnd_0_1() ));
-        mPosition.push_back(Vec3d( worldVoxelCenter.x() + ds * getRnd_0_1(), worldVoxelCenter.y() - ds * getRnd_0_1(), worldVoxelCenter.z() + ds * getRnd_0_1() ));
-        mPosition.push_back(Vec3d( worldVoxelCenter.x() - ds * getRnd_0_1(), worldVoxelCenter.y() + ds * getRnd_0_1(), worldVoxelCenter.z() + ds * getRnd_0_1() ));
-        mPosition.push_back(Vec3d( worldVoxelCenter.x() + ds * getRnd_0_1(), worldVoxelCenter.y() - ds * getRnd_0_1(), worldVoxelCenter.z() - ds * getRnd_0_1() ));
-        mPosition.push_back(Vec3d( worldVoxelCenter.x() - ds * getRnd_0_1(), worldVoxelCenter.y() - ds * getRnd_0_1(), worldVoxelCenter.z() + ds * getRnd_0_1() ));
-        mPosition.push_back(Vec3d( worldVoxelCenter.x() - ds * getRnd_0_1(), worldVoxelCenter.y() + ds * getRnd_0_1(), worldVoxelCenter.z() - ds * getRnd_0_1() ));
-        mPosition.push_back(Vec3d( worldVoxelCenter.x() - ds * getRnd_0_1(), worldVoxelCenter.y() - ds * getRnd_0_1(), worldVoxelCenter.z() - ds * getRnd_0_1() ));
+        mPosition.push_back(Vec3Type( worldVoxelCenter.x() + ds * getRnd_0_1(), worldVoxelCenter.y() + ds * getRnd_0_1(), worldVoxelCenter.z() + ds * getRnd_0_1() ));
+        mPosition.push_back(Vec3Type( worldVoxelCenter.x() + ds * getRnd_0_1(), worldVoxelCenter.y() + ds * getRnd_0_1(), worldVoxelCenter.z() - ds * getRnd_0_1() ));
+        mPosition.push_back(Vec3Type( worldVoxelCenter.x() + ds * getRnd_0_1(), worldVoxelCenter.y() - ds * getRnd_0_1(), worldVoxelCenter.z() + ds * getRnd_0_1() ));
+        mPosition.push_back(Vec3Type( worldVoxelCenter.x() - ds * getRnd_0_1(), worldVoxelCenter.y() + ds * getRnd_0_1(), worldVoxelCenter.z() + ds * getRnd_0_1() ));
+        mPosition.push_back(Vec3Type( worldVoxelCenter.x() + ds * getRnd_0_1(), worldVoxelCenter.y() - ds * getRnd_0_1(), worldVoxelCenter.z() - ds * getRnd_0_1() ));
+        mPosition.push_back(Vec3Type( worldVoxelCenter.x() - ds * getRnd_0_1(), worldVoxelCenter.y() - ds * getRnd_0_1(), worldVoxelCenter.z() + ds * getRnd_0_1() ));
+        mPosition.push_back(Vec3Type( worldVoxelCenter.x() - ds * getRnd_0_1(), worldVoxelCenter.y() + ds * getRnd_0_1(), worldVoxelCenter.z() - ds * getRnd_0_1() ));
+        mPosition.push_back(Vec3Type( worldVoxelCenter.x() - ds * getRnd_0_1(), worldVoxelCenter.y() - ds * getRnd_0_1(), worldVoxelCenter.z() - ds * getRnd_0_1() ));
 
 
     }
 
+    template class Particles<float>;
+    template class Particles<double>;
+
 }
@@ -56,12 +56,16 @@ namespace yapfs
 
     //TODO: for now this is a simple very brutal vector of particles, no index for voxel
 
+    // Positions and velocities stored with the scalar RealT, instantiated for float and double
+    template<typename RealT>
     class Particles
     {
 
         public:
-            vector<Vec3d> mPosition;
-            vector<Vec3d> mVelocity;
+            typedef typename RealGridTypes<RealT>::Vec3Type Vec3Type;
+
+            vector<Vec3Type> mPosition;
+            vector<Vec3Type> mVelocity;
             LReal mVoxelSize;
 
             Particles(LReal voxelSize);
@@ -0,0 +1,164 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#include "relaxation_solver.h"
+
+namespace yapfs
+{
+
+    RelaxationSolver::RelaxationSolver(const LaplacianOperator &A, RelaxationMethod method, float omega)
+    {
+        mA = &A;
+        mMethod = method;
+        mOmega = omega;
+
+        int N = A.size();
+        mDiag.resize(N);
+        A.diagonal(mDiag.data());
+        mWork.resize(N);
+
+        if (mMethod == RELAXATION_SOR)
+        {
+            for (int row = 0; row < N; row++)
+            {
+                int64_t i, j, k;
+                A.getVoxel(row, i, j, k);
+                mColorRows[(i + j + k) & 1].push_back(row);
+            }
+        }
+    }
+
+    void RelaxationSolver::sweepSOR(float *x, const float *b)
+    {
+        for (int color = 0; color < 2; color++)
+        {
+            const vector<int> &rows = mColorRows[color];
+            tbb::parallel_for(tbb::blocked_range<int>(0, (int)rows.size(), CPU_SOLVER_GRAIN_SIZE),
+                [&](const tbb::blocked_range<int> &range)
+                {
+                    for (int idx = range.begin(); idx != range.end(); ++idx)
+                    {
+                        int row = rows[idx];
+                        float diag = mDiag[row];
+                        // rows without non solid neighbours are not coupled to anything
+                        x[row] = (diag > 0.0f) ? (1.0f - mOmega) * x[row] + mOmega * (b[row] + mA->getNeighbourSum(row, x)) / diag : 0.0f;
+                    }
+                });
+        }
+    }
+
+    void RelaxationSolver::sweepJacobi(float *x, const float *b)
+    {
+        float *xOld = mWork.data();
+        int N = mA->size();
+        std::copy(x, x + N, xOld);
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    float diag = mDiag[row];
+                    x[row] = (diag > 0.0f) ? (1.0f - mOmega) * xOld[row] + mOmega * (b[row] + mA->getNeighbourSum(row, xOld)) / diag : 0.0f;
+                }
+            });
+    }
+
+    float RelaxationSolver::computeResidual(const float *x, const float *b)
+    {
+        float *Ax = mWork.data();
+        mA->apply(x, Ax);
+        double r2 = tbb::parallel_reduce(tbb::blocked_range<int>(0, mA->size(), CPU_SOLVER_GRAIN_SIZE), 0.0,
+            [&](const tbb::blocked_range<int> &range, double sum) -> double
+            {
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    double r = b[row] - Ax[row];
+                    sum += r * r;
+                }
+                return sum;
+            },
+            [](double s1, double s2) -> double { return s1 + s2; });
+        return sqrt(r2);
+    }
+
+    int RelaxationSolver::solve(float *x, const float *b, float tol, int maxSweeps, float &residual, SolverStats *stats)
+    {
+        if (stats != NULL)
+        {
+            stats->mN = mA->size();
+            stats->mInitialResidual = computeResidual(x, b);
+            stats->mResidualHistory.assign(1, stats->mInitialResidual);
+            stats->mStopReason = SOLVER_MAX_ITERATIONS;
+        }
+
+        int sweep = 0;
+        while (sweep < maxSweeps)
+        {
+            if ( (tol > 0.0f) && (sweep % RELAXATION_CHECK_INTERVAL == 0) )
+            {
+                float checkResidual = (sweep == 0 && stats != NULL) ? stats->mInitialResidual : computeResidual(x, b);
+                if ( (stats != NULL) && (sweep > 0) )
+                {
+                    stats->mResidualHistory.push_back(checkResidual);
+                }
+                if (checkResidual <= tol)
+                {
+                    if (stats != NULL)
+                    {
+                        stats->mStopReason = (sweep == 0) ? SOLVER_CONVERGED_INITIAL : SOLVER_CONVERGED;
+                    }
+                    break;
+                }
+            }
+
+            if (mMethod == RELAXATION_SOR)
+            {
+                sweepSOR(x, b);
+            }
+            else
+            {
+                sweepJacobi(x, b);
+            }
+            sweep++;
+        }
+
+        residual = computeResidual(x, b);
+        if (stats != NULL)
+        {
+            stats->mIterations = sweep;
+            stats->mFinalResidual = residual;
+            if (stats->mStopReason == SOLVER_MAX_ITERATIONS)
+            {
+                stats->mResidualHistory.push_back(residual);
+            }
+        }
+        return sweep;
+    }
+
+}
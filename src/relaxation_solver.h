@@ -0,0 +1,92 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef RELAXATION_SOLVER_H_
+#define RELAXATION_SOLVER_H_
+
+#include <vector>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+
+#include "common.h"
+#include "log.h"
+#include "sparse_solver_cpu.h"
+#include "laplacian.h"
+
+// Sweeps between two residual checks of the RelaxationSolver, a residual costs as much as a sweep
+#define RELAXATION_CHECK_INTERVAL 10
+
+// Default relaxation factors: SOR near the optimum of the 7-point Laplacian on the usual grids,
+// weighted Jacobi with the best smoothing of the high frequencies
+#define RELAXATION_SOR_OMEGA 1.8
+#define RELAXATION_JACOBI_OMEGA (2.0 / 3.0)
+
+using namespace std;
+
+namespace yapfs
+{
+
+    enum RelaxationMethod { RELAXATION_SOR=0, RELAXATION_JACOBI=1 };
+
+    // Relaxation solver of the pressure system working on the neighbour masks of the LaplacianOperator,
+    // no CSR matrix and no Krylov vectors: cheap approximate pressure for preview runs.
+    // RELAXATION_SOR is red-black successive over-relaxation: red voxels have i+j+k even and their
+    // fluid neighbours are all black, so the rows of a color are updated in parallel.
+    // RELAXATION_JACOBI is weighted Jacobi, omega around 2/3; SOR converges for 0 < omega < 2.
+    class RelaxationSolver
+    {
+        public:
+            const LaplacianOperator *mA;
+            RelaxationMethod mMethod;
+            float mOmega;
+
+            vector<float> mDiag;
+            vector<int>   mColorRows[2]; // rows of the red and of the black voxels
+            vector<float> mWork; // previous x of the Jacobi sweep, A*x of the residual
+
+            RelaxationSolver(const LaplacianOperator &A, RelaxationMethod method, float omega);
+
+            // Relax A*x = b starting from x: stops when |b - A*x| <= tol, checked every RELAXATION_CHECK_INTERVAL
+            // sweeps, or after maxSweeps; with tol <= 0 it always runs maxSweeps.
+            // stats, if not NULL, gets the residuals of the checks (only the initial and the final one with tol <= 0)
+            // returns the number of sweeps, residual is the final 2-norm of b - A*x
+            int solve(float *x, const float *b, float tol, int maxSweeps, float &residual, SolverStats *stats = NULL);
+
+        private:
+            void sweepSOR(float *x, const float *b);
+            void sweepJacobi(float *x, const float *b);
+            float computeResidual(const float *x, const float *b);
+    };
+
+}
+
+#endif /* RELAXATION_SOLVER_H_ */
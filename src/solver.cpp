@@ -43,6 +43,36 @@ namespace yapfs
         mMaxBox       = Vec3d(getConfig<LReal>("max_x"), getConfig<LReal>("max_y"), getConfig<LReal>("max_z") );
         mFramesPerSec = getConfig<uint32_t>("frames_per_sec");
         mNumFrames    = getConfig<uint32_t>("num_frames");
+        mPressureSolver = getConfig<std::string>("pressure_solver");
+        mPressurePreconditioner = getConfig<std::string>("pressure_preconditioner");
+        mPressureWarmStart = getConfig<bool>("pressure_warm_start");
+        mPressureDt = 0.0;
+        mPressureRefactorThreshold = getConfig<LReal>("pressure_refactor_threshold");
+        mPressurePrecision = getConfig<std::string>("pressure_precision");
+        mPressureRelaxationOmega = getConfig<LReal>("pressure_relaxation_omega");
+        mPressureRelaxationSweeps = getConfig<uint32_t>("pressure_relaxation_sweeps");
+        mPressureRelaxationTol = getConfig<LReal>("pressure_relaxation_tol");
+        mPressureCG = getConfig<std::string>("pressure_cg");
+        mPressureOperator = getConfig<std::string>("pressure_operator");
+        mPressureOrdering = getConfig<std::string>("pressure_ordering");
+        mPressureComponents = getConfig<bool>("pressure_components");
+        mPressureRefinementTol = getConfig<LReal>("pressure_refinement_tol");
+        mPressureVerify = getConfig<bool>("pressure_verify");
+        mPressureTolRelative = getConfig<LReal>("pressure_tol_relative");
+        mPressureTolDivergence = getConfig<LReal>("pressure_tol_divergence");
+        mPressureMaxIterations = getConfig<uint32_t>("pressure_max_iterations");
+        mSolverContext = new SolverContext();
+
+        std::string metricsFile = getConfig<std::string>("pressure_metrics_file");
+        mMetricsSink = metricsFile.empty() ? NULL : new SolverMetricsSink(metricsFile);
+
+#ifndef YAPFS_CUDA
+        if (mPressureSolver == "cuda")
+        {
+            L_LOG_WARN("Built without CUDA: pressure_solver switched to cpu");
+            mPressureSolver = "cpu";
+        }
+#endif
 
         mNX = (mMaxBox.x() - mMinBox.x()) / mVoxelSize;
         mNY = (mMaxBox.y() - mMinBox.y()) / mVoxelSize;
@@ -55,21 +85,23 @@ namespace yapfs
         mIdFrame = 0;
         mDt = mFrameTime;
 
-        // Create grids
-        mGVel        = new Grid<Vec3DGrid>(mVoxelSize); // velocity is in m/s
-        mGVelSave    = new Grid<Vec3DGrid>(mVoxelSize);
-        mGTypeVoxel  = new Grid<Int32Grid>(mVoxelSize);
-        mGDivergence = new Grid<DoubleGrid>(mVoxelSize);
-        mGP          = new Grid<DoubleGrid>(mVoxelSize);
-
-        mParticles  = new Particles(mVoxelSize);
-
-        mMinN = mGVel->getWorldToIndex(mMinBox);
+        // Grid indexes of the box, the dense grids are allocated on it
+        openvdb::math::Transform::Ptr linearTransform = openvdb::math::Transform::createLinearTransform(mVoxelSize);
+        mMinN = linearTransform->worldToIndex(mMinBox);
         L_LOG_INFO("mMinN: " + to_string(mMinN.x()) + ", " + to_string(mMinN.y()) + ", " + to_string(mMinN.z()));
 
-        mMaxN = mGVel->getWorldToIndex(mMaxBox);
+        mMaxN = linearTransform->worldToIndex(mMaxBox);
         L_LOG_INFO("mMaxN: " + to_string(mMaxN.x()) + ", " + to_string(mMaxN.y()) + ", " + to_string(mMaxN.z()));
 
+        // Create grids
+        mGVel        = new VelocityGrid(mVoxelSize, mMinN, mMaxN); // velocity is in m/s
+        mGVelSave    = new VelocityGrid(mVoxelSize, mMinN, mMaxN);
+        mGTypeVoxel  = new TypeVoxelGrid(mVoxelSize, mMinN, mMaxN);
+        mGDivergence = new ScalarGrid(mVoxelSize, mMinN, mMaxN);
+        mGP          = new ScalarGrid(mVoxelSize, mMinN, mMaxN);
+
+        mParticles  = new SolverParticles(mVoxelSize);
+
     }
 
     void Solver::initGrids()
@@ -93,8 +125,7 @@ namespace yapfs
 
         //TODO : assign velocity: it is just for first debugging
         for(int64_t i = 0; i < (mParticles->mPosition).size(); ++i){
-            Vec3d particlePosition = (mParticles->mPosition)[i];
-            Vec3d velCentr(0.0, 0.0, 0.0);
+            SolverParticles::Vec3Type velCentr(0.0, 0.0, 0.0);
             mParticles->mVelocity.push_back(velCentr);
         }
 
@@ -105,14 +136,38 @@ namespace yapfs
 
     }
 
-    Vec3d Solver::getAbsMax(Grid<Vec3DGrid> *grid)
+    // Max absolute value of each velocity component, over its face grid
+    Vec3d Solver::getAbsMax(VelocityGrid *grid)
     {
-        Vec3d absMax(0.0, 0.0, 0.0);
-        openvdb::tools::foreach(grid->mGrid->cbeginValueOn(), AbsMax(&absMax), true);
+        Vec3d absMax(getAbsMax(grid->getFace(0)), getAbsMax(grid->getFace(1)), getAbsMax(grid->getFace(2)));
         //L_LOG_DEBUG("absMax: " + to_string(absMax.x()) + ", " + to_string(absMax.y()) + ", " + to_string(absMax.z()));
         return absMax;
     }
 
+    LReal Solver::getAbsMax(Grid<RealGrid> *grid)
+    {
+        LStoreReal minValue, maxValue;
+        grid->mGrid->evalMinMax(minValue, maxValue);
+        return std::max(std::fabs(minValue), std::fabs(maxValue));
+    }
+
+    // Max absolute value over the array of a dense grid
+    LReal Solver::getAbsMax(Grid<RealGrid, DenseStorage> *grid)
+    {
+        size_t size = (size_t)grid->getDim().x() * grid->getStrideX();
+        const LStoreReal *data = grid->getData(0);
+        return tbb::parallel_reduce(tbb::blocked_range<size_t>(0, size, CPU_SOLVER_GRAIN_SIZE), (LStoreReal)0.0,
+            [&](const tbb::blocked_range<size_t> &range, LStoreReal maxValue) -> LStoreReal
+            {
+                for (size_t index = range.begin(); index != range.end(); ++index)
+                {
+                    maxValue = std::max(maxValue, std::fabs(data[index]));
+                }
+                return maxValue;
+            },
+            [](LStoreReal max1, LStoreReal max2) -> LStoreReal { return std::max(max1, max2); });
+    }
+
     LReal Solver::getCFL()
     {
         Vec3d absMax = getAbsMax(mGVel);
@@ -168,6 +223,7 @@ namespace yapfs
 
     void Solver::doStep(LReal dt)
     {
+        mDt = dt;
 
         for(int64_t i = 0; i < 5; ++i)
         {
@@ -208,10 +264,12 @@ namespace yapfs
         frameParticleV.push_back(mParticles->mVelocity); // particles velocity
 
         Grid<Vec3DGrid> copyGridV(mGVel->mVoxelSize);
-        copyGridV.deepCopyFromGrid(mGVel);
+        mGVel->exportToGrid(copyGridV);
         frameGridV.push_back(copyGridV); // grids velocities
 
-        frameGridT.push_back(*mGTypeVoxel); // grids type voxels
+        Grid<Int32Grid> copyGridT(mGTypeVoxel->mVoxelSize);
+        mGTypeVoxel->exportToGrid(copyGridT);
+        frameGridT.push_back(copyGridT); // grids type voxels
 
     }
 
@@ -221,17 +279,17 @@ namespace yapfs
         // First implementation using tools::BoxSampler and Runge-Kutta implemented from scratch
         for(int64_t i = 0; i < (mParticles->mPosition).size(); ++i)
         {
-            Vec3d particlePosition = (mParticles->mPosition)[i];
+            Vec3d particlePosition((mParticles->mPosition)[i]);
 
             // first stage of Runge-Kutta 2 (do a half Euler step)
             Vec3d indexSpacePoint = mGVel->getWorldToIndex(particlePosition); // particle grid index space point
             // Trilinear interpolation
-            Vec3d gu = tools::BoxSampler::sample(mGVel->mGrid->tree(), indexSpacePoint);
+            Vec3d gu = mGVel->sample(indexSpacePoint);
             // Runge-Kutta second order
             Vec3d midPoint = particlePosition + 0.5 * dt * gu;
 
             indexSpacePoint = mGVel->getWorldToIndex(midPoint);
-            gu = tools::BoxSampler::sample(mGVel->mGrid->tree(), indexSpacePoint);
+            gu = mGVel->sample(indexSpacePoint);
             // second stage of Runge-Kutta 2
             particlePosition = particlePosition + dt * gu;
 
@@ -239,7 +297,7 @@ namespace yapfs
             clampToGrid(particlePosition);
 
             // save particle
-            (mParticles->mPosition)[i] = particlePosition;
+            (mParticles->mPosition)[i] = SolverParticles::Vec3Type(particlePosition);
 
         }
 
@@ -248,7 +306,7 @@ namespace yapfs
         typedef tools::VelocityIntegrator<openvdb::Vec3DGrid, true>  VelocityIntg;
         VelocityIntg velInt(*(mGVel->mGrid));
         for(int64_t i = 0; i < (mParticles->mPosition).size(); ++i){
-            Vec3d particlePosition = (mParticles->mPosition)[i];
+            Vec3d particlePosition((mParticles->mPosition)[i]);
 
             velInt.rungeKutta<4, openvdb::Vec3d>(dt, particlePosition); //4 runge kutta
 
@@ -284,19 +342,20 @@ namespace yapfs
     void Solver::transferToGrid()
     {
         // init grid to save weights sum
-        Grid<Vec3DGrid> *sum = new Grid<Vec3DGrid>(mVoxelSize);
+        VelocityGrid *sum = new VelocityGrid(mVoxelSize, mMinN, mMaxN);
 
         // clear all previous velocity values in mGVel
         mGVel->clear();
+        ScalarGrid::Accessor velAccessor[3] = { mGVel->getFace(0)->getAccessor(), mGVel->getFace(1)->getAccessor(), mGVel->getFace(2)->getAccessor() };
+        ScalarGrid::Accessor sumAccessor[3] = { sum->getFace(0)->getAccessor(), sum->getFace(1)->getAccessor(), sum->getFace(2)->getAccessor() };
 
         Vec3i ijk[3];
         Vec3d fxyz[3];
-        Vec3d component[3];
 
         // loop over all the particles
         for(int64_t i = 0; i < (mParticles->mPosition).size(); ++i)
         {
-            Vec3d particlePosition = (mParticles->mPosition)[i];
+            Vec3d particlePosition((mParticles->mPosition)[i]);
             Vec3d cindexSpacePoint = mGVel->getWorldToIndex(particlePosition);
             Vec3i cijk = Vec3i( floor(cindexSpacePoint.x()), floor(cindexSpacePoint.y()), floor(cindexSpacePoint.z()) );
             Vec3d cfxyz = Vec3d( cindexSpacePoint.x() - floor(cindexSpacePoint.x()), cindexSpacePoint.y() - floor(cindexSpacePoint.y()), cindexSpacePoint.z() - floor(cindexSpacePoint.z()) ); //TODO: fix with floor
@@ -322,15 +381,12 @@ namespace yapfs
             // X
             ijk[0].init(cijk.x(), sijk.y(), sijk.z());
             fxyz[0].init(cfxyz.x(), sfxyz.y(), sfxyz.z());
-            component[0].init(1.0, 0.0, 0.0);
             // Y
             ijk[1].init(sijk.x(), cijk.y(), sijk.z());
             fxyz[1].init(sfxyz.x(), cfxyz.y(), sfxyz.z());
-            component[1].init(0.0, 1.0, 0.0);
             // Z
             ijk[2].init(sijk.x(), sijk.y(), cijk.z());
             fxyz[2].init(sfxyz.x(), sfxyz.y(), cfxyz.z());
-            component[2].init(0.0, 0.0, 1.0); 
 
             // loop on x, y, z
             for(uint8_t compIdx = 0; compIdx < 3; ++compIdx)
@@ -352,10 +408,10 @@ namespace yapfs
                                             ( 1 - getComponentWeight(fxyz[compIdx].z(), cz) );
 
                             // applying formula same in book Fluid Simulation for Computer Graphics by Robert Bridson (second edition) at page 117
-                            Vec3d vel = mGVel->getValue(ijk[compIdx].x()+cx, ijk[compIdx].y()+cy, ijk[compIdx].z()+cz) + weight * mParticles->mVelocity[i] * component[compIdx];
-                            mGVel->setValue(vel, ijk[compIdx].x()+cx, ijk[compIdx].y()+cy, ijk[compIdx].z()+cz);
-                            Vec3d sumVoxel = sum->getValue(ijk[compIdx].x()+cx, ijk[compIdx].y()+cy, ijk[compIdx].z()+cz) + weight * component[compIdx];
-                            sum->setValue(sumVoxel, ijk[compIdx].x()+cx, ijk[compIdx].y()+cy, ijk[compIdx].z()+cz);
+                            LReal vel = velAccessor[compIdx].getValue(ijk[compIdx].x()+cx, ijk[compIdx].y()+cy, ijk[compIdx].z()+cz) + weight * mParticles->mVelocity[i][compIdx];
+                            velAccessor[compIdx].setValue(vel, ijk[compIdx].x()+cx, ijk[compIdx].y()+cy, ijk[compIdx].z()+cz);
+                            LReal sumVoxel = sumAccessor[compIdx].getValue(ijk[compIdx].x()+cx, ijk[compIdx].y()+cy, ijk[compIdx].z()+cz) + weight;
+                            sumAccessor[compIdx].setValue(sumVoxel, ijk[compIdx].x()+cx, ijk[compIdx].y()+cy, ijk[compIdx].z()+cz);
 
                         }
                     }
@@ -365,21 +421,21 @@ namespace yapfs
         }
 
         // denominator of furmula at page 117 (see comment above)
-        for(int64_t i = mMinN.x(); i < mMaxN.x()+1; ++i)
-            for(int64_t j = mMinN.y(); j < mMaxN.y()+1; ++j)
-                for(int64_t k = mMinN.z(); k < mMaxN.z()+1; ++k)
+        for(int compIdx = 0; compIdx < 3; ++compIdx)
+        {
+            mGVel->getFace(compIdx)->forEachBlock(mMinN, mMaxN + Vec3i(1, 1, 1),
+                [&](ScalarGrid::Block &block)
                 {
-                    Vec3d vel = mGVel->getValue(i, j, k);
-                    Vec3d sumVoxel = sum->getValue(i, j, k);
-
-                    LReal xResult = sumVoxel.x() != 0 ? vel.x() / sumVoxel.x() : 0.0;
-                    LReal yResult = sumVoxel.y() != 0 ? vel.y() / sumVoxel.y() : 0.0;
-                    LReal zResult = sumVoxel.z() != 0 ? vel.z() / sumVoxel.z() : 0.0;
-
-                    Vec3d result(xResult, yResult, zResult);
-                    mGVel->setValue(result , i, j, k);
-
-                }
+                    ScalarGrid::ConstAccessor sumFaceAccessor = sum->getFace(compIdx)->getConstAccessor();
+                    for(int64_t i = block.getBegin().x(); i < block.getEnd().x(); ++i)
+                        for(int64_t j = block.getBegin().y(); j < block.getEnd().y(); ++j)
+                            for(int64_t k = block.getBegin().z(); k < block.getEnd().z(); ++k)
+                            {
+                                LReal sumVoxel = sumFaceAccessor.getValue(i, j, k);
+                                block.setValue(sumVoxel != 0 ? block.getValue(i, j, k) / sumVoxel : 0.0, i, j, k);
+                            }
+                });
+        }
 
         delete sum;
     }
@@ -393,19 +449,17 @@ namespace yapfs
     {
         LReal dtg = dt * mGravity;
 
-        for(int64_t i = mMinN.x(); i < mMaxN.x()+1; ++i)
-            for(int64_t j = mMinN.y(); j < mMaxN.y()+1; ++j)
-                for(int64_t k = mMinN.z(); k < mMaxN.z()+1; ++k)
-                {
-                    Vec3d vel = mGVel->getValue(i, j, k);
-
-                    LReal xResult = vel.x();
-                    LReal yResult = vel.y() - dtg;
-                    LReal zResult = vel.z();
-
-                    Vec3d result(xResult, yResult, zResult);
-                    mGVel->setValue(result , i, j, k);
-                }
+        // gravity along y, only the y faces change
+        mGVel->getFace(1)->forEachBlock(mMinN, mMaxN + Vec3i(1, 1, 1),
+            [&](ScalarGrid::Block &block)
+            {
+                for(int64_t i = block.getBegin().x(); i < block.getEnd().x(); ++i)
+                    for(int64_t j = block.getBegin().y(); j < block.getEnd().y(); ++j)
+                        for(int64_t k = block.getBegin().z(); k < block.getEnd().z(); ++k)
+                        {
+                            block.setValue(block.getValue(i, j, k) - dtg, i, j, k);
+                        }
+            });
     }
 
     void Solver::addExternalForces(LReal dt)
@@ -421,20 +475,21 @@ namespace yapfs
         // Mark all as AIR
 	// TODO: use instead a default grid value VoxelType::AIR
         mGTypeVoxel->clear();
+        TypeVoxelGrid::Accessor typeAccessor = mGTypeVoxel->getAccessor();
         for(int64_t i = mMinN.x(); i < mMaxN.x(); ++i)
             for(int64_t j = mMinN.y(); j < mMaxN.y(); ++j)
                 for(int64_t k = mMinN.z(); k < mMaxN.z(); ++k)
                 {
-                    mGTypeVoxel->setValue(VoxelType::AIR, i, j, k);
+                    typeAccessor.setValue(VoxelType::AIR, i, j, k);
                 }
 
 
         for(int64_t i = 0; i < (mParticles->mPosition).size(); ++i)
         {
-            Vec3d particlePosition = (mParticles->mPosition)[i];
+            Vec3d particlePosition((mParticles->mPosition)[i]);
             Vec3d cindexSpacePoint = mGVel->getWorldToIndex(particlePosition);
             Vec3i cijk = Vec3i( floor(cindexSpacePoint.x()), floor(cindexSpacePoint.y()), floor(cindexSpacePoint.z()) );
-            mGTypeVoxel->setValue(VoxelType::FLUID, cijk.x(), cijk.y(), cijk.z());
+            typeAccessor.setValue(VoxelType::FLUID, cijk.x(), cijk.y(), cijk.z());
             //L_LOG_DEBUG("FLUID: " + to_string(i) + " --> " + to_string(cijk.x()) + ", " + to_string(cijk.y()) + ", " + to_string(cijk.z()));
             //L_LOG_DEBUG("particlePosition: " + to_string(particlePosition.x()) + ", " + to_string(particlePosition.y()) + ", " + to_string(particlePosition.z()));
         }
@@ -470,29 +525,95 @@ namespace yapfs
 
     void Solver::boundaryConditions()
     {
-        // TODO: for empty box only loop on boundary surfaces, to improve performance
         // TODO: implement for solid voxels
 
-        for(int64_t i = mMinN.x(); i < mMaxN.x()+1; ++i)
-            for(int64_t j = mMinN.y(); j < mMaxN.y()+1; ++j)
-                for(int64_t k = mMinN.z(); k < mMaxN.z()+1; ++k)
-                {
-                    Vec3d vel = mGVel->getValue(i, j, k);
+        // the faces of each component on the two walls of the box normal to it
+        for(int compIdx = 0; compIdx < 3; ++compIdx)
+            for(int wall = 0; wall < 2; ++wall)
+            {
+                Vec3i begin = mMinN;
+                Vec3i end = mMaxN + Vec3i(1, 1, 1);
+                begin[compIdx] = wall ? mMaxN[compIdx] : mMinN[compIdx];
+                end[compIdx] = begin[compIdx] + 1;
+                mGVel->getFace(compIdx)->forEachBlock(begin, end,
+                    [&](ScalarGrid::Block &block)
+                    {
+                        for(int64_t i = block.getBegin().x(); i < block.getEnd().x(); ++i)
+                            for(int64_t j = block.getBegin().y(); j < block.getEnd().y(); ++j)
+                                for(int64_t k = block.getBegin().z(); k < block.getEnd().z(); ++k)
+                                {
+                                    block.setValue(0.0, i, j, k);
+                                }
+                    });
+            }
+    }
 
-                    LReal xResult = vel.x();
-                    LReal yResult = vel.y();
-                    LReal zResult = vel.z();
+    // VoxelFlag of each voxel of the box in the box index order of LaplacianOperator, the slabs of constant i
+    // are read in parallel, each task with its own accessor
+    void Solver::fillVoxelFlags(vector<uint8_t> &flags)
+    {
+        int64_t numY = mMaxN.y() - mMinN.y();
+        int64_t numZ = mMaxN.z() - mMinN.z();
+        flags.resize((mMaxN.x() - mMinN.x()) * numY * numZ);
+        tbb::parallel_for(tbb::blocked_range<int64_t>(mMinN.x(), mMaxN.x()),
+            [&](const tbb::blocked_range<int64_t> &range)
+            {
+                TypeVoxelGrid::ConstAccessor accessor = mGTypeVoxel->getConstAccessor();
+                for(int64_t i = range.begin(); i != range.end(); ++i)
+                {
+                    uint8_t *slab = flags.data() + (i - mMinN.x()) * numY * numZ;
+                    for(int64_t j = mMinN.y(); j < mMaxN.y(); ++j)
+                        for(int64_t k = mMinN.z(); k < mMaxN.z(); ++k)
+                        {
+                            int32_t type = accessor.getValue(i, j, k);
+                            uint8_t flag = 0;
+                            if ( type == VoxelType::FLUID )
+                            {
+                                flag = VOXEL_FLUID | VOXEL_NON_SOLID;
+                            }
+                            else if ( type != VoxelType::SOLID )
+                            {
+                                flag = VOXEL_NON_SOLID;
+                            }
+                            slab[(j - mMinN.y()) * numZ + (k - mMinN.z())] = flag;
+                        }
+                }
+            });
+    }
 
-                    if ( (i == mMinN.x()) || (i == mMaxN.x()) )
-                        xResult = 0.0;
-                    if ( (j == mMinN.y()) || (j == mMaxN.y()) )
-                        yResult = 0.0;
-                    if ( (k == mMinN.z()) || (k == mMaxN.z()) )
-                        zResult = 0.0;
+    Preconditioner *Solver::createPreconditioner(const LaplacianOperator &laplacian)
+    {
+        if (mPressurePreconditioner == "mic")
+        {
+            return new MICPreconditioner(laplacian, true);
+        }
+        else if (mPressurePreconditioner == "mic_serial")
+        {
+            return new MICPreconditioner(laplacian, false);
+        }
+        else if (mPressurePreconditioner == "multigrid")
+        {
+            return new MultigridPreconditioner(laplacian);
+        }
+        else if (mPressurePreconditioner == "dct")
+        {
+            return new DCTPreconditioner(laplacian);
+        }
+        else if (mPressurePreconditioner == "amg")
+        {
+            return new AMGPreconditioner(laplacian);
+        }
+        return new JacobiPreconditioner(laplacian);
+    }
 
-                    Vec3d result(xResult, yResult, zResult);
-                    mGVel->setValue(result , i, j, k);
-                }
+    // The preconditioner of the previous step is reused when the fluid topology is unchanged and updated on the
+    // changed rows when few rows changed; it is built again when the rows changed since its build are too many.
+    // The change is applied once, the refinements of a mixed precision solve get the same preconditioner
+    Preconditioner *Solver::updatePreconditioner()
+    {
+        return mSolverContext->getPreconditioner(
+            [this](const LaplacianOperator &A) -> Preconditioner * { return createPreconditioner(A); },
+            mPressureRefactorThreshold);
     }
 
     void Solver::solvePressure()
@@ -503,180 +624,326 @@ namespace yapfs
         int64_t mNumX = mMaxN.x() - mMinN.x();
         int64_t mNumY = mMaxN.y() - mMinN.y();
         int64_t mNumZ = mMaxN.z() - mMinN.z();
-        int M;
-        int N;
-        M = N = mNumX * mNumY * mNumZ; // tridiagonal symmetric matrix in CSR format with I,J,val,nz
-        float *x = (float *)malloc(sizeof(float)*N); // x vector
-        float *rhs = (float *)malloc(sizeof(float)*N); // b vector
 
-        // Count all fluid voxels and populate x and rhs
-        uint64_t numFluidVoxel = 0;
-        uint64_t idxMat = 0;
-        for(int64_t i = mMinN.x(); i < mMaxN.x(); ++i)
-            for(int64_t j = mMinN.y(); j < mMaxN.y(); ++j)
-                for(int64_t k = mMinN.z(); k < mMaxN.z(); ++k)
-                {
-                    // count all fluid voxels
-                    if ( mGTypeVoxel->getValue(i, j, k) == VoxelType::FLUID )
-                    {
-                        numFluidVoxel++;
-                    }
+        // A*x = b (b is rhs): only the fluid voxels are unknowns,
+        // the matrix A is represented by the neighbour mask of each fluid voxel
+        // the system and its buffers are kept in mSolverContext and reused at each step
+        mSolverContext->reset(mNumX, mNumY, mNumZ);
+        LaplacianOperator &laplacian = mSolverContext->mLaplacian;
+
+        // Number all fluid voxels and set their neighbour masks: the types are read once into a dense box,
+        // the row of each voxel in mRowOfVoxel is then the index grid of the whole step
+        fillVoxelFlags(mSolverContext->mVoxelFlags);
+        laplacian.build(mSolverContext->mVoxelFlags.data());
+        // optional numbering with near neighbours in memory, everything after follows mVoxelOfRow and mRowOfVoxel
+        if (mPressureOrdering == "morton")
+        {
+            laplacian.reorder(ROW_ORDER_MORTON);
+        }
+        else if (mPressureOrdering == "rcm")
+        {
+            laplacian.reorder(ROW_ORDER_RCM);
+        }
 
-                    // populate x and rhs
-                    LReal divergenceVal = mGDivergence->getValue(i, j, k);
-                    rhs[idxMat] = divergenceVal;
-                    x[idxMat] = 0.0;
-                    idxMat++;
-                }
-        // maximize the array elements using numFluidVoxel => nz
+        int M;
+        int N;
+        M = N = laplacian.size(); // symmetric matrix with 7-point stencil, a row for each fluid voxel
 
-        if ( numFluidVoxel == 0 )
+        if ( N == 0 )
         {
             L_LOG_WARN("numFluidVoxel is 0, skip solvePressure");
             return;
         }
 
-        // A*x = b (b is rhs)
-        int *I;
-        int *J;
-        float *val;
-        int nz;
-        nz = numFluidVoxel * 7; //Maximum: 7 elements per row 
-        I = (int *)malloc(sizeof(int)*(N+1));
-        J = (int *)malloc(sizeof(int)*nz);
-        val = (float *)malloc(sizeof(float)*nz);
-
-        //Populate val, I, J using sparse CSR format
-        int64_t idxVal = 0; //TODO: remove it is reduntant
-        int64_t idxI = 0;
-        int64_t idxJ = 0;
-        //idxMat = 0;
-        for(int64_t i = mMinN.x(); i < mMaxN.x(); ++i)
-            for(int64_t j = mMinN.y(); j < mMaxN.y(); ++j)
-                for(int64_t k = mMinN.z(); k < mMaxN.z(); ++k)
-                {
+        mSolverContext->resize(N);
+        float *x = mSolverContext->mX.data(); // x vector
+        float *rhs = mSolverContext->mRhs.data(); // b vector
 
-                    // check error
-                    //if ( (idxVal != idxJ) || (idxJ >= nz) )
-                    //{
-                    //    L_LOG_ERROR("Error: array index is greater than nz: " + to_string(nz) + " idxJ:" + to_string(idxJ));
-                    //    L_LOG_ERROR("idxVal: " + to_string(idxVal) + " idxJ:" + to_string(idxJ));
-                    //    exit(-1);
-                    //}
+        // mixed precision: x and b are kept in double too, the float vectors are used by the inner solves
+        bool mixedPrecision = (mPressurePrecision == "mixed");
+        if (mixedPrecision)
+        {
+            mSolverContext->resizeDouble(N);
+        }
+        double *xDouble = mSolverContext->mXDouble.data();
+        double *rhsDouble = mSolverContext->mRhsDouble.data();
 
-                    I[idxI++] = idxJ;
+        // warm start: the pressure of the previous step, scaled by the ratio of the time steps
+        // since the pressure here is the impulse p*dt/density
+        bool warmStart = mPressureWarmStart && (mPressureDt > 0.0);
+        LReal warmStartScale = warmStart ? mDt / mPressureDt : 0.0;
 
-                    // sparse matrix has row with elements non zero only in fluid voxels
-                    if ( mGTypeVoxel->getValue(i, j, k) == VoxelType::FLUID )
+        // populate x and rhs in parallel, one accessor for each range of rows
+        LReal maxDivergence = tbb::parallel_reduce(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE), (LReal)0.0,
+            [&](const tbb::blocked_range<int> &range, LReal maxValue) -> LReal
+            {
+                ScalarGrid::ConstAccessor divergenceAccessor = mGDivergence->getConstAccessor();
+                ScalarGrid::ConstAccessor pressureAccessor = mGP->getConstAccessor();
+                for (int row = range.begin(); row != range.end(); ++row)
+                {
+                    int64_t i, j, k;
+                    laplacian.getVoxel(row, i, j, k);
+                    i += mMinN.x();
+                    j += mMinN.y();
+                    k += mMinN.z();
+
+                    LReal divergenceVal = divergenceAccessor.getValue(i, j, k);
+                    LReal pressureVal = warmStart ? warmStartScale * pressureAccessor.getValue(i, j, k) : 0.0;
+                    rhs[row] = divergenceVal;
+                    x[row] = pressureVal;
+                    maxValue = std::max(maxValue, std::fabs(divergenceVal));
+                    if (mixedPrecision)
                     {
+                        rhsDouble[row] = divergenceVal;
+                        xDouble[row] = pressureVal;
+                    }
+                }
+                return maxValue;
+            },
+            [](LReal max1, LReal max2) -> LReal { return std::max(max1, max2); });
 
-                        if ( ( mGTypeVoxel->getValue(i - 1, j, k) == VoxelType::FLUID ) && (i - 1 >= mMinN.x()) ) //TODO cambiare ordine condizioni
-                        {
-                            int64_t idx_col = (i -1 - mMinN.x())*mNumY*mNumZ + (j - mMinN.y())*mNumZ + (k - mMinN.z());
-                            //printf("i-1: %d \n", idx_col);
-                            val[idxVal++] = -1;
-                            J[idxJ++] = idx_col;
-                        }
+        mSolverContext->compareTopology();
 
-                        if ( ( mGTypeVoxel->getValue(i, j - 1, k) == VoxelType::FLUID ) && (j - 1 >= mMinN.y()) )
-                        {
-                            int64_t idx_col = (i - mMinN.x())*mNumY*mNumZ + (j - 1 - mMinN.y())*mNumZ + (k - mMinN.z());
-                            //printf("j-1: %d \n", idx_col);
-                            val[idxVal++] = -1;
-                            J[idxJ++] = idx_col;
-                        }
+        // everything is ready...
 
-                        if ( ( mGTypeVoxel->getValue(i, j, k - 1) == VoxelType::FLUID ) && (k - 1 >= mMinN.z()) )
+        // execute the pressure solver
+        SolverStats stats;
+        if ( (mPressureTolDivergence > 0.0) && (maxDivergence * mDt / mVoxelSize <= mPressureTolDivergence) )
+        {
+            // early exit: the velocities are already divergence free within the tolerance, no pressure to add.
+            // The preconditioner is not asked for, the change of the fluid stays pending until the next solve
+            // since compareTopology() compares with the topology the preconditioner was built on
+            std::fill(x, x + N, 0.0f);
+            if (mixedPrecision)
+            {
+                std::fill(xDouble, xDouble + N, 0.0);
+            }
+            stats.mSolver = mPressureSolver;
+            stats.mN = N;
+            stats.mInitialResidual = stats.mFinalResidual = sqrt(cpuDot(rhs, rhs, N));
+            stats.mStopReason = SOLVER_CONVERGED_INITIAL;
+        }
+        else if (mixedPrecision)
+        {
+            solvePressureMixed(stats);
+        }
+        else
+        {
+            // initial residual, used to report the warm start gain
+            vector<float> &rhsResidual = mSolverContext->mRhsResidual;
+            if (warmStart)
+            {
+                rhsResidual.resize(N);
+                laplacian.apply(x, rhsResidual.data());
+                tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+                    [&](const tbb::blocked_range<int> &range)
+                    {
+                        for(int row = range.begin(); row != range.end(); ++row)
                         {
-                            int64_t idx_col = (i - mMinN.x())*mNumY*mNumZ + (j - mMinN.y())*mNumZ + (k - 1 - mMinN.z());
-                            //printf("k-1: %d \n", idx_col);
-                            val[idxVal++] = -1;
-                            J[idxJ++] = idx_col;
+                            rhsResidual[row] = rhs[row] - rhsResidual[row];
                         }
+                    });
+            }
 
-                        //printf("ROW: %d \n", idx_row);
-                        // Diagonal
-                        LReal omega = 6.0;
-                        if ( i <= mMinN.x() )
-                            omega -= 1.0;
-                        if ( i >= mMaxN.x() -1 )
-                            omega -= 1.0;
-                        if ( j <= mMinN.y() )
-                            omega -= 1.0;
-                        if ( j >= mMaxN.y() -1 )
-                            omega -= 1.0;
-                        if ( k <= mMinN.z() )
-                            omega -= 1.0;
-                        if ( k >= mMaxN.z() -1 )
-                            omega -= 1.0;
-                        if ( omega != 0.0 )
-                        {
-                            int64_t idx_col = (i - mMinN.x())*mNumY*mNumZ + (j - mMinN.y())*mNumZ + (k - mMinN.z());
-                            //printf("idx_col: %d  omega: %f\n", idx_col, omega);
-                            val[idxVal++] = omega;
-                            J[idxJ++] = idx_col;
-                        }
+            runPressureSolver(x, rhs, getPressureTolerance(N), stats);
 
-                        if ( ( mGTypeVoxel->getValue(i, j, k + 1) == VoxelType::FLUID ) && (k + 1 < mMaxN.z()) )
-                        {
-                            int64_t idx_col = (i - mMinN.x())*mNumY*mNumZ + (j - mMinN.y())*mNumZ + (k + 1 - mMinN.z());
-                            //printf("k+1: %d \n", idx_col);
-                            val[idxVal++] = -1;
-                            J[idxJ++] = idx_col;
-                        }
+            if (warmStart && (mPressureSolver == "cpu"))
+            {
+                logWarmStart(laplacian, rhsResidual.data(), rhs, stats);
+            }
+        }
 
-                        if ( ( mGTypeVoxel->getValue(i, j + 1, k) == VoxelType::FLUID ) && (j + 1 < mMaxN.y()) )
-                        {
-                            int64_t idx_col = (i - mMinN.x())*mNumY*mNumZ + (j + 1 - mMinN.y())*mNumZ + (k - mMinN.z());
-                            //printf("j+1: %d \n", idx_col);
-                            val[idxVal++] = -1;
-                            J[idxJ++] = idx_col;
-                        }
+        // populate mGP: pressure grid, scatter the fluid rows back to their voxels
+        // (the writes of an OpenVDB tree are not thread safe, one accessor for all the rows)
+        mGP->clear();
+        mPressureDt = mDt;
+        ScalarGrid::Accessor pressureAccessor = mGP->getAccessor();
+        for(int row = 0; row < N; ++row)
+        {
+            int64_t i, j, k;
+            laplacian.getVoxel(row, i, j, k);
+            pressureAccessor.setValue(mixedPrecision ? xDouble[row] : x[row], i + mMinN.x(), j + mMinN.y(), k + mMinN.z());
+        }
 
-                        if ( ( mGTypeVoxel->getValue(i + 1, j, k) == VoxelType::FLUID ) && (i + 1 < mMaxN.x()) )
-                        {
-                            int64_t idx_col = (i + 1 - mMinN.x())*mNumY*mNumZ + (j - mMinN.y())*mNumZ + (k - mMinN.z());
-                            //printf("i+1: %d \n", idx_col);
-                            val[idxVal++] = -1;
-                            J[idxJ++] = idx_col;
-                        }
+        addGradient();
 
-                    }
+        if (mPressureVerify)
+        {
+            stats.mDivergence = getMaxDivergence() * mDt / mVoxelSize;
+        }
+        reportPressureStats(stats);
 
-                }
+    }
 
-        // for matrix in CSR format the last entry contains nnz: number of not zero values of val 
-        I[N] = idxVal;
-        nz = idxVal; // use the actual number of not zero values of val
+    // Stopping criterion of the pressure solve: mPressureTolRelative * |rhs|, or the residual at which the fluid
+    // loses mPressureTolDivergence of the volume of a voxel in a step. The residual of a row is the divergence left
+    // in the voxel as a sum of face velocities, so its volume fraction lost per step is residual * dt / h, and the
+    // root mean square of the N rows is |r| / sqrt(N)
+    SolverTolerance Solver::getPressureTolerance(int N)
+    {
+        float absolute = mPressureTolDivergence * mVoxelSize / mDt * sqrt((double)N);
+        return SolverTolerance(mPressureTolRelative, absolute, (int)mPressureMaxIterations);
+    }
 
-        // everything is ready...
+    // Max |div u| of the fluid voxels of mGVel, as a sum of the face velocities like computeDivergence;
+    // the slabs of constant i are reduced in parallel, each task with its own accessors
+    LReal Solver::getMaxDivergence()
+    {
+        return tbb::parallel_reduce(tbb::blocked_range<int64_t>(mMinN.x(), mMaxN.x()), (LReal)0.0,
+            [&](const tbb::blocked_range<int64_t> &range, LReal maxDivergence) -> LReal
+            {
+                TypeVoxelGrid::ConstAccessor typeAccessor = mGTypeVoxel->getConstAccessor();
+                ScalarGrid::ConstAccessor uAccessor = mGVel->getFace(0)->getConstAccessor();
+                ScalarGrid::ConstAccessor vAccessor = mGVel->getFace(1)->getConstAccessor();
+                ScalarGrid::ConstAccessor wAccessor = mGVel->getFace(2)->getConstAccessor();
+                for(int64_t i = range.begin(); i != range.end(); ++i)
+                    for(int64_t j = mMinN.y(); j < mMaxN.y(); ++j)
+                        for(int64_t k = mMinN.z(); k < mMaxN.z(); ++k)
+                        {
+                            if ( typeAccessor.getValue(i, j, k) == VoxelType::FLUID )
+                            {
+                                LReal divergence = uAccessor.getValue(i+1, j, k) - uAccessor.getValue(i, j, k)
+                                        + vAccessor.getValue(i, j+1, k) - vAccessor.getValue(i, j, k)
+                                        + wAccessor.getValue(i, j, k+1) - wAccessor.getValue(i, j, k);
+                                maxDivergence = std::max(maxDivergence, std::fabs(divergence));
+                            }
+                        }
+                return maxDivergence;
+            },
+            [](LReal max1, LReal max2) -> LReal { return std::max(max1, max2); });
+    }
 
-        // execute cuda solver
-        spareSolverConjugateGradient(I, J, val, M, N, nz, x, rhs);
+    // Run the selected pressure solver on the float system A*x = rhs of mSolverContext,
+    // the result of the solve is added to stats (times accumulate over the solves of a mixed precision step)
+    void Solver::runPressureSolver(float *x, float *rhs, const SolverTolerance &tolerance, SolverStats &stats)
+    {
+        const LaplacianOperator &laplacian = mSolverContext->mLaplacian;
 
-        // populate mGP: pressure grid
-        mGP->clear();
-        idxMat = 0;
-        for(int64_t i = mMinN.x(); i < mMaxN.x(); ++i)
-            for(int64_t j = mMinN.y(); j < mMaxN.y(); ++j)
-                for(int64_t k = mMinN.z(); k < mMaxN.z(); ++k)
-                {
-                    if ( mGTypeVoxel->getValue(i, j, k) == VoxelType::FLUID )
-                    {
-                        mGP->setValue(x[idxMat], i, j, k);
-                    }
-                    idxMat++;
-                }
+        if (mPressureSolver == "cpu")
+        {
+            if (mPressureComponents)
+            {
+                // a solve for each connected component, on its own system: always matrix-free. The systems and the
+                // preconditioners of the components are kept in mSolverContext until the components change
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                const FluidComponents &components = mSolverContext->getComponents();
+                stats.mSetupTime += getElapsedSeconds(start);
+                int numSolved = solveComponentsCPU(laplacian, components, x, rhs,
+                    [this](const LaplacianOperator &A) -> Preconditioner * { return createPreconditioner(A); },
+                    tolerance, mPressureCG == "single_reduction", mPressureVerify, &stats, &mSolverContext->mComponentSystems);
+                L_LOG_DEBUG("Pressure components: " + to_string(components.size()) + ", solved " + to_string(numSolved));
+                return;
+            }
+
+            // matrix-free by default, the preconditioners always use the neighbour masks of the laplacian
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            const LinearOperator &A = mSolverContext->getOperator(mPressureOperator);
+            Preconditioner *precond = updatePreconditioner();
+            stats.mSetupTime += getElapsedSeconds(start);
+            spareSolverConjugateGradientCPU(A, x, rhs, precond, &stats, &mSolverContext->mWorkspace, mPressureCG == "single_reduction", mPressureVerify, tolerance);
+        }
+        else if ( (mPressureSolver == "sor") || (mPressureSolver == "jacobi") )
+        {
+            // relaxation on the neighbour masks, no CSR matrix: approximate pressure for previews
+            RelaxationMethod method = (mPressureSolver == "sor") ? RELAXATION_SOR : RELAXATION_JACOBI;
+            LReal omega = mPressureRelaxationOmega;
+            if (omega <= 0.0)
+            {
+                omega = (method == RELAXATION_SOR) ? RELAXATION_SOR_OMEGA : RELAXATION_JACOBI_OMEGA;
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            RelaxationSolver *relaxation = mSolverContext->getRelaxationSolver(method, omega);
+            stats.mSetupTime += getElapsedSeconds(start);
+            start = std::chrono::steady_clock::now();
+            float finalResidual;
+            relaxation->solve(x, rhs, mPressureRelaxationTol, (int)mPressureRelaxationSweeps, finalResidual, &stats);
+            stats.mSolveTime += getElapsedSeconds(start);
+            stats.mSolver = mPressureSolver;
+        }
+#ifdef YAPFS_CUDA
+        else
+        {
+            // assemble the matrix in CSR format from the neighbour masks, only when the topology changed:
+            // the matrix of the previous step is still on the device otherwise
+            int N = laplacian.size();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            bool uploadMatrix = !mSolverContext->mCSRValid;
+            int nz = uploadMatrix ? mSolverContext->assembleCSR() : (int)mSolverContext->mJ.size();
+            stats.mSetupTime += getElapsedSeconds(start);
+
+            spareSolverConjugateGradient(mSolverContext->getCudaContext(), mSolverContext->mI.data(), mSolverContext->mJ.data(), mSolverContext->mVal.data(), N, N, nz, x, rhs, uploadMatrix,
+                                         &stats, mPressureVerify, tolerance);
+        }
+#endif
+    }
 
-        // free memory
-        free(I);
-        free(J);
-        free(val);
-        free(x);
-        free(rhs);
+    // Mixed precision: float solves of the selected solver inside a double precision iterative refinement,
+    // stats gets the double residuals and the float iterations and times summed over the refinements
+    void Solver::solvePressureMixed(SolverStats &stats)
+    {
+        const LaplacianOperator &laplacian = mSolverContext->mLaplacian;
+        int N = laplacian.size();
+        double *xDouble = mSolverContext->mXDouble.data();
+        double *rhsDouble = mSolverContext->mRhsDouble.data();
+        double *residualDouble = mSolverContext->mResidualDouble.data();
+
+        double rhsNorm = sqrt(cpuDot(rhsDouble, rhsDouble, N));
+        double initialResidual = cpuResidual(laplacian, xDouble, rhsDouble, residualDouble);
+        // the float solves stop at the relative tolerance only, the refinement gives the final accuracy
+        SolverTolerance floatTolerance(mPressureTolRelative, 0.0f, (int)mPressureMaxIterations);
+        int iterations;
+        double residual;
+        int refinements = iterativeRefinementCPU(laplacian,
+            [&](float *d, float *r) -> int
+            {
+                SolverStats floatStats;
+                runPressureSolver(d, r, floatTolerance, floatStats);
+                stats.mSetupTime += floatStats.mSetupTime;
+                stats.mSolveTime += floatStats.mSolveTime;
+                return floatStats.mIterations;
+            },
+            xDouble, rhsDouble, mPressureRefinementTol, PRESSURE_MAX_REFINEMENTS,
+            mSolverContext->mX.data(), mSolverContext->mRhs.data(), residualDouble, iterations, residual);
+
+        stats.mSolver = "mixed";
+        stats.mN = N;
+        stats.mIterations = iterations;
+        stats.mInitialResidual = initialResidual;
+        stats.mFinalResidual = residual;
+        stats.mStopReason = (residual <= mPressureRefinementTol * rhsNorm) ? SOLVER_CONVERGED : SOLVER_MAX_ITERATIONS;
+
+        std::ostringstream message;
+        message << "Pressure mixed precision: " << refinements << " refinements (|rhs| " << std::scientific << rhsNorm << ")";
+        L_LOG_INFO(message.str());
+    }
 
-        addGradient();
+    // Log the stats of the pressure solve of this step and add them to the metrics file
+    void Solver::reportPressureStats(const SolverStats &stats)
+    {
+        L_LOG_INFO(stats.toString());
+        if (mMetricsSink != NULL)
+        {
+            mMetricsSink->write(mIdFrame, stats);
+        }
+    }
 
+    // CG reduces the residual by the same factor at each iteration, so the iterations saved by the warm start are
+    // estimated from the rate of this solve and from the initial residual of the cold start (x = 0 that is |rhs|)
+    void Solver::logWarmStart(const LaplacianOperator &laplacian, const float *rhsResidual, const float *rhs, const SolverStats &stats)
+    {
+        int iterations = stats.mIterations;
+        double residual = stats.mFinalResidual;
+        int N = laplacian.size();
+        double warmResidual = sqrt(cpuDot(rhsResidual, rhsResidual, N));
+        double coldResidual = sqrt(cpuDot(rhs, rhs, N));
+
+        double savedIterations = 0.0;
+        if ( (iterations > 0) && (warmResidual > residual) && (coldResidual > 0.0) && (residual > 0.0) )
+        {
+            savedIterations = iterations * log(coldResidual / warmResidual) / log(warmResidual / residual);
+        }
+
+        L_LOG_INFO("Pressure warm start: initial residual " + to_string(warmResidual) + " (cold start " + to_string(coldResidual) + "), iterations " + to_string(iterations) + ", estimated iterations saved " + to_string(savedIterations));
     }
 
     void Solver::computeDivergence()
@@ -708,86 +975,79 @@ namespace yapfs
 
         // Divergence calculated without OpenVDB and applying formula
         mGDivergence->clear();
-        for(int64_t i = mMinN.x(); i < mMaxN.x(); ++i)
-            for(int64_t j = mMinN.y(); j < mMaxN.y(); ++j)
-                for(int64_t k = mMinN.z(); k < mMaxN.z(); ++k)
-                {
-                    if ( mGTypeVoxel->getValue(i, j, k) == VoxelType::FLUID )
-                    {
-                        Vec3d velV = mGVel->getValue(i, j, k);
-                        Vec3d velX = mGVel->getValue(i+1, j, k);
-                        Vec3d velY = mGVel->getValue(i, j+1, k);
-                        Vec3d velZ = mGVel->getValue(i, j, k+1);
-
-                        LReal result = velX.x() - velV.x() + velY.y() - velV.y() + velZ.z() - velV.z();
-
-                        mGDivergence->setValue(result , i, j, k);
-                    }
-                }
+        mGDivergence->forEachBlock(mMinN, mMaxN,
+            [&](ScalarGrid::Block &block)
+            {
+                TypeVoxelGrid::ConstAccessor typeAccessor = mGTypeVoxel->getConstAccessor();
+                ScalarGrid::ConstAccessor uAccessor = mGVel->getFace(0)->getConstAccessor();
+                ScalarGrid::ConstAccessor vAccessor = mGVel->getFace(1)->getConstAccessor();
+                ScalarGrid::ConstAccessor wAccessor = mGVel->getFace(2)->getConstAccessor();
+                for(int64_t i = block.getBegin().x(); i < block.getEnd().x(); ++i)
+                    for(int64_t j = block.getBegin().y(); j < block.getEnd().y(); ++j)
+                        for(int64_t k = block.getBegin().z(); k < block.getEnd().z(); ++k)
+                        {
+                            if ( typeAccessor.getValue(i, j, k) == VoxelType::FLUID )
+                            {
+                                LReal result = uAccessor.getValue(i+1, j, k) - uAccessor.getValue(i, j, k)
+                                        + vAccessor.getValue(i, j+1, k) - vAccessor.getValue(i, j, k)
+                                        + wAccessor.getValue(i, j, k+1) - wAccessor.getValue(i, j, k);
+
+                                block.setValue(result , i, j, k);
+                            }
+                        }
+            });
 
     }
 
     void Solver::addGradient()
     {
         //L_LOG_DEBUG("Solver::addGradient");
-        for(int64_t i = mMinN.x()+1; i < mMaxN.x()+1; ++i)
-            for(int64_t j = mMinN.y()+1; j < mMaxN.y()+1; ++j)
-                for(int64_t k = mMinN.z()+1; k < mMaxN.z()+1; ++k)
+        // each face grid gets the pressure difference of the two voxels sharing its faces
+        for(int compIdx = 0; compIdx < 3; ++compIdx)
+        {
+            Vec3i offset(compIdx == 0, compIdx == 1, compIdx == 2);
+            mGVel->getFace(compIdx)->forEachBlock(mMinN + Vec3i(1, 1, 1), mMaxN + Vec3i(1, 1, 1),
+                [&](ScalarGrid::Block &block)
                 {
-
-                    Vec3d vel = mGVel->getValue(i, j, k);
-
-                    LReal xResult = vel.x();
-                    LReal yResult = vel.y();
-                    LReal zResult = vel.z();
-
-                    // TODO: change completely all those conditions, improving performance and algorithm
-
-                    if ( ((mGTypeVoxel->getValue(i-1, j, k) == VoxelType::AIR) && (mGTypeVoxel->getValue(i, j, k) == VoxelType::FLUID)) 
-                        || ((mGTypeVoxel->getValue(i-1, j, k) == VoxelType::FLUID) && (mGTypeVoxel->getValue(i, j, k) == VoxelType::AIR))
-                        || ((mGTypeVoxel->getValue(i-1, j, k) == VoxelType::FLUID) && (mGTypeVoxel->getValue(i, j, k) == VoxelType::FLUID)) )
-                    {
-                        xResult += mGP->getValue(i, j, k) - mGP->getValue(i-1, j, k);
-                        //L_LOG_DEBUG("Gradient X : " + to_string( mGP->getValue(i, j, k) - mGP->getValue(i-1, j, k) ) + " --> " + to_string(xResult));
-                    }
-
-                    if ( ((mGTypeVoxel->getValue(i, j-1, k) == VoxelType::AIR) && (mGTypeVoxel->getValue(i, j, k) == VoxelType::FLUID)) 
-                        || ((mGTypeVoxel->getValue(i, j-1, k) == VoxelType::FLUID) && (mGTypeVoxel->getValue(i, j, k) == VoxelType::AIR)) 
-                        || ((mGTypeVoxel->getValue(i, j-1, k) == VoxelType::FLUID) && (mGTypeVoxel->getValue(i, j, k) == VoxelType::FLUID)) )
-                    {
-                        yResult += mGP->getValue(i, j, k) - mGP->getValue(i, j-1, k);
-                    }
-
-                    if ( ((mGTypeVoxel->getValue(i, j, k-1) == VoxelType::AIR) || (mGTypeVoxel->getValue(i, j, k) == VoxelType::FLUID)) 
-                        || ((mGTypeVoxel->getValue(i, j, k-1) == VoxelType::FLUID) || (mGTypeVoxel->getValue(i, j, k) == VoxelType::AIR)) 
-                        || ((mGTypeVoxel->getValue(i, j, k-1) == VoxelType::FLUID) || (mGTypeVoxel->getValue(i, j, k) == VoxelType::FLUID)) )
-                    {
-                        zResult += mGP->getValue(i, j, k) - mGP->getValue(i, j, k-1);
-                    }
-
-                    Vec3d result(xResult, yResult, zResult);
-                    mGVel->setValue(result , i, j, k);
-
-                }
+                    TypeVoxelGrid::ConstAccessor typeAccessor = mGTypeVoxel->getConstAccessor();
+                    ScalarGrid::ConstAccessor pressureAccessor = mGP->getConstAccessor();
+                    for(int64_t i = block.getBegin().x(); i < block.getEnd().x(); ++i)
+                        for(int64_t j = block.getBegin().y(); j < block.getEnd().y(); ++j)
+                            for(int64_t k = block.getBegin().z(); k < block.getEnd().z(); ++k)
+                            {
+                                // TODO: change completely all those conditions, improving performance and algorithm
+
+                                int64_t iPrev = i - offset.x();
+                                int64_t jPrev = j - offset.y();
+                                int64_t kPrev = k - offset.z();
+
+                                if ( isGradientFace(typeAccessor.getValue(iPrev, jPrev, kPrev), typeAccessor.getValue(i, j, k)) )
+                                {
+                                    LReal result = block.getValue(i, j, k) + pressureAccessor.getValue(i, j, k) - pressureAccessor.getValue(iPrev, jPrev, kPrev);
+                                    block.setValue(result , i, j, k);
+                                }
+                            }
+                });
+        }
     }
 
     void Solver::saveVelocitiesUpdate()
     {
         //L_LOG_DEBUG("Solver::saveVelocitiesUpdate start");
-        for(int64_t i = mMinN.x(); i < mMaxN.x()+1; ++i)
-            for(int64_t j = mMinN.y(); j < mMaxN.y()+1; ++j)
-                for(int64_t k = mMinN.z(); k < mMaxN.z()+1; ++k)
+        for(int compIdx = 0; compIdx < 3; ++compIdx)
+        {
+            mGVelSave->getFace(compIdx)->forEachBlock(mMinN, mMaxN + Vec3i(1, 1, 1),
+                [&](ScalarGrid::Block &block)
                 {
-                    Vec3d vel = mGVel->getValue(i, j, k);
-                    Vec3d velSave = mGVelSave->getValue(i, j, k);
-
-                    LReal xResult = vel.x() - velSave.x();
-                    LReal yResult = vel.y() - velSave.y();
-                    LReal zResult = vel.z() - velSave.z();
-
-                    Vec3d result(xResult, yResult, zResult);
-                    mGVelSave->setValue(result , i, j, k);
-                }
+                    ScalarGrid::ConstAccessor velAccessor = mGVel->getFace(compIdx)->getConstAccessor();
+                    for(int64_t i = block.getBegin().x(); i < block.getEnd().x(); ++i)
+                        for(int64_t j = block.getBegin().y(); j < block.getEnd().y(); ++j)
+                            for(int64_t k = block.getBegin().z(); k < block.getEnd().z(); ++k)
+                            {
+                                block.setValue(velAccessor.getValue(i, j, k) - block.getValue(i, j, k), i, j, k);
+                            }
+                });
+        }
 
     }
 
@@ -795,19 +1055,19 @@ namespace yapfs
     {
         for(int64_t i = 0; i < (mParticles->mPosition).size(); ++i)
         {
-            Vec3d particlePosition = (mParticles->mPosition)[i];
+            Vec3d particlePosition((mParticles->mPosition)[i]);
 
             Vec3d indexSpacePoint = mGVel->getWorldToIndex(particlePosition); // particle grid index space point
 
             // Trilinear interpolation
-            Vec3d gUpdate = tools::BoxSampler::sample(mGVelSave->mGrid->tree(), indexSpacePoint); //TODO see Solver::moveParticlesInGrid: or use StaggeredBoxSampler? Dont think so!! or PointSampler or QuadraticSampler
-            Vec3d gVel = tools::BoxSampler::sample(mGVel->mGrid->tree(), indexSpacePoint);
+            Vec3d gUpdate = mGVelSave->sample(indexSpacePoint); //TODO see Solver::moveParticlesInGrid: or use StaggeredBoxSampler? Dont think so!! or PointSampler or QuadraticSampler
+            Vec3d gVel = mGVel->sample(indexSpacePoint);
 
             // FLIP
             //mParticles->mVelocity[i] = mParticles->mVelocity[i] + gUpdate;
 
             // PIC
-            mParticles->mVelocity[i] = gVel;
+            mParticles->mVelocity[i] = SolverParticles::Vec3Type(gVel);
 
             // TODO make velocity part of FLIP and part of PIC with weights
 
@@ -53,8 +53,22 @@
 #include "config.h"
 #include "utils.h"
 #include "grid.h"
+#include "dense_grid.h"
+#include "mac_grid.h"
 #include "particles.h"
 #include "sparse_solver.h"
+#include "sparse_solver_cpu.h"
+#include "laplacian.h"
+#include "mic_preconditioner.h"
+#include "multigrid.h"
+#include "dct_preconditioner.h"
+#include "amg_preconditioner.h"
+#include "relaxation_solver.h"
+#include "solver_context.h"
+#include "solver_stats.h"
+
+// Maximum number of iterative refinements of the mixed precision pressure solve
+#define PRESSURE_MAX_REFINEMENTS 8
 
 using namespace openvdb;
 using namespace std;
@@ -77,18 +91,30 @@ namespace yapfs
 
     enum VoxelType { NDF=0, FLUID=1, SOLID=2, AIR=3 };
 
-    struct AbsMax
+    // The pressure gradient is added to the faces between two fluid voxels and between a fluid and an air voxel,
+    // prevType is the type of the voxel on the lower side of the face
+    inline bool isGradientFace(int32_t prevType, int32_t type)
     {
-        Vec3d *mAbsMax;
-        AbsMax(Vec3d *_absMax): mAbsMax(_absMax) {}
-        template<typename TreeIterT> void operator()(const TreeIterT& it) const
-        {
-            Vec3d v(*it);
-            if (std::fabs(v.x()) > mAbsMax->x()) mAbsMax->init(std::fabs(v.x()), mAbsMax->y(), mAbsMax->z() );
-            if (std::fabs(v.y()) > mAbsMax->y()) mAbsMax->init(mAbsMax->x(), std::fabs(v.y()), mAbsMax->z() );
-            if (std::fabs(v.z()) > mAbsMax->z()) mAbsMax->init(mAbsMax->x(), mAbsMax->y(), std::fabs(v.z()) );
-        }
-    };
+        return ((prevType == VoxelType::AIR) && (type == VoxelType::FLUID))
+            || ((prevType == VoxelType::FLUID) && (type == VoxelType::AIR))
+            || ((prevType == VoxelType::FLUID) && (type == VoxelType::FLUID));
+    }
+
+    // Storage of the grids of the solver: OpenVDB trees, or with -DUSE_DENSE_GRIDS=ON arrays over the box of
+    // the simulation, converted to OpenVDB grids only for the export of the frames
+#ifdef YAPFS_DENSE_GRIDS
+    typedef DenseStorage SolverStorage;
+#else
+    typedef SparseStorage SolverStorage;
+#endif
+
+    // OpenVDB grid of the scalars stored by the solver, float or double following LStoreReal
+    typedef RealGridTypes<LStoreReal>::ScalarGrid RealGrid;
+
+    typedef MACGrid<SolverStorage, LStoreReal> VelocityGrid;
+    typedef Grid<Int32Grid, SolverStorage> TypeVoxelGrid;
+    typedef Grid<RealGrid, SolverStorage> ScalarGrid;
+    typedef Particles<LStoreReal> SolverParticles;
 
     class Solver
     {
@@ -110,15 +136,35 @@ namespace yapfs
             LReal    mDt;
             uint32_t mNumFrames;
             uint32_t mIdFrame;
-
-            Grid<Vec3DGrid>    *mGVel; //Staggered MAC Grid
-            Grid<Vec3DGrid>    *mGVelSave;
-            Grid<Int32Grid>    *mGTypeVoxel;
-            Grid<DoubleGrid>   *mGDivergence;
-            Grid<DoubleGrid>   *mGP; //Pressure
+            std::string mPressureSolver; // cuda, cpu, sor or jacobi (relaxation solvers for previews)
+            std::string mPressurePreconditioner; // jacobi, mic, mic_serial, multigrid, dct or amg
+            bool     mPressureWarmStart; // start the pressure solve from the pressure of the previous step
+            LReal    mPressureDt; // dt of the step that computed mGP, 0.0 if mGP is not valid
+            LReal    mPressureRefactorThreshold; // fraction of changed rows over which the preconditioner is rebuilt
+            std::string mPressurePrecision; // float or mixed (float solver with double iterative refinement)
+            LReal    mPressureRelaxationOmega; // relaxation factor of the sor and jacobi solvers, 0 for the default of the method
+            uint32_t mPressureRelaxationSweeps; // sweeps of the sor and jacobi solvers
+            LReal    mPressureRelaxationTol; // sor and jacobi stop earlier at this residual, 0 for a fixed number of sweeps
+            std::string mPressureCG; // conjugate gradient of the cpu solver: standard or single_reduction
+            std::string mPressureOperator; // matrix of the cpu solver: matrix_free, csr, symmetric_csr or sell
+            std::string mPressureOrdering; // numbering of the fluid voxels: lexicographic, morton or rcm
+            bool     mPressureComponents; // cpu: a solve for each connected component of the fluid
+            LReal    mPressureRefinementTol; // mixed precision: stop when |b - A*x| <= tol * |b|
+            bool     mPressureVerify; // compute max |A*x - b| and the divergence after each solve, a full extra SpMV and grid pass
+            LReal    mPressureTolRelative; // cpu and cuda: stop when |b - A*x| <= tol * |b|
+            LReal    mPressureTolDivergence; // or when the voxels lose this fraction of volume per step, skip the solve if already so
+            uint32_t mPressureMaxIterations; // cpu and cuda
+            SolverMetricsSink *mMetricsSink; // CSV of the stats of every pressure solve, NULL if not configured
+            SolverContext *mSolverContext; // pressure system and solver buffers reused between steps
+
+            VelocityGrid       *mGVel; //Staggered MAC Grid, a scalar grid for each component
+            VelocityGrid       *mGVelSave;
+            TypeVoxelGrid      *mGTypeVoxel;
+            ScalarGrid         *mGDivergence;
+            ScalarGrid         *mGP; //Pressure
 
             // TODO: using DNeg OpenVDBPoints
-            Particles          *mParticles;
+            SolverParticles    *mParticles;
 
             Solver();
 
@@ -129,7 +175,9 @@ namespace yapfs
             void execute();
             void exportFrame();
 
-            Vec3d getAbsMax(Grid<Vec3DGrid> *grid);
+            Vec3d getAbsMax(VelocityGrid *grid);
+            LReal getAbsMax(Grid<RealGrid> *grid);
+            LReal getAbsMax(Grid<RealGrid, DenseStorage> *grid);
             LReal getCFL();
 
             inline void clampToGrid(Vec3d &vect);
@@ -143,7 +191,16 @@ namespace yapfs
             void identifyTypeVoxels();
             void velocityExtrapolation();
             void boundaryConditions();
+            void fillVoxelFlags(vector<uint8_t> &flags);
+            Preconditioner *createPreconditioner(const LaplacianOperator &laplacian);
+            Preconditioner *updatePreconditioner();
             void solvePressure();
+            SolverTolerance getPressureTolerance(int N);
+            LReal getMaxDivergence();
+            void runPressureSolver(float *x, float *rhs, const SolverTolerance &tolerance, SolverStats &stats);
+            void solvePressureMixed(SolverStats &stats);
+            void reportPressureStats(const SolverStats &stats);
+            void logWarmStart(const LaplacianOperator &laplacian, const float *rhsResidual, const float *rhs, const SolverStats &stats);
             void computeDivergence();
             void addGradient();
             void saveVelocitiesUpdate();
@@ -151,8 +208,8 @@ namespace yapfs
 
 
             // TODO: remove and change: it is used only for the temporary OpenGL viewer debugger
-            vector< vector<Vec3d> > frameParticleP; // particles position
-            vector< vector<Vec3d> > frameParticleV; // particles velocity
+            vector< vector<SolverParticles::Vec3Type> > frameParticleP; // particles position
+            vector< vector<SolverParticles::Vec3Type> > frameParticleV; // particles velocity
             vector< Grid<Vec3DGrid> > frameGridV; // grids velocities
             vector< Grid<Int32Grid> > frameGridT; // grids type voxels
 
@@ -0,0 +1,265 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#include "solver_context.h"
+
+namespace yapfs
+{
+
+    SolverContext::SolverContext() : mLaplacian(0, 0, 0), mCSR(NULL, NULL, NULL, 0, 0)
+    {
+        mCSRValid = false;
+        mSymmetricCSRValid = false;
+        mSellCSValid = false;
+        mComponentsValid = false;
+        mRelaxationSolver = NULL;
+        mPreconditioner = NULL;
+        mNumUpdatedRows = 0;
+        mTopologyChanged = true;
+#ifdef YAPFS_CUDA
+        mCudaContext = NULL;
+#endif
+    }
+
+    SolverContext::~SolverContext()
+    {
+        delete mRelaxationSolver;
+        delete mPreconditioner;
+#ifdef YAPFS_CUDA
+        if (mCudaContext != NULL)
+        {
+            destroyCudaSolverContext(mCudaContext);
+        }
+#endif
+    }
+
+    void SolverContext::reset(int64_t numX, int64_t numY, int64_t numZ)
+    {
+        if ( (numX == mLaplacian.mNumX) && (numY == mLaplacian.mNumY) && (numZ == mLaplacian.mNumZ) )
+        {
+            mPrevVoxelOfRow = mLaplacian.mVoxelOfRow;
+            mPrevMask = mLaplacian.mMask;
+        }
+        else
+        {
+            // the voxel indexes of a different box can't be compared
+            mPrevVoxelOfRow.clear();
+            mPrevMask.clear();
+            mPrecondVoxelOfRow.clear();
+            mPrecondMask.clear();
+            delete mPreconditioner;
+            mPreconditioner = NULL;
+            mNumUpdatedRows = 0;
+        }
+        mLaplacian.reset(numX, numY, numZ);
+    }
+
+    void SolverContext::compareTopology()
+    {
+        if ( (mPrevVoxelOfRow != mLaplacian.mVoxelOfRow) || (mPrevMask != mLaplacian.mMask) )
+        {
+            mCSRValid = false;
+            mSymmetricCSRValid = false;
+            mSellCSValid = false;
+            mComponentsValid = false;
+            mComponentSystems.clear();
+            delete mRelaxationSolver;
+            mRelaxationSolver = NULL;
+        }
+
+        int N = mLaplacian.size();
+        int prevN = (int)mPrecondVoxelOfRow.size();
+
+        mOldRowOfRow.assign(N, -1);
+        for (int oldRow = 0; oldRow < prevN; oldRow++)
+        {
+            int row = mLaplacian.mRowOfVoxel[mPrecondVoxelOfRow[oldRow]];
+            if (row >= 0)
+            {
+                mOldRowOfRow[row] = oldRow;
+            }
+        }
+
+        // removed voxels change the masks of their fluid neighbours, so they are found here too
+        bool renumbered = (N != prevN);
+        mChangedRows.clear();
+        for (int row = 0; row < N; row++)
+        {
+            int oldRow = mOldRowOfRow[row];
+            if ( (oldRow < 0) || (mPrecondMask[oldRow] != mLaplacian.mMask[row]) )
+            {
+                mChangedRows.push_back(row);
+            }
+            renumbered |= (oldRow != row);
+        }
+
+        mTopologyChanged = renumbered || !mChangedRows.empty();
+    }
+
+    void SolverContext::consumeTopology()
+    {
+        int N = mLaplacian.size();
+        mPrecondVoxelOfRow = mLaplacian.mVoxelOfRow;
+        mPrecondMask = mLaplacian.mMask;
+        mOldRowOfRow.resize(N);
+        for (int row = 0; row < N; row++)
+        {
+            mOldRowOfRow[row] = row;
+        }
+        mChangedRows.clear();
+        mTopologyChanged = false;
+    }
+
+    void SolverContext::setPreconditioner(Preconditioner *precond)
+    {
+        delete mPreconditioner;
+        mPreconditioner = precond;
+        mNumUpdatedRows = 0;
+        consumeTopology();
+    }
+
+    Preconditioner *SolverContext::getPreconditioner(PreconditionerFactory createPreconditioner, LReal refactorThreshold)
+    {
+        int numChanged = (int)mChangedRows.size();
+
+        if ( (mPreconditioner != NULL) && !mTopologyChanged )
+        {
+            return mPreconditioner;
+        }
+
+        if ( (mPreconditioner != NULL) && (mNumUpdatedRows + numChanged <= refactorThreshold * mLaplacian.size()) &&
+             mPreconditioner->update(mOldRowOfRow, mChangedRows) )
+        {
+            mNumUpdatedRows += numChanged;
+            consumeTopology();
+            L_LOG_DEBUG("Pressure preconditioner: updated " + to_string(numChanged) + " changed rows");
+        }
+        else
+        {
+            L_LOG_DEBUG("Pressure preconditioner: built, " + to_string(numChanged) + " changed rows");
+            setPreconditioner(createPreconditioner(mLaplacian));
+        }
+        return mPreconditioner;
+    }
+
+    void SolverContext::resize(int N)
+    {
+        mX.resize(N);
+        mRhs.resize(N);
+        mWorkspace.resize(N);
+    }
+
+    void SolverContext::resizeDouble(int N)
+    {
+        mXDouble.resize(N);
+        mRhsDouble.resize(N);
+        mResidualDouble.resize(N);
+    }
+
+    RelaxationSolver *SolverContext::getRelaxationSolver(RelaxationMethod method, float omega)
+    {
+        if ( (mRelaxationSolver == NULL) || (mRelaxationSolver->mMethod != method) )
+        {
+            delete mRelaxationSolver;
+            mRelaxationSolver = new RelaxationSolver(mLaplacian, method, omega);
+        }
+        mRelaxationSolver->mOmega = omega;
+        return mRelaxationSolver;
+    }
+
+    int SolverContext::assembleCSR()
+    {
+        int nz = mLaplacian.getNumNonZero();
+        mI.resize(mLaplacian.size() + 1);
+        mJ.resize(nz);
+        mVal.resize(nz);
+        mLaplacian.toCSR(mI.data(), mJ.data(), mVal.data());
+        mCSR = CSRMatrix(mI.data(), mJ.data(), mVal.data(), mLaplacian.size(), nz);
+        mCSRValid = true;
+        return nz;
+    }
+
+    const LinearOperator &SolverContext::getOperator(const std::string &type)
+    {
+        if (type == "csr")
+        {
+            if (!mCSRValid)
+            {
+                assembleCSR();
+            }
+            return mCSR;
+        }
+        else if (type == "symmetric_csr")
+        {
+            if (!mSymmetricCSRValid)
+            {
+                mLaplacian.toSymmetricCSR(mSymmetricCSR);
+                mSymmetricCSRValid = true;
+            }
+            return mSymmetricCSR;
+        }
+        else if (type == "sell")
+        {
+            if (!mSellCSValid)
+            {
+                if (!mCSRValid)
+                {
+                    assembleCSR();
+                }
+                mSellCS.assemble(mCSR);
+                mSellCSValid = true;
+            }
+            return mSellCS;
+        }
+        return mLaplacian;
+    }
+
+    const FluidComponents &SolverContext::getComponents()
+    {
+        if (!mComponentsValid)
+        {
+            mComponentSystems.clear();
+            mComponents.build(mLaplacian);
+            mComponentsValid = true;
+        }
+        return mComponents;
+    }
+
+#ifdef YAPFS_CUDA
+    CudaSolverContext *SolverContext::getCudaContext()
+    {
+        if (mCudaContext == NULL)
+        {
+            mCudaContext = createCudaSolverContext();
+        }
+        return mCudaContext;
+    }
+#endif
+
+}
@@ -0,0 +1,157 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef SOLVER_CONTEXT_H_
+#define SOLVER_CONTEXT_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "sparse_solver.h"
+#include "sparse_solver_cpu.h"
+#include "laplacian.h"
+#include "relaxation_solver.h"
+#include "component_solver.h"
+
+using namespace std;
+
+namespace yapfs
+{
+
+    // Buffers of the pressure solve that persist between the steps of a Solver:
+    // the memory grows with the fluid volume and it is reused by the next steps,
+    // the CUDA handles and the device buffers are created only once
+    class SolverContext
+    {
+
+        public:
+
+            LaplacianOperator mLaplacian;
+            vector<uint8_t>   mVoxelFlags; // VoxelFlag of each voxel of the box, mLaplacian is built from them
+            vector<float>     mX; // x vector
+            vector<float>     mRhs; // b vector
+            vector<float>     mRhsResidual; // b - A*x0 for the warm start
+
+            // double precision x, b and b - A*x of the mixed precision solve
+            vector<double>    mXDouble;
+            vector<double>    mRhsDouble;
+            vector<double>    mResidualDouble;
+
+            // CSR matrix for the cuda solver and for the csr operator of the cpu solver
+            vector<int>       mI;
+            vector<int>       mJ;
+            vector<float>     mVal;
+            CSRMatrix         mCSR; // wraps mI, mJ and mVal
+
+            bool              mCSRValid; // mI, mJ and mVal are assembled from the current mLaplacian
+
+            // upper triangle of the matrix for the symmetric_csr operator of the cpu solver
+            SymmetricCSRMatrix mSymmetricCSR;
+            bool              mSymmetricCSRValid;
+
+            // SELL-C-sigma matrix for the sell operator of the cpu solver
+            SellCSMatrix      mSellCS;
+            bool              mSellCSValid;
+
+            CGWorkspace       mWorkspace;
+
+            // connected components of mLaplacian for the solves by component
+            FluidComponents   mComponents;
+            bool              mComponentsValid;
+            ComponentSystems  mComponentSystems; // systems and preconditioners of mComponents, reused until they change
+
+            RelaxationSolver *mRelaxationSolver; // sor or jacobi pressure solver of mLaplacian, NULL if not built
+
+            Preconditioner   *mPreconditioner; // preconditioner of mLaplacian, NULL if not built
+            int               mNumUpdatedRows; // rows updated in mPreconditioner since it was built
+
+            // topology of the previous system, compared with the current one by compareTopology()
+            vector<int64_t>   mPrevVoxelOfRow;
+            vector<NeighbourMask> mPrevMask;
+
+            // topology mPreconditioner was built or last updated on, recorded by consumeTopology(): a step
+            // whose solve is skipped doesn't apply its change, so the next steps are compared with this one
+            vector<int64_t>   mPrecondVoxelOfRow;
+            vector<NeighbourMask> mPrecondMask;
+            vector<int>       mOldRowOfRow; // row -> row of the same voxel in mPrecondVoxelOfRow, -1 for new voxels
+            vector<int>       mChangedRows; // rows that are new or whose neighbour mask changed since mPrecondMask
+            bool              mTopologyChanged; // false if rows and masks are the same of mPrecondVoxelOfRow and mPrecondMask
+
+            SolverContext();
+            ~SolverContext();
+
+            // set the box of the system and resize the vectors when the number of unknowns is known
+            void reset(int64_t numX, int64_t numY, int64_t numZ);
+            void resize(int N);
+            void resizeDouble(int N);
+
+            // compare the rows and the masks of mLaplacian with the previous system, to invalidate the matrices
+            // and the components, and with the topology of mPreconditioner, to update it
+            void compareTopology();
+
+            // the change found by compareTopology() is applied to mPreconditioner: the current topology is
+            // recorded as its own, no changed rows and the identity as mOldRowOfRow until the next
+            // compareTopology(), so the change is applied only once
+            void consumeTopology();
+
+            // replace mPreconditioner, built for the current mLaplacian, and record its topology
+            void setPreconditioner(Preconditioner *precond);
+
+            // mPreconditioner for the current mLaplacian: reused when the topology is unchanged, updated on the
+            // changed rows while the rows updated since its build are at most refactorThreshold of the rows,
+            // built again by createPreconditioner otherwise. Can be called any number of times in a step
+            Preconditioner *getPreconditioner(PreconditionerFactory createPreconditioner, LReal refactorThreshold);
+
+            // relaxation solver of mLaplacian, built again only when the topology changed
+            RelaxationSolver *getRelaxationSolver(RelaxationMethod method, float omega);
+
+            // assemble mI, mJ and mVal from mLaplacian, returns the number of non zero
+            int assembleCSR();
+
+            // operator of the cpu conjugate gradient: matrix_free (mLaplacian), csr, symmetric_csr or sell,
+            // the matrices are assembled only when the topology changed
+            const LinearOperator &getOperator(const std::string &type);
+
+            // components of mLaplacian, labeled again only when the topology changed
+            const FluidComponents &getComponents();
+
+#ifdef YAPFS_CUDA
+            CudaSolverContext *getCudaContext();
+
+        private:
+
+            CudaSolverContext *mCudaContext;
+#endif
+
+    };
+
+}
+
+#endif /* SOLVER_CONTEXT_H_ */
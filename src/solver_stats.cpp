@@ -0,0 +1,108 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#include "solver_stats.h"
+
+namespace yapfs
+{
+
+    const char *getStopReasonName(SolverStopReason reason)
+    {
+        switch (reason)
+        {
+            case SOLVER_CONVERGED:         return "converged";
+            case SOLVER_CONVERGED_INITIAL: return "converged_initial";
+            case SOLVER_MAX_ITERATIONS:    return "max_iterations";
+            case SOLVER_BREAKDOWN:         return "breakdown";
+        }
+        return "unknown";
+    }
+
+    void SolverStats::reset()
+    {
+        mSolver.clear();
+        mN = 0;
+        mIterations = 0;
+        mInitialResidual = 0.0;
+        mFinalResidual = 0.0;
+        mTolerance = 0.0;
+        mResidualHistory.clear();
+        mSetupTime = 0.0;
+        mSolveTime = 0.0;
+        mStopReason = SOLVER_MAX_ITERATIONS;
+        mError = -1.0f;
+        mDivergence = -1.0;
+    }
+
+    std::string SolverStats::toString() const
+    {
+        std::ostringstream message;
+        message << "Pressure " << mSolver << ": " << mN << " unknowns, " << mIterations << " iterations, "
+                << getStopReasonName(mStopReason) << ", residual " << std::scientific << mInitialResidual << " -> " << mFinalResidual << " (tol " << mTolerance << ")"
+                << std::fixed << ", setup " << 1000.0 * mSetupTime << " ms, solve " << 1000.0 * mSolveTime << " ms";
+        if (mError >= 0.0f)
+        {
+            message << ", error " << std::scientific << mError;
+        }
+        if (mDivergence >= 0.0)
+        {
+            message << ", divergence " << std::scientific << mDivergence;
+        }
+        return message.str();
+    }
+
+    SolverMetricsSink::SolverMetricsSink(const std::string &fileName)
+    {
+        mFile.open(fileName.c_str(), std::ios::out | std::ios::trunc);
+        if (!mFile.is_open())
+        {
+            L_LOG_ERROR("Unable to open the solver metrics file " + fileName);
+            return;
+        }
+        mFile << "frame,solver,unknowns,iterations,initial_residual,final_residual,tolerance,setup_ms,solve_ms,stop_reason,error,divergence,residual_history" << std::endl;
+    }
+
+    void SolverMetricsSink::write(uint32_t frame, const SolverStats &stats)
+    {
+        if (!mFile.is_open())
+        {
+            return;
+        }
+        mFile << frame << "," << stats.mSolver << "," << stats.mN << "," << stats.mIterations << ","
+              << std::scientific << stats.mInitialResidual << "," << stats.mFinalResidual << "," << stats.mTolerance << ","
+              << std::fixed << 1000.0 * stats.mSetupTime << "," << 1000.0 * stats.mSolveTime << ","
+              << getStopReasonName(stats.mStopReason) << "," << std::scientific << stats.mError << "," << stats.mDivergence << ",";
+        for (size_t idx = 0; idx < stats.mResidualHistory.size(); idx++)
+        {
+            mFile << (idx > 0 ? " " : "") << stats.mResidualHistory[idx];
+        }
+        mFile << std::endl;
+    }
+
+}
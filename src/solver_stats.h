@@ -0,0 +1,122 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef SOLVER_STATS_H_
+#define SOLVER_STATS_H_
+
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+
+#include "common.h"
+#include "log.h"
+
+using namespace std;
+
+namespace yapfs
+{
+
+    // Why a solver stopped
+    enum SolverStopReason
+    {
+        SOLVER_CONVERGED=0,         // residual under the tolerance
+        SOLVER_CONVERGED_INITIAL=1, // the initial guess was already under the tolerance
+        SOLVER_MAX_ITERATIONS=2,    // iteration (or sweep) budget exhausted
+        SOLVER_BREAKDOWN=3          // p.A.p <= 0, no more progress possible
+    };
+
+    const char *getStopReasonName(SolverStopReason reason);
+
+    // Seconds elapsed from start
+    inline double getElapsedSeconds(const std::chrono::steady_clock::time_point &start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Stopping criterion of the iterative solvers: |b - A*x| <= max(mAbsolute, mRelative * |b|) in 2-norm,
+    // or mMaxIterations. The default is the old fixed criterion, absolute 1e-5 and 10000 iterations
+    struct SolverTolerance
+    {
+        float mRelative;
+        float mAbsolute;
+        int   mMaxIterations;
+
+        SolverTolerance(float relative = 0.0f, float absolute = 1e-5f, int maxIterations = 10000)
+            : mRelative(relative), mAbsolute(absolute), mMaxIterations(maxIterations) {}
+
+        float getTolerance(double rhsNorm) const
+        {
+            return (float)std::max((double)mAbsolute, mRelative * rhsNorm);
+        }
+    };
+
+    // Result of a pressure solve, filled by the solver functions that take a SolverStats pointer
+    struct SolverStats
+    {
+        std::string      mSolver; // cpu, cuda, sor, jacobi or mixed
+        int              mN; // unknowns
+        int              mIterations;
+        double           mInitialResidual; // 2-norm of b - A*x0
+        double           mFinalResidual;
+        double           mTolerance; // absolute tolerance on the 2-norm of the residual used by the solve
+        vector<float>    mResidualHistory; // 2-norm of the residual at each iteration, initial one included
+        double           mSetupTime; // seconds to build the operator and the preconditioner
+        double           mSolveTime; // seconds of the iterations
+        SolverStopReason mStopReason;
+        float            mError; // max |A*x - b| of the verification, negative if not verified
+        double           mDivergence; // max |div u| * dt / h after the projection (volume fraction lost per step), negative if not measured
+
+        SolverStats() { reset(); }
+
+        void reset();
+        // one line summary for the log
+        std::string toString() const;
+    };
+
+    // Receives the SolverStats of every pressure solve and writes them as CSV lines, one per solve:
+    // frame, solver, unknowns, iterations, residuals, tolerance, times in ms, stop reason, error, divergence and the residual history
+    class SolverMetricsSink
+    {
+        public:
+            std::ofstream mFile;
+
+            SolverMetricsSink(const std::string &fileName);
+
+            void write(uint32_t frame, const SolverStats &stats);
+    };
+
+}
+
+#endif /* SOLVER_STATS_H_ */
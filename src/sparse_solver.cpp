@@ -28,6 +28,9 @@
  ****************************************************************************/
 
 #include "sparse_solver.h"
+#include "sparse_solver_cpu.h"
+
+#ifdef YAPFS_CUDA
 
 // Using updated (v2) interfaces to cublas
 #include <cuda_runtime.h>
@@ -37,44 +40,47 @@
 // Utilities and system includes
 #include <helper_cuda.h> 
 
+#include <algorithm>
+
 
 namespace yapfs
 {
 
-    //TODO: use CUSPARSE_MATRIX_TYPE_SYMMETRIC for better memory performance
+    //TODO: use CUSPARSE_MATRIX_TYPE_SYMMETRIC for better memory performance,
+    //      the cpu solver already stores the upper triangle only, see SymmetricCSRMatrix
 
-    // https://devblogs.nvidia.com/parallelforall/optimizing-high-performance-conjugate-gradient-benchmark-gpus/
-
-    // This implements a conjugate gradient solver on GPU using CUBLAS and CUSPARSE library.
-    // Solve Ax = b using cuda conjugate gradient cuSPARSE API
-    // A is the CSR matrix: see http://docs.nvidia.com/cuda/cusparse/#compressed-sparse-row-format-csr for CSR format
-    // b is rhs
-    // returns the numeric error
-    float spareSolverConjugateGradient(int *I, int *J, float *val, int M, int N, int nz, float *x, float *rhs)
+    struct CudaSolverContext
     {
-        // take input as a tridiagonal symmetric matrix MxN in CSR format with I, J, val and nz
-        const float tol = 1e-5f;
-        const int max_iter = 10000;
-        float a, b, na, r0, r1;
+        int devID;
+        cublasHandle_t cublasHandle;
+        cusparseHandle_t cusparseHandle;
+        cusparseMatDescr_t descr;
+
+        // device buffers and their capacity: N for the vectors, nz for the matrix
+        int capacityN;
+        int capacityNz;
         int *d_col, *d_row;
-        float *d_val, *d_x, dot;
+        float *d_val, *d_x;
         float *d_r, *d_p, *d_Ax;
-        int k;
-        float alpha, beta, alpham1;
+    };
+
+    CudaSolverContext *createCudaSolverContext()
+    {
+        CudaSolverContext *context = new CudaSolverContext();
 
         // This will pick the best possible CUDA capable device
         cudaDeviceProp deviceProp;
         int argc = 1;
         char *argv[1];
-        int devID = findCudaDevice(argc, (const char **)argv);
+        context->devID = findCudaDevice(argc, (const char **)argv);
 
-        if (devID < 0)
+        if (context->devID < 0)
         {
             printf("exiting: devID < 0\n");
             exit(-1);
         }
 
-        checkCudaErrors(cudaGetDeviceProperties(&deviceProp, devID));
+        checkCudaErrors(cudaGetDeviceProperties(&deviceProp, context->devID));
 
         // Statistics about the GPU device
         printf("> GPU device has %d Multi-Processors, SM %d.%d compute capabilities\n",
@@ -89,40 +95,146 @@ namespace yapfs
         }
 
         /* Get handle to the CUBLAS context */
-        cublasHandle_t cublasHandle = 0;
+        context->cublasHandle = 0;
         cublasStatus_t cublasStatus;
-        cublasStatus = cublasCreate(&cublasHandle);
+        cublasStatus = cublasCreate(&context->cublasHandle);
 
         checkCudaErrors(cublasStatus);
 
         /* Get handle to the CUSPARSE context */
-        cusparseHandle_t cusparseHandle = 0;
+        context->cusparseHandle = 0;
         cusparseStatus_t cusparseStatus;
-        cusparseStatus = cusparseCreate(&cusparseHandle);
+        cusparseStatus = cusparseCreate(&context->cusparseHandle);
 
         checkCudaErrors(cusparseStatus);
 
-        cusparseMatDescr_t descr = 0;
-        cusparseStatus = cusparseCreateMatDescr(&descr);
+        context->descr = 0;
+        cusparseStatus = cusparseCreateMatDescr(&context->descr);
 
         checkCudaErrors(cusparseStatus);
 
-        cusparseSetMatType(descr,CUSPARSE_MATRIX_TYPE_GENERAL);
-        cusparseSetMatIndexBase(descr,CUSPARSE_INDEX_BASE_ZERO);
+        cusparseSetMatType(context->descr,CUSPARSE_MATRIX_TYPE_GENERAL);
+        cusparseSetMatIndexBase(context->descr,CUSPARSE_INDEX_BASE_ZERO);
+
+        context->capacityN = 0;
+        context->capacityNz = 0;
+        context->d_col = NULL;
+        context->d_row = NULL;
+        context->d_val = NULL;
+        context->d_x = NULL;
+        context->d_r = NULL;
+        context->d_p = NULL;
+        context->d_Ax = NULL;
+
+        return context;
+    }
+
+    static void freeCudaSolverBuffers(CudaSolverContext *context)
+    {
+        cudaFree(context->d_col);
+        cudaFree(context->d_row);
+        cudaFree(context->d_val);
+        cudaFree(context->d_x);
+        cudaFree(context->d_r);
+        cudaFree(context->d_p);
+        cudaFree(context->d_Ax);
+    }
+
+    void destroyCudaSolverContext(CudaSolverContext *context)
+    {
+        freeCudaSolverBuffers(context);
+        cusparseDestroyMatDescr(context->descr);
+        cusparseDestroy(context->cusparseHandle);
+        cublasDestroy(context->cublasHandle);
+        delete context;
+    }
+
+    // grow the device buffers, with 25% margin to avoid reallocation at each small change of the fluid volume
+    // returns true if the buffers have been reallocated
+    static bool reserveCudaSolverBuffers(CudaSolverContext *context, int N, int nz)
+    {
+        if ( (N <= context->capacityN) && (nz <= context->capacityNz) )
+        {
+            return false;
+        }
+
+        freeCudaSolverBuffers(context);
+        context->capacityN = std::max(N + N/4, context->capacityN);
+        context->capacityNz = std::max(nz + nz/4, context->capacityNz);
+
+        checkCudaErrors(cudaMalloc((void **)&context->d_col, context->capacityNz*sizeof(int)));
+        checkCudaErrors(cudaMalloc((void **)&context->d_row, (context->capacityN+1)*sizeof(int)));
+        checkCudaErrors(cudaMalloc((void **)&context->d_val, context->capacityNz*sizeof(float)));
+        checkCudaErrors(cudaMalloc((void **)&context->d_x, context->capacityN*sizeof(float)));
+        checkCudaErrors(cudaMalloc((void **)&context->d_r, context->capacityN*sizeof(float)));
+        checkCudaErrors(cudaMalloc((void **)&context->d_p, context->capacityN*sizeof(float)));
+        checkCudaErrors(cudaMalloc((void **)&context->d_Ax, context->capacityN*sizeof(float)));
+        return true;
+    }
+
+    // https://devblogs.nvidia.com/parallelforall/optimizing-high-performance-conjugate-gradient-benchmark-gpus/
+
+    // This implements a conjugate gradient solver on GPU using CUBLAS and CUSPARSE library.
+    // Solve Ax = b using cuda conjugate gradient cuSPARSE API
+    // A is the CSR matrix: see http://docs.nvidia.com/cuda/cusparse/#compressed-sparse-row-format-csr for CSR format
+    // b is rhs
+    // returns the numeric error
+    float spareSolverConjugateGradient(int *I, int *J, float *val, int M, int N, int nz, float *x, float *rhs)
+    {
+        CudaSolverContext *context = createCudaSolverContext();
+        float err = spareSolverConjugateGradient(context, I, J, val, M, N, nz, x, rhs);
+        destroyCudaSolverContext(context);
+        return err;
+    }
+
+    float spareSolverConjugateGradient(CudaSolverContext *context, int *I, int *J, float *val, int M, int N, int nz, float *x, float *rhs, bool uploadMatrix, SolverStats *stats, bool verify,
+                                       const SolverTolerance &tolerance)
+    {
+        // take input as a tridiagonal symmetric matrix MxN in CSR format with I, J, val and nz
+        float tol;
+        const int max_iter = tolerance.mMaxIterations;
+        float a, b, na, r0, r1;
+        float dot;
+        int k;
+        float alpha, beta, alpham1;
 
-        checkCudaErrors(cudaMalloc((void **)&d_col, nz*sizeof(int)));
-        checkCudaErrors(cudaMalloc((void **)&d_row, (N+1)*sizeof(int)));
-        checkCudaErrors(cudaMalloc((void **)&d_val, nz*sizeof(float)));
-        checkCudaErrors(cudaMalloc((void **)&d_x, N*sizeof(float)));
-        checkCudaErrors(cudaMalloc((void **)&d_r, N*sizeof(float)));
-        checkCudaErrors(cudaMalloc((void **)&d_p, N*sizeof(float)));
-        checkCudaErrors(cudaMalloc((void **)&d_Ax, N*sizeof(float)));
+        cublasHandle_t cublasHandle = context->cublasHandle;
+        cusparseHandle_t cusparseHandle = context->cusparseHandle;
+        cusparseMatDescr_t descr = context->descr;
+        cublasStatus_t cublasStatus;
+
+        SolverStats localStats;
+        if (stats == NULL)
+        {
+            stats = &localStats;
+        }
+        stats->mSolver = "cuda";
+        stats->mN = N;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-        cudaMemcpy(d_col, J, nz*sizeof(int), cudaMemcpyHostToDevice);
-        cudaMemcpy(d_row, I, (N+1)*sizeof(int), cudaMemcpyHostToDevice);
-        cudaMemcpy(d_val, val, nz*sizeof(float), cudaMemcpyHostToDevice);
+        if (reserveCudaSolverBuffers(context, N, nz))
+        {
+            uploadMatrix = true;
+        }
+        int *d_col = context->d_col;
+        int *d_row = context->d_row;
+        float *d_val = context->d_val;
+        float *d_x = context->d_x;
+        float *d_r = context->d_r;
+        float *d_p = context->d_p;
+        float *d_Ax = context->d_Ax;
+
+        if (uploadMatrix)
+        {
+            cudaMemcpy(d_col, J, nz*sizeof(int), cudaMemcpyHostToDevice);
+            cudaMemcpy(d_row, I, (N+1)*sizeof(int), cudaMemcpyHostToDevice);
+            cudaMemcpy(d_val, val, nz*sizeof(float), cudaMemcpyHostToDevice);
+        }
         cudaMemcpy(d_x, x, N*sizeof(float), cudaMemcpyHostToDevice);
         cudaMemcpy(d_r, rhs, N*sizeof(float), cudaMemcpyHostToDevice);
+        cudaThreadSynchronize();
+        stats->mSetupTime += getElapsedSeconds(start);
+        start = std::chrono::steady_clock::now();
 
         alpha = 1.0;
         alpham1 = -1.0;
@@ -131,8 +243,16 @@ namespace yapfs
 
         cusparseScsrmv(cusparseHandle,CUSPARSE_OPERATION_NON_TRANSPOSE, N, N, nz, &alpha, descr, d_val, d_row, d_col, d_x, &beta, d_Ax);
 
+        // d_r is still rhs here
+        cublasStatus = cublasSdot(cublasHandle, N, d_r, 1, d_r, 1, &r1);
+        tol = tolerance.getTolerance(sqrt(r1));
+        stats->mTolerance = tol;
+
         cublasSaxpy(cublasHandle, N, &alpham1, d_Ax, 1, d_r, 1);
         cublasStatus = cublasSdot(cublasHandle, N, d_r, 1, d_r, 1, &r1);
+        stats->mInitialResidual = sqrt(r1);
+        stats->mResidualHistory.assign(1, sqrt(r1));
+        stats->mStopReason = SOLVER_MAX_ITERATIONS;
 
         k = 1;
 
@@ -160,46 +280,34 @@ namespace yapfs
             r0 = r1;
             cublasStatus = cublasSdot(cublasHandle, N, d_r, 1, d_r, 1, &r1);
             cudaThreadSynchronize();
-            //printf("iteration = %3d, residual = %e   N-M = %d\n", k, sqrt(r1), N);
+            stats->mResidualHistory.push_back(sqrt(r1));
             k++;
         }
-        printf("SPARSE SOLVER: Total iterations = %3d, residual = %e   NxM = %dx%d\n", k, sqrt(r1), N, M);
 
         cudaMemcpy(x, d_x, N*sizeof(float), cudaMemcpyDeviceToHost);
-
-        // Check error
-        float rsum, diff, err = 0.0;
-        for (int i = 0; i < N; i++)
+        stats->mSolveTime += getElapsedSeconds(start);
+        stats->mIterations = k - 1;
+        stats->mFinalResidual = sqrt(r1);
+        if (r1 <= tol*tol)
         {
-            rsum = 0.0;
-
-            for (int j = I[i]; j < I[i+1]; j++)
-            {
-                rsum += val[j]*x[J[j]];
-            }
-
-            diff = fabs(rsum - rhs[i]);
+            stats->mStopReason = (k == 1) ? SOLVER_CONVERGED_INITIAL : SOLVER_CONVERGED;
+        }
 
-            if (diff > err)
-            {
-                err = diff;
-            }
+        // Check error on CPU, in parallel
+        stats->mError = -1.0f;
+        if (verify)
+        {
+            CSRMatrix A(I, J, val, N, nz);
+            vector<float> Ax(N);
+            stats->mError = cpuMaxError(A, x, rhs, Ax.data());
         }
-        printf("SPARSE SOLVER:  Test Summary:  Error amount = %f\n", err);
-
-        cusparseDestroy(cusparseHandle);
-        cublasDestroy(cublasHandle);
-        cudaFree(d_col);
-        cudaFree(d_row);
-        cudaFree(d_val);
-        cudaFree(d_x);
-        cudaFree(d_r);
-        cudaFree(d_p);
-        cudaFree(d_Ax);
+        L_LOG_DEBUG(stats->toString());
 
-        return err;
+        return verify ? stats->mError : 0.0f;
 
     }
 
 
 }
+
+#endif /* YAPFS_CUDA */
@@ -42,13 +42,29 @@
 
 #include "log.h"
 #include "config.h"
+#include "solver_stats.h"
 
 using namespace std;
 
 namespace yapfs
 {
 
+#ifdef YAPFS_CUDA
+    // CUDA device, cuBLAS/cuSPARSE handles and device buffers kept alive between solves (defined in sparse_solver.cpp)
+    struct CudaSolverContext;
+
+    CudaSolverContext *createCudaSolverContext();
+    void destroyCudaSolverContext(CudaSolverContext *context);
+
+    // Solve using a temporary context
     float spareSolverConjugateGradient(int *I, int *J, float *val, int M, int N, int nz, float *x, float *rhs);
+    // Solve reusing the context, device buffers grow when the matrix is bigger than the previous ones.
+    // With uploadMatrix false the matrix already on the device from the previous solve is used.
+    // stats, if not NULL, gets the result of the solve (the upload is the setup time), verify computes max |A*x - b|
+    // on CPU, tolerance is relative to |rhs| of this solve, returns 0 when not verified
+    float spareSolverConjugateGradient(CudaSolverContext *context, int *I, int *J, float *val, int M, int N, int nz, float *x, float *rhs, bool uploadMatrix = true,
+                                       SolverStats *stats = NULL, bool verify = true, const SolverTolerance &tolerance = SolverTolerance());
+#endif
 
 }
 
@@ -0,0 +1,855 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#include "sparse_solver_cpu.h"
+
+#include <algorithm>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+namespace yapfs
+{
+
+    template<typename T>
+    static void spMV(const CSRMatrix &A, const T *x, T *y)
+    {
+        tbb::parallel_for(tbb::blocked_range<int>(0, A.mN, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    T sum = 0.0;
+                    for (int j = A.mI[i]; j < A.mI[i+1]; j++)
+                    {
+                        sum += A.mVal[j] * x[A.mJ[j]];
+                    }
+                    y[i] = sum;
+                }
+            });
+    }
+
+    void cpuSpMV(const CSRMatrix &A, const float *x, float *y)
+    {
+        spMV(A, x, y);
+    }
+
+    void CSRMatrix::apply(const float *x, float *y) const
+    {
+        spMV(*this, x, y);
+    }
+
+    void CSRMatrix::apply(const double *x, double *y) const
+    {
+        spMV(*this, x, y);
+    }
+
+    void CSRMatrix::diagonal(float *d) const
+    {
+        tbb::parallel_for(tbb::blocked_range<int>(0, mN, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    d[i] = 0.0f;
+                    for (int j = mI[i]; j < mI[i+1]; j++)
+                    {
+                        if (mJ[j] == i)
+                        {
+                            d[i] = mVal[j];
+                            break;
+                        }
+                    }
+                }
+            });
+    }
+
+    void SymmetricCSRMatrix::assemble(const CSRMatrix &A)
+    {
+        mN = A.mN;
+        mI.resize(mN + 1);
+        mJ.clear();
+        mVal.clear();
+        for (int i = 0; i < mN; i++)
+        {
+            mI[i] = (int)mJ.size();
+            for (int j = A.mI[i]; j < A.mI[i+1]; j++)
+            {
+                if (A.mJ[j] >= i)
+                {
+                    mJ.push_back(A.mJ[j]);
+                    mVal.push_back(A.mVal[j]);
+                }
+            }
+        }
+        mI[mN] = (int)mJ.size();
+        buildBlocks();
+    }
+
+    void SymmetricCSRMatrix::buildBlocks()
+    {
+        int bandwidth = 1;
+        for (int i = 0; i < mN; i++)
+        {
+            if (mI[i+1] > mI[i])
+            {
+                bandwidth = std::max(bandwidth, mJ[mI[i+1] - 1] - i);
+            }
+        }
+
+        int blockSize = std::max(bandwidth, CPU_SOLVER_GRAIN_SIZE);
+        mBlockStart.clear();
+        for (int i = 0; i < mN; i += blockSize)
+        {
+            mBlockStart.push_back(i);
+        }
+        mBlockStart.push_back(mN);
+    }
+
+    template<typename T>
+    static void symmetricSpMV(const SymmetricCSRMatrix &A, const T *x, T *y)
+    {
+        const int *I = A.mI.data();
+        const int *J = A.mJ.data();
+        const float *val = A.mVal.data();
+        int numBlocks = (int)A.mBlockStart.size() - 1;
+
+        std::fill(y, y + A.mN, (T)0.0);
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            int numPassBlocks = (numBlocks - pass + 1) / 2;
+            tbb::parallel_for(tbb::blocked_range<int>(0, numPassBlocks),
+                [&](const tbb::blocked_range<int> &range)
+                {
+                    for (int idx = range.begin(); idx != range.end(); ++idx)
+                    {
+                        int block = 2*idx + pass;
+                        for (int i = A.mBlockStart[block]; i < A.mBlockStart[block+1]; i++)
+                        {
+                            T xi = x[i];
+                            T sum = 0.0;
+                            for (int j = I[i]; j < I[i+1]; j++)
+                            {
+                                int col = J[j];
+                                sum += val[j] * x[col];
+                                if (col != i)
+                                {
+                                    y[col] += val[j] * xi;
+                                }
+                            }
+                            y[i] += sum;
+                        }
+                    }
+                });
+        }
+    }
+
+    void SymmetricCSRMatrix::apply(const float *x, float *y) const
+    {
+        symmetricSpMV(*this, x, y);
+    }
+
+    void SymmetricCSRMatrix::apply(const double *x, double *y) const
+    {
+        symmetricSpMV(*this, x, y);
+    }
+
+    void SymmetricCSRMatrix::diagonal(float *d) const
+    {
+        tbb::parallel_for(tbb::blocked_range<int>(0, mN, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    // the diagonal is the first column of a row of the upper triangle
+                    d[i] = ( (mI[i+1] > mI[i]) && (mJ[mI[i]] == i) ) ? mVal[mI[i]] : 0.0f;
+                }
+            });
+    }
+
+    void SellCSMatrix::assemble(const CSRMatrix &A, int sigma)
+    {
+        const int C = SELL_SLICE_SIZE;
+        sigma = std::max(C, (sigma + C - 1) / C * C);
+        mN = A.mN;
+        int numSlices = (mN + C - 1) / C;
+
+        // rows sorted by decreasing length inside each window of sigma rows
+        vector<int> sortedRows(mN);
+        for (int i = 0; i < mN; i++)
+        {
+            sortedRows[i] = i;
+        }
+        for (int start = 0; start < mN; start += sigma)
+        {
+            std::stable_sort(sortedRows.begin() + start, sortedRows.begin() + std::min(start + sigma, mN),
+                [&](int r1, int r2) { return (A.mI[r1+1] - A.mI[r1]) > (A.mI[r2+1] - A.mI[r2]); });
+        }
+
+        mRowOfSlot.assign(numSlices * C, -1);
+        std::copy(sortedRows.begin(), sortedRows.end(), mRowOfSlot.begin());
+
+        mSliceStart.resize(numSlices + 1);
+        mSliceStart[0] = 0;
+        for (int slice = 0; slice < numSlices; slice++)
+        {
+            int width = 0;
+            for (int lane = 0; lane < C; lane++)
+            {
+                int row = mRowOfSlot[slice*C + lane];
+                if (row >= 0)
+                {
+                    width = std::max(width, A.mI[row+1] - A.mI[row]);
+                }
+            }
+            mSliceStart[slice+1] = mSliceStart[slice] + width*C;
+        }
+
+        mCol.resize(mSliceStart[numSlices]);
+        mVal.resize(mSliceStart[numSlices]);
+        tbb::parallel_for(tbb::blocked_range<int>(0, numSlices, CPU_SOLVER_GRAIN_SIZE / C),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int slice = range.begin(); slice != range.end(); ++slice)
+                {
+                    int width = (mSliceStart[slice+1] - mSliceStart[slice]) / C;
+                    for (int lane = 0; lane < C; lane++)
+                    {
+                        int row = mRowOfSlot[slice*C + lane];
+                        int length = (row >= 0) ? A.mI[row+1] - A.mI[row] : 0;
+                        for (int j = 0; j < width; j++)
+                        {
+                            int idx = mSliceStart[slice] + j*C + lane;
+                            if (j < length)
+                            {
+                                mCol[idx] = A.mJ[A.mI[row] + j];
+                                mVal[idx] = A.mVal[A.mI[row] + j];
+                            }
+                            else
+                            {
+                                // padding: 0 times an x value that is always readable
+                                mCol[idx] = (row >= 0) ? row : 0;
+                                mVal[idx] = 0.0f;
+                            }
+                        }
+                    }
+                }
+            });
+    }
+
+    // C lanes of a slice in a plain loop, vectorized by the compiler when it can
+    template<typename T>
+    static void sellSpMV(const SellCSMatrix &A, const T *x, T *y)
+    {
+        const int C = SELL_SLICE_SIZE;
+        const int *sliceStart = A.mSliceStart.data();
+        const int *col = A.mCol.data();
+        const float *val = A.mVal.data();
+        const int *rowOfSlot = A.mRowOfSlot.data();
+        tbb::parallel_for(tbb::blocked_range<int>(0, (int)A.mSliceStart.size() - 1, CPU_SOLVER_GRAIN_SIZE / C),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int slice = range.begin(); slice != range.end(); ++slice)
+                {
+                    T sum[C] = {};
+                    for (int idx = sliceStart[slice]; idx < sliceStart[slice+1]; idx += C)
+                    {
+                        for (int lane = 0; lane < C; lane++)
+                        {
+                            sum[lane] += val[idx + lane] * x[col[idx + lane]];
+                        }
+                    }
+                    for (int lane = 0; lane < C; lane++)
+                    {
+                        int row = rowOfSlot[slice*C + lane];
+                        if (row >= 0)
+                        {
+                            y[row] = sum[lane];
+                        }
+                    }
+                }
+            });
+    }
+
+    void SellCSMatrix::apply(const float *x, float *y) const
+    {
+#if defined(__AVX2__) && defined(__FMA__)
+        // one slice is one register: load 8 values and 8 columns, gather 8 x
+        static_assert(SELL_SLICE_SIZE == 8, "the AVX2 kernel needs slices of 8 rows");
+        const int *sliceStart = mSliceStart.data();
+        const int *col = mCol.data();
+        const float *val = mVal.data();
+        const int *rowOfSlot = mRowOfSlot.data();
+        tbb::parallel_for(tbb::blocked_range<int>(0, (int)mSliceStart.size() - 1, CPU_SOLVER_GRAIN_SIZE / SELL_SLICE_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int slice = range.begin(); slice != range.end(); ++slice)
+                {
+                    __m256 sum = _mm256_setzero_ps();
+                    for (int idx = sliceStart[slice]; idx < sliceStart[slice+1]; idx += 8)
+                    {
+                        __m256i c = _mm256_loadu_si256((const __m256i *)(col + idx));
+                        __m256 v = _mm256_loadu_ps(val + idx);
+                        sum = _mm256_fmadd_ps(v, _mm256_i32gather_ps(x, c, 4), sum);
+                    }
+                    float out[8];
+                    _mm256_storeu_ps(out, sum);
+                    for (int lane = 0; lane < 8; lane++)
+                    {
+                        int row = rowOfSlot[slice*8 + lane];
+                        if (row >= 0)
+                        {
+                            y[row] = out[lane];
+                        }
+                    }
+                }
+            });
+#else
+        sellSpMV(*this, x, y);
+#endif
+    }
+
+    void SellCSMatrix::apply(const double *x, double *y) const
+    {
+        sellSpMV(*this, x, y);
+    }
+
+    void SellCSMatrix::diagonal(float *d) const
+    {
+        const int C = SELL_SLICE_SIZE;
+        tbb::parallel_for(tbb::blocked_range<int>(0, (int)mSliceStart.size() - 1, CPU_SOLVER_GRAIN_SIZE / C),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int slice = range.begin(); slice != range.end(); ++slice)
+                {
+                    for (int lane = 0; lane < C; lane++)
+                    {
+                        int row = mRowOfSlot[slice*C + lane];
+                        if (row < 0)
+                        {
+                            continue;
+                        }
+                        // the padding has the diagonal column too, but value 0
+                        d[row] = 0.0f;
+                        for (int idx = mSliceStart[slice] + lane; idx < mSliceStart[slice+1]; idx += C)
+                        {
+                            if ( (mCol[idx] == row) && (mVal[idx] != 0.0f) )
+                            {
+                                d[row] = mVal[idx];
+                                break;
+                            }
+                        }
+                    }
+                }
+            });
+    }
+
+    double cpuDot(const float *a, const float *b, int N)
+    {
+        return tbb::parallel_reduce(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE), 0.0,
+            [&](const tbb::blocked_range<int> &range, double sum) -> double
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    sum += (double)a[i] * (double)b[i];
+                }
+                return sum;
+            },
+            [](double s1, double s2) -> double { return s1 + s2; });
+    }
+
+    double cpuDot(const double *a, const double *b, int N)
+    {
+        return tbb::parallel_reduce(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE), 0.0,
+            [&](const tbb::blocked_range<int> &range, double sum) -> double
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    sum += a[i] * b[i];
+                }
+                return sum;
+            },
+            [](double s1, double s2) -> double { return s1 + s2; });
+    }
+
+    double cpuResidual(const LinearOperator &A, const double *x, const double *b, double *r)
+    {
+        int N = A.size();
+        A.apply(x, r);
+        return sqrt(tbb::parallel_reduce(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE), 0.0,
+            [&](const tbb::blocked_range<int> &range, double sum) -> double
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    r[i] = b[i] - r[i];
+                    sum += r[i] * r[i];
+                }
+                return sum;
+            },
+            [](double s1, double s2) -> double { return s1 + s2; }));
+    }
+
+    void cpuScale(const double *x, double alpha, float *y, int N)
+    {
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    y[i] = alpha * x[i];
+                }
+            });
+    }
+
+    void cpuAxpy(double alpha, const float *x, double *y, int N)
+    {
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    y[i] += alpha * x[i];
+                }
+            });
+    }
+
+    int iterativeRefinementCPU(const LinearOperator &A, FloatSolver floatSolve, double *x, const double *b, double tol, int maxRefinements,
+                               float *d, float *rhsFloat, double *r, int &iterations, double &residual)
+    {
+        int N = A.size();
+        double bNorm = sqrt(cpuDot(b, b, N));
+        residual = cpuResidual(A, x, b, r);
+        iterations = 0;
+        int refinement = 0;
+        while ( (residual > tol * bNorm) && (residual > 0.0) && (refinement < maxRefinements) )
+        {
+            cpuScale(r, 1.0 / residual, rhsFloat, N);
+            std::fill(d, d + N, 0.0f);
+            iterations += floatSolve(d, rhsFloat);
+
+            cpuAxpy(residual, d, x, N);
+            residual = cpuResidual(A, x, b, r);
+            refinement++;
+        }
+        return refinement;
+    }
+
+    void cpuAxpy(float alpha, const float *x, float *y, int N)
+    {
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    y[i] += alpha * x[i];
+                }
+            });
+    }
+
+    void cpuXpby(const float *z, float beta, float *p, int N)
+    {
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    p[i] = z[i] + beta * p[i];
+                }
+            });
+    }
+
+    // x = x + alpha*p, r = r - alpha*Ap in one sweep, returns r.r
+    static double cpuUpdateSolution(float alpha, const float *p, const float *Ap, float *x, float *r, int N)
+    {
+        return tbb::parallel_reduce(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE), 0.0,
+            [&](const tbb::blocked_range<int> &range, double sum) -> double
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    x[i] += alpha * p[i];
+                    r[i] -= alpha * Ap[i];
+                    sum += (double)r[i] * (double)r[i];
+                }
+                return sum;
+            },
+            [](double s1, double s2) -> double { return s1 + s2; });
+    }
+
+    JacobiPreconditioner::JacobiPreconditioner(const LinearOperator &A)
+    {
+        mInvDiag.resize(A.size());
+        A.diagonal(mInvDiag.data());
+        tbb::parallel_for(tbb::blocked_range<int>(0, A.size(), CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    mInvDiag[i] = (mInvDiag[i] != 0.0f) ? 1.0f / mInvDiag[i] : 0.0f;
+                }
+            });
+    }
+
+    void JacobiPreconditioner::apply(const float *r, float *z)
+    {
+        const float *invDiag = mInvDiag.data();
+        tbb::parallel_for(tbb::blocked_range<int>(0, (int)mInvDiag.size(), CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    z[i] = invDiag[i] * r[i];
+                }
+            });
+    }
+
+    void CGWorkspace::resize(int N)
+    {
+        // std::vector keeps its capacity, the memory is allocated only when N grows
+        mR.resize(N);
+        mZ.resize(N);
+        mP.resize(N);
+        mAp.resize(N);
+    }
+
+    // PCG algorithm described in chapter 5 of Fluid Simulation for Computer Graphics by Robert Bridson (second edition 2015)
+    static void startStats(SolverStats *stats, int N, double initialResidual)
+    {
+        if (stats != NULL)
+        {
+            stats->mN = N;
+            stats->mInitialResidual = initialResidual;
+            stats->mResidualHistory.clear();
+            stats->mResidualHistory.push_back(initialResidual);
+        }
+    }
+
+    static inline void addResidualToStats(SolverStats *stats, double residual)
+    {
+        if (stats != NULL)
+        {
+            stats->mResidualHistory.push_back(residual);
+        }
+    }
+
+    static void finishStats(SolverStats *stats, int iterations, double residual, SolverStopReason reason)
+    {
+        if (stats != NULL)
+        {
+            stats->mIterations = iterations;
+            stats->mFinalResidual = residual;
+            stats->mStopReason = reason;
+        }
+    }
+
+    int conjugateGradientCPU(const LinearOperator &A, Preconditioner *precond, float *x, const float *rhs, float tol, int maxIter, float &residual, CGWorkspace *workspace, SolverStats *stats)
+    {
+        int N = A.size();
+        CGWorkspace localWorkspace;
+        if (workspace == NULL)
+        {
+            workspace = &localWorkspace;
+        }
+        workspace->resize(N);
+        vector<float> &r = workspace->mR;
+        vector<float> &z = workspace->mZ;
+        vector<float> &p = workspace->mP;
+        vector<float> &Ap = workspace->mAp;
+
+        // r = b - A*x
+        A.apply(x, Ap.data());
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    r[i] = rhs[i] - Ap[i];
+                }
+            });
+
+        double r1 = cpuDot(r.data(), r.data(), N);
+        startStats(stats, N, sqrt(r1));
+        if (r1 <= (double)tol*tol)
+        {
+            residual = sqrt(r1);
+            finishStats(stats, 0, residual, SOLVER_CONVERGED_INITIAL);
+            return 0;
+        }
+
+        // p = z = M^-1 * r
+        precond->apply(r.data(), z.data());
+        std::copy(z.begin(), z.end(), p.begin());
+        double rz = cpuDot(r.data(), z.data(), N);
+
+        SolverStopReason reason = SOLVER_MAX_ITERATIONS;
+        int k = 1;
+        while (k <= maxIter)
+        {
+            A.apply(p.data(), Ap.data());
+            double pAp = cpuDot(p.data(), Ap.data(), N);
+            if (pAp <= 0.0)
+            {
+                // p is in the null space of A: nothing more to gain
+                reason = SOLVER_BREAKDOWN;
+                break;
+            }
+
+            float alpha = rz / pAp;
+            r1 = cpuUpdateSolution(alpha, p.data(), Ap.data(), x, r.data(), N);
+            addResidualToStats(stats, sqrt(r1));
+            if (r1 <= (double)tol*tol)
+            {
+                reason = SOLVER_CONVERGED;
+                break;
+            }
+
+            precond->apply(r.data(), z.data());
+            double rzNew = cpuDot(r.data(), z.data(), N);
+            float beta = rzNew / rz;
+            rz = rzNew;
+            cpuXpby(z.data(), beta, p.data(), N);
+
+            k++;
+        }
+        // the loop exits with k = maxIter + 1 when the iterations are exhausted
+        k = std::min(k, maxIter);
+
+        residual = sqrt(r1);
+        finishStats(stats, k, residual, reason);
+        return k;
+    }
+
+    // r.u, w.u and r.r of the single reduction conjugate gradient
+    struct CGDots
+    {
+        double rz;
+        double wz;
+        double rr;
+    };
+
+    static CGDots cpuDots(const float *r, const float *u, const float *w, int N)
+    {
+        CGDots zero = { 0.0, 0.0, 0.0 };
+        return tbb::parallel_reduce(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE), zero,
+            [&](const tbb::blocked_range<int> &range, CGDots dots) -> CGDots
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    dots.rz += (double)r[i] * (double)u[i];
+                    dots.wz += (double)w[i] * (double)u[i];
+                    dots.rr += (double)r[i] * (double)r[i];
+                }
+                return dots;
+            },
+            [](const CGDots &d1, const CGDots &d2) -> CGDots
+            {
+                CGDots sum = { d1.rz + d2.rz, d1.wz + d2.wz, d1.rr + d2.rr };
+                return sum;
+            });
+    }
+
+    // p = u + beta*p, s = w + beta*s, x = x + alpha*p, r = r - alpha*s in one sweep
+    static void cpuUpdateSingleReduction(float alpha, float beta, const float *u, const float *w, float *p, float *s, float *x, float *r, int N)
+    {
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    p[i] = u[i] + beta * p[i];
+                    s[i] = w[i] + beta * s[i];
+                    x[i] += alpha * p[i];
+                    r[i] -= alpha * s[i];
+                }
+            });
+    }
+
+    // Chronopoulos and Gear, s-step iterative methods for symmetric linear systems (J. Comput. Appl. Math. 1989),
+    // the conjugate gradient with one reduction per iteration: p.A.p = w.u - beta*r.u/alpha_old
+    int singleReductionConjugateGradientCPU(const LinearOperator &A, Preconditioner *precond, float *x, const float *rhs, float tol, int maxIter, float &residual, CGWorkspace *workspace, SolverStats *stats)
+    {
+        int N = A.size();
+        CGWorkspace localWorkspace;
+        if (workspace == NULL)
+        {
+            workspace = &localWorkspace;
+        }
+        workspace->resize(N);
+        workspace->mS.resize(N);
+        vector<float> &r = workspace->mR;
+        vector<float> &u = workspace->mZ;
+        vector<float> &p = workspace->mP;
+        vector<float> &w = workspace->mAp;
+        vector<float> &s = workspace->mS;
+
+        // r = b - A*x
+        A.apply(x, w.data());
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, CPU_SOLVER_GRAIN_SIZE),
+            [&](const tbb::blocked_range<int> &range)
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    r[i] = rhs[i] - w[i];
+                }
+            });
+
+        // the first iteration has beta = 0, the old values must not be NaN
+        std::fill(p.begin(), p.end(), 0.0f);
+        std::fill(s.begin(), s.end(), 0.0f);
+
+        double rzOld = 0.0;
+        double alphaOld = 0.0;
+        double r1 = 0.0;
+        SolverStopReason reason = SOLVER_MAX_ITERATIONS;
+        int k = 0;
+        while (k <= maxIter)
+        {
+            // u = M^-1 * r, w = A*u and the only reduction of the iteration
+            precond->apply(r.data(), u.data());
+            A.apply(u.data(), w.data());
+            CGDots dots = cpuDots(r.data(), u.data(), w.data(), N);
+            r1 = dots.rr;
+            if (k == 0)
+            {
+                startStats(stats, N, sqrt(r1));
+            }
+            else
+            {
+                addResidualToStats(stats, sqrt(r1));
+            }
+            if (r1 <= (double)tol*tol)
+            {
+                reason = (k == 0) ? SOLVER_CONVERGED_INITIAL : SOLVER_CONVERGED;
+                break;
+            }
+            if (k == maxIter)
+            {
+                break;
+            }
+
+            double beta = (k > 0) ? dots.rz / rzOld : 0.0;
+            double pAp = (k > 0) ? dots.wz - beta * dots.rz / alphaOld : dots.wz;
+            if (pAp <= 0.0)
+            {
+                // p is in the null space of A: nothing more to gain
+                reason = SOLVER_BREAKDOWN;
+                break;
+            }
+            double alpha = dots.rz / pAp;
+            rzOld = dots.rz;
+            alphaOld = alpha;
+
+            cpuUpdateSingleReduction(alpha, beta, u.data(), w.data(), p.data(), s.data(), x, r.data(), N);
+
+            k++;
+        }
+
+        residual = sqrt(r1);
+        finishStats(stats, k, residual, reason);
+        return k;
+    }
+
+    float spareSolverConjugateGradientCPU(int *I, int *J, float *val, int M, int N, int nz, float *x, float *rhs)
+    {
+        // take input as a symmetric matrix MxN in CSR format with I, J, val and nz
+        CSRMatrix A(I, J, val, N, nz);
+        return spareSolverConjugateGradientCPU(A, x, rhs);
+    }
+
+    float cpuMaxError(const LinearOperator &A, const float *x, const float *rhs, float *Ax)
+    {
+        A.apply(x, Ax);
+        return tbb::parallel_reduce(tbb::blocked_range<int>(0, A.size(), CPU_SOLVER_GRAIN_SIZE), 0.0f,
+            [&](const tbb::blocked_range<int> &range, float maxDiff) -> float
+            {
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    float diff = fabs(Ax[i] - rhs[i]);
+                    if (diff > maxDiff)
+                    {
+                        maxDiff = diff;
+                    }
+                }
+                return maxDiff;
+            },
+            [](float d1, float d2) -> float { return std::max(d1, d2); });
+    }
+
+    float spareSolverConjugateGradientCPU(const LinearOperator &A, float *x, float *rhs, Preconditioner *precond, SolverStats *stats, CGWorkspace *workspace, bool singleReduction, bool verify,
+                                          const SolverTolerance &tolerance)
+    {
+        const float tol = tolerance.getTolerance(sqrt(cpuDot(rhs, rhs, A.size())));
+        const int max_iter = tolerance.mMaxIterations;
+
+        SolverStats localStats;
+        if (stats == NULL)
+        {
+            stats = &localStats;
+        }
+        if (stats->mSolver.empty())
+        {
+            stats->mSolver = "cpu";
+        }
+        stats->mTolerance = tol;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        JacobiPreconditioner *jacobi = NULL;
+        if (precond == NULL)
+        {
+            jacobi = new JacobiPreconditioner(A);
+            precond = jacobi;
+        }
+        stats->mSetupTime += getElapsedSeconds(start);
+
+        float finalResidual;
+        CGWorkspace localWorkspace;
+        if (workspace == NULL)
+        {
+            workspace = &localWorkspace;
+        }
+        start = std::chrono::steady_clock::now();
+        if (singleReduction)
+        {
+            singleReductionConjugateGradientCPU(A, precond, x, rhs, tol, max_iter, finalResidual, workspace, stats);
+        }
+        else
+        {
+            conjugateGradientCPU(A, precond, x, rhs, tol, max_iter, finalResidual, workspace, stats);
+        }
+        stats->mSolveTime += getElapsedSeconds(start);
+        delete jacobi;
+
+        stats->mError = verify ? cpuMaxError(A, x, rhs, workspace->mAp.data()) : -1.0f;
+        L_LOG_DEBUG(stats->toString());
+
+        return stats->mError;
+    }
+
+}
@@ -0,0 +1,256 @@
+/*****************************************************************************
+ * LarmorFluid-YAPFS Version 1.0 2017
+ * Copyright (c) 2017 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorFluid-YAPFS 
+ * (https://github.com/ppciarravano/larmorfluid-yapfs).
+ *
+ * LarmorFluid-YAPFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorFluid-YAPFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorFluid-YAPFS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef SPARSE_SOLVER_CPU_H_
+#define SPARSE_SOLVER_CPU_H_
+
+#include <vector>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+
+#include <sys/time.h>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+
+#include "log.h"
+#include "config.h"
+#include "solver_stats.h"
+
+// Number of rows processed by a single TBB task in the CPU solver kernels
+#define CPU_SOLVER_GRAIN_SIZE 2048
+
+// Rows of a slice of the SELL-C-sigma matrix, one AVX2 register of floats
+#define SELL_SLICE_SIZE 8
+// Default window of rows sorted by length in the SELL-C-sigma matrix, a multiple of SELL_SLICE_SIZE
+#define SELL_DEFAULT_SIGMA 256
+
+using namespace std;
+
+namespace yapfs
+{
+
+    // Linear operator A of the system A*x = b solved on CPU
+    class LinearOperator
+    {
+        public:
+            virtual ~LinearOperator() {}
+
+            // number of rows
+            virtual int size() const = 0;
+            // y = A*x
+            virtual void apply(const float *x, float *y) const = 0;
+            // y = A*x in double precision
+            virtual void apply(const double *x, double *y) const = 0;
+            // d = diagonal of A
+            virtual void diagonal(float *d) const = 0;
+    };
+
+    // Sparse matrix in CSR format, it only wraps the I, J, val arrays (not owned)
+    // see http://docs.nvidia.com/cuda/cusparse/#compressed-sparse-row-format-csr for CSR format
+    class CSRMatrix : public LinearOperator
+    {
+        public:
+            int   *mI;
+            int   *mJ;
+            float *mVal;
+            int    mN;
+            int    mNz;
+
+            CSRMatrix(int *I, int *J, float *val, int N, int nz): mI(I), mJ(J), mVal(val), mN(N), mNz(nz) {}
+
+            int size() const { return mN; }
+            void apply(const float *x, float *y) const;
+            void apply(const double *x, double *y) const;
+            void diagonal(float *d) const;
+    };
+
+    // Symmetric sparse matrix: only the upper triangle (diagonal included) is stored in CSR format,
+    // about half of the memory and of the bytes read by each product of the full CSR matrix.
+    // Row i of the product also adds its transposed entries y[j] += a_ij*x[i] to the rows j > i:
+    // the rows are split in blocks not smaller than the bandwidth, so a block only writes its rows and the
+    // rows of the next block. Even and odd blocks run in two parallel passes without write conflicts.
+    class SymmetricCSRMatrix : public LinearOperator
+    {
+        public:
+            vector<int>   mI;
+            vector<int>   mJ;
+            vector<float> mVal;
+            int           mN;
+            vector<int>   mBlockStart; // rows of block b are mBlockStart[b]..mBlockStart[b+1]
+
+            SymmetricCSRMatrix(): mN(0) {}
+
+            // keep the upper triangle of the full matrix A, columns of each row must be sorted
+            void assemble(const CSRMatrix &A);
+            // split the rows in blocks, to call after mI, mJ and mVal are filled
+            void buildBlocks();
+
+            int size() const { return mN; }
+            int getNumNonZero() const { return (int)mJ.size(); }
+            void apply(const float *x, float *y) const;
+            void apply(const double *x, double *y) const;
+            void diagonal(float *d) const;
+    };
+
+    // Sparse matrix in SELL-C-sigma format (Kreutzer et al., SIAM J. Sci. Comput. 2014):
+    // the rows are sorted by number of non zero inside windows of sigma rows, then packed in slices of
+    // C = SELL_SLICE_SIZE rows padded to the longest row of the slice. A slice is stored column by column,
+    // so the product computes C rows at once with contiguous loads of values and columns and a gather of x,
+    // instead of the short indirect loop of each CSR row. Padding entries have value 0 and a valid column.
+    class SellCSMatrix : public LinearOperator
+    {
+        public:
+            vector<int>   mSliceStart; // entries of slice s are mSliceStart[s]..mSliceStart[s+1], C per column
+            vector<int>   mCol;
+            vector<float> mVal;
+            vector<int>   mRowOfSlot; // slot s*C + lane -> row, -1 for the padding rows of the last slice
+            int           mN;
+
+            SellCSMatrix(): mN(0) {}
+
+            // convert the full matrix A, sigma is rounded up to a multiple of SELL_SLICE_SIZE
+            void assemble(const CSRMatrix &A, int sigma = SELL_DEFAULT_SIGMA);
+
+            int size() const { return mN; }
+            // stored entries, padding included
+            int getNumStored() const { return (int)mVal.size(); }
+            void apply(const float *x, float *y) const;
+            void apply(const double *x, double *y) const;
+            void diagonal(float *d) const;
+    };
+
+    // Parallel kernels used by the CPU conjugate gradient
+    // y = A*x
+    void cpuSpMV(const CSRMatrix &A, const float *x, float *y);
+    // returns a.b, accumulated in double precision
+    double cpuDot(const float *a, const float *b, int N);
+    // y = y + alpha*x
+    void cpuAxpy(float alpha, const float *x, float *y, int N);
+    // returns max |A*x - rhs|, Ax is a work vector of size N
+    float cpuMaxError(const LinearOperator &A, const float *x, const float *rhs, float *Ax);
+
+    // Double precision kernels of the mixed precision solve
+    double cpuDot(const double *a, const double *b, int N);
+    // r = b - A*x, returns the 2-norm of r
+    double cpuResidual(const LinearOperator &A, const double *x, const double *b, double *r);
+    // y = alpha*x rounded to float
+    void cpuScale(const double *x, double alpha, float *y, int N);
+    // y = y + alpha*x with the float x
+    void cpuAxpy(double alpha, const float *x, double *y, int N);
+
+    // Solver of the float system A*x = rhs used inside the iterative refinement, returns the iterations
+    typedef std::function<int (float *x, float *rhs)> FloatSolver;
+
+    // Mixed precision solve with iterative refinement: x and b in double, r = b - A*x computed in double and
+    // the correction A*d = r solved in float by floatSolve. The float solvers stop at an absolute residual,
+    // so r is normalized: each refinement reduces the double residual by the float tolerance.
+    // Stops when |r| <= tol*|b| or after maxRefinements; d, rhsFloat and r are work vectors of size N.
+    // returns the number of refinements, iterations is the total of the float solver, residual the final |r|
+    int iterativeRefinementCPU(const LinearOperator &A, FloatSolver floatSolve, double *x, const double *b, double tol, int maxRefinements,
+                               float *d, float *rhsFloat, double *r, int &iterations, double &residual);
+    // p = z + beta*p
+    void cpuXpby(const float *z, float beta, float *p, int N);
+
+    // Preconditioner M of the CPU conjugate gradient
+    class Preconditioner
+    {
+        public:
+            virtual ~Preconditioner() {}
+
+            // z = M^-1 * r
+            virtual void apply(const float *r, float *z) = 0;
+
+            // Update M after a small change of A, that is the same operator with the new rows:
+            // oldRowOfRow is the row of the same voxel before the change (-1 for new rows),
+            // changedRows are the rows that are new or whose coefficients changed.
+            // Call it once for each change: M is then in the new numbering and a second call with the same
+            // oldRowOfRow would remap it again (SolverContext::getPreconditioner consumes the change).
+            // returns false when M can't be updated and it has to be rebuilt
+            virtual bool update(const vector<int> &, const vector<int> &) { return false; }
+    };
+
+    // Diagonal preconditioner: empty rows (non fluid voxels) get 0 as inverse
+    class JacobiPreconditioner : public Preconditioner
+    {
+        public:
+            vector<float> mInvDiag;
+
+            JacobiPreconditioner(const LinearOperator &A);
+            void apply(const float *r, float *z);
+    };
+
+    // Work vectors of the conjugate gradient, they can be kept between solves to avoid allocations
+    struct CGWorkspace
+    {
+        vector<float> mR;
+        vector<float> mZ;
+        vector<float> mP;
+        vector<float> mAp;
+        vector<float> mS; // A*p of the single reduction conjugate gradient, resized only by it
+
+        void resize(int N);
+    };
+
+    // Solve A*x = b with preconditioned conjugate gradient, x is the initial guess and the result
+    // workspace can be NULL, then the work vectors are allocated for this solve
+    // stats, if not NULL, gets the residual history, the iterations and the stop reason
+    // returns the number of iterations, residual is the final 2-norm of b - A*x
+    int conjugateGradientCPU(const LinearOperator &A, Preconditioner *precond, float *x, const float *rhs, float tol, int maxIter, float &residual, CGWorkspace *workspace = NULL, SolverStats *stats = NULL);
+
+    // Preconditioned conjugate gradient with one reduction per iteration, same interface of conjugateGradientCPU.
+    // Chronopoulos and Gear form: s = A*p is updated by recurrence, so the dot products r.u, w.u (u = M^-1*r, w = A*u)
+    // and r.r are computed together by one parallel sweep after the product, instead of three separate reductions.
+    // The fully pipelined recurrences of Ghysels and Vanroose also update u and w, in float they stagnate
+    // far above the solver tolerance, here u and w are computed again at each iteration
+    int singleReductionConjugateGradientCPU(const LinearOperator &A, Preconditioner *precond, float *x, const float *rhs, float tol, int maxIter, float &residual, CGWorkspace *workspace = NULL, SolverStats *stats = NULL);
+
+    // Same interface of spareSolverConjugateGradient, runs on CPU using TBB
+    // returns the numeric error
+    float spareSolverConjugateGradientCPU(int *I, int *J, float *val, int M, int N, int nz, float *x, float *rhs);
+
+    // As above for any operator, e.g. the matrix-free LaplacianOperator, with a given preconditioner (Jacobi if NULL)
+    // stats, if not NULL, gets the result of the solve: the setup (Jacobi preconditioner) and solve times are added
+    // to the ones already in stats, the other fields are replaced.
+    // singleReduction selects singleReductionConjugateGradientCPU, verify computes max |A*x - b| with one more product,
+    // tolerance is relative to |rhs| of this solve
+    // returns the numeric error, -1 when not verified as stats->mError
+    float spareSolverConjugateGradientCPU(const LinearOperator &A, float *x, float *rhs, Preconditioner *precond = NULL, SolverStats *stats = NULL, CGWorkspace *workspace = NULL, bool singleReduction = false, bool verify = true,
+                                          const SolverTolerance &tolerance = SolverTolerance());
+
+}
+
+#endif /* SPARSE_SOLVER_CPU_H_ */
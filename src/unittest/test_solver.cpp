@@ -31,15 +31,45 @@
 
 #include <cppunit/extensions/HelperMacros.h>
 #include <tbb/tick_count.h>
+#include <atomic>
 
 class TestCaseSolver : public CppUnit::TestCase {
 
     public:
 
         CPPUNIT_TEST_SUITE( TestCaseSolver );
+#ifdef YAPFS_CUDA
         CPPUNIT_TEST( testSolver );
+#endif
+        CPPUNIT_TEST( testSolverCPU );
+        CPPUNIT_TEST( testLaplacianOperator );
+        CPPUNIT_TEST( testLaplacianBuild );
+        CPPUNIT_TEST( testRowOrdering );
+        CPPUNIT_TEST( testSymmetricCSR );
+        CPPUNIT_TEST( testSellCSMatrix );
+        CPPUNIT_TEST( testMICPreconditioner );
+        CPPUNIT_TEST( testSingleReductionCG );
+        CPPUNIT_TEST( testMultigridPreconditioner );
+        CPPUNIT_TEST( testPreconditionerUpdate );
+        CPPUNIT_TEST( testPreconditionerSkippedStep );
+        CPPUNIT_TEST( testSkippedPressureSolve );
+        CPPUNIT_TEST( testMixedPrecision );
+        CPPUNIT_TEST( testMixedPrecisionSteps );
+        CPPUNIT_TEST( testRelaxationSolver );
+        CPPUNIT_TEST( testSolverStats );
+        CPPUNIT_TEST( testRelativeTolerance );
+        CPPUNIT_TEST( testDCTPreconditioner );
+        CPPUNIT_TEST( testAMGPreconditioner );
+        CPPUNIT_TEST( testComponentSolver );
+        CPPUNIT_TEST( testGridAccessors );
+        CPPUNIT_TEST( testDenseGrid );
+        CPPUNIT_TEST( testGridBlocks );
+        CPPUNIT_TEST( testMACGrid );
+        CPPUNIT_TEST( testSinglePrecision );
+        CPPUNIT_TEST( testGradientFaces );
         CPPUNIT_TEST_SUITE_END();
 
+#ifdef YAPFS_CUDA
         // returns the numeric error
         float runSolver(uint64_t gridDim)
         {
@@ -188,6 +218,1417 @@ class TestCaseSolver : public CppUnit::TestCase {
             CPPUNIT_ASSERT( total_error < 10.0);
 
         }
+#endif
+
+        // Build the pressure matrix as Solver::solvePressure does: fluid in the voxels with j < fluidHeight,
+        // solid walls on the box and air above the fluid; rhs is random in the fluid voxels
+        // returns nz
+        int buildFluidPoisson(int64_t gridDim, int64_t fluidHeight, int *I, int *J, float *val, float *rhs)
+        {
+            int64_t idxI = 0;
+            int64_t idxJ = 0;
+            for(int64_t i = 0; i < gridDim; ++i)
+                for(int64_t j = 0; j < gridDim; ++j)
+                    for(int64_t k = 0; k < gridDim; ++k)
+                    {
+                        rhs[idxI] = 0.0;
+                        I[idxI++] = idxJ;
+                        if (j >= fluidHeight)
+                        {
+                            continue;
+                        }
+
+                        rhs[idxI - 1] = yapfs::getRnd_0_1() - 0.5;
+
+                        if ( i - 1 >= 0 )
+                        {
+                            val[idxJ] = -1;
+                            J[idxJ++] = (i - 1)*gridDim*gridDim + (j)*gridDim + (k);
+                        }
+                        if ( j - 1 >= 0 )
+                        {
+                            val[idxJ] = -1;
+                            J[idxJ++] = (i)*gridDim*gridDim + (j - 1)*gridDim + (k);
+                        }
+                        if ( k - 1 >= 0 )
+                        {
+                            val[idxJ] = -1;
+                            J[idxJ++] = (i)*gridDim*gridDim + (j)*gridDim + (k - 1);
+                        }
+
+                        // Diagonal
+                        LReal omega = 6.0;
+                        if ( i <= 0 )
+                            omega -= 1.0;
+                        if ( i >= gridDim -1 )
+                            omega -= 1.0;
+                        if ( j <= 0 )
+                            omega -= 1.0;
+                        if ( j >= gridDim -1 )
+                            omega -= 1.0;
+                        if ( k <= 0 )
+                            omega -= 1.0;
+                        if ( k >= gridDim -1 )
+                            omega -= 1.0;
+                        val[idxJ] = omega;
+                        J[idxJ++] = (i)*gridDim*gridDim + (j)*gridDim + (k);
+
+                        if ( k + 1 < gridDim )
+                        {
+                            val[idxJ] = -1;
+                            J[idxJ++] = (i)*gridDim*gridDim + (j)*gridDim + (k + 1);
+                        }
+                        if ( (j + 1 < gridDim) && (j + 1 < fluidHeight) )
+                        {
+                            val[idxJ] = -1;
+                            J[idxJ++] = (i)*gridDim*gridDim + (j + 1)*gridDim + (k);
+                        }
+                        if ( i + 1 < gridDim )
+                        {
+                            val[idxJ] = -1;
+                            J[idxJ++] = (i + 1)*gridDim*gridDim + (j)*gridDim + (k);
+                        }
+                    }
+            I[idxI] = idxJ;
+            return idxJ;
+        }
+
+        void testSolverCPU()
+        {
+            printf("\n\n");
+
+            float max_error = 0.0;
+            for(int64_t gridDim = 10; gridDim <= 60; gridDim += 10)
+            {
+                int N = gridDim * gridDim * gridDim;
+                int *I = (int *)malloc(sizeof(int)*(N+1));
+                int *J = (int *)malloc(sizeof(int)*N*7);
+                float *val = (float *)malloc(sizeof(float)*N*7);
+                float *x = (float *)calloc(N, sizeof(float));
+                float *rhs = (float *)malloc(sizeof(float)*N);
+
+                int nz = buildFluidPoisson(gridDim, gridDim / 2, I, J, val, rhs);
+
+                tbb::tick_count t0 = tbb::tick_count::now();
+                float error = yapfs::spareSolverConjugateGradientCPU(I, J, val, N, N, nz, x, rhs);
+                tbb::tick_count t1 = tbb::tick_count::now();
+                L_LOG_INFO("CPU SOLVER " + to_string(gridDim) + "^3 TIME IN MILLIESEC: " + to_string( 1000.0*(t1 - t0).seconds() ) );
+
+                max_error = std::max(max_error, error);
+
+                free(I);
+                free(J);
+                free(val);
+                free(x);
+                free(rhs);
+            }
+
+            CPPUNIT_ASSERT( max_error < 1e-3 );
+
+        }
+
+        // Neighbour masks of the same fluid layout of buildFluidPoisson
+        void buildFluidLaplacian(int64_t gridDim, int64_t fluidHeight, yapfs::LaplacianOperator &laplacian)
+        {
+            for(int64_t i = 0; i < gridDim; ++i)
+                for(int64_t j = 0; j < fluidHeight; ++j)
+                    for(int64_t k = 0; k < gridDim; ++k)
+                    {
+                        const int64_t neighbour[6][3] = { {i-1, j, k}, {i, j-1, k}, {i, j, k-1}, {i, j, k+1}, {i, j+1, k}, {i+1, j, k} };
+                        yapfs::NeighbourMask mask = 0;
+                        for (int dir = 0; dir < 6; dir++)
+                        {
+                            const int64_t *n = neighbour[dir];
+                            if ( (n[0] < 0) || (n[0] >= gridDim) || (n[1] < 0) || (n[1] >= gridDim) || (n[2] < 0) || (n[2] >= gridDim) )
+                                continue;
+                            mask |= yapfs::neighbourNonSolidBit(dir);
+                            if ( n[1] < fluidHeight )
+                                mask |= yapfs::neighbourFluidBit(dir);
+                        }
+                        int row = laplacian.addFluidVoxel(i, j, k);
+                        laplacian.mMask[row] = mask;
+                    }
+        }
+
+        void testLaplacianOperator()
+        {
+            int64_t gridDim = 30;
+            int N = gridDim * gridDim * gridDim;
+            vector<int> I(N+1), J(N*7);
+            vector<float> val(N*7), rhs(N);
+
+            int nz = buildFluidPoisson(gridDim, gridDim / 2, I.data(), J.data(), val.data(), rhs.data());
+
+            yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2, laplacian);
+            int numFluid = laplacian.size();
+            CPPUNIT_ASSERT( numFluid == gridDim * gridDim * (gridDim / 2) );
+
+            // the assembled CSR matrix on the fluid rows is the same of the full box matrix
+            vector<int> laplacianI(numFluid+1), laplacianJ(numFluid*7);
+            vector<float> laplacianVal(numFluid*7);
+            CPPUNIT_ASSERT( laplacian.getNumNonZero() == nz );
+            CPPUNIT_ASSERT( laplacian.toCSR(laplacianI.data(), laplacianJ.data(), laplacianVal.data()) == nz );
+            bool sameMatrix = true;
+            for(int row = 0; row < numFluid; ++row)
+            {
+                int64_t voxel = laplacian.mVoxelOfRow[row];
+                sameMatrix &= (laplacianI[row+1] - laplacianI[row]) == (I[voxel+1] - I[voxel]);
+                for(int idx = 0; sameMatrix && idx < laplacianI[row+1] - laplacianI[row]; ++idx)
+                {
+                    sameMatrix &= laplacian.mVoxelOfRow[ laplacianJ[laplacianI[row] + idx] ] == J[I[voxel] + idx];
+                    sameMatrix &= laplacianVal[laplacianI[row] + idx] == val[I[voxel] + idx];
+                }
+            }
+            CPPUNIT_ASSERT( sameMatrix );
+
+            // matrix-free product is the same of the CSR product
+            yapfs::CSRMatrix A(I.data(), J.data(), val.data(), N, nz);
+            vector<float> y(N), laplacianX(numFluid), laplacianY(numFluid);
+            A.apply(rhs.data(), y.data());
+            for(int row = 0; row < numFluid; ++row)
+            {
+                laplacianX[row] = rhs[laplacian.mVoxelOfRow[row]];
+            }
+            laplacian.apply(laplacianX.data(), laplacianY.data());
+            float maxDiff = 0.0;
+            for(int row = 0; row < numFluid; ++row)
+            {
+                maxDiff = std::max(maxDiff, (float)fabs(y[laplacian.mVoxelOfRow[row]] - laplacianY[row]));
+            }
+            CPPUNIT_ASSERT( maxDiff < 1e-6 );
+
+        }
+
+        void testLaplacianBuild()
+        {
+            // fluid bottom half of a box with some solid voxels
+            int64_t numX = 31, numY = 17, numZ = 23;
+            vector<uint8_t> flags(numX * numY * numZ);
+            for(int64_t i = 0; i < numX; ++i)
+                for(int64_t j = 0; j < numY; ++j)
+                    for(int64_t k = 0; k < numZ; ++k)
+                    {
+                        uint8_t flag = (j < numY / 2) ? (yapfs::VOXEL_FLUID | yapfs::VOXEL_NON_SOLID) : yapfs::VOXEL_NON_SOLID;
+                        flags[(i * numY + j) * numZ + k] = ((i + 2 * j + 3 * k) % 11 == 0) ? 0 : flag;
+                    }
+
+            // parallel build is the same of adding the fluid voxels in i, j, k order
+            yapfs::LaplacianOperator serial(numX, numY, numZ);
+            for(int64_t i = 0; i < numX; ++i)
+                for(int64_t j = 0; j < numY; ++j)
+                    for(int64_t k = 0; k < numZ; ++k)
+                    {
+                        if ( !(flags[(i * numY + j) * numZ + k] & yapfs::VOXEL_FLUID) )
+                            continue;
+                        const int64_t neighbour[6][3] = { {i-1, j, k}, {i, j-1, k}, {i, j, k-1}, {i, j, k+1}, {i, j+1, k}, {i+1, j, k} };
+                        yapfs::NeighbourMask mask = 0;
+                        for (int dir = 0; dir < 6; dir++)
+                        {
+                            const int64_t *n = neighbour[dir];
+                            if ( (n[0] < 0) || (n[0] >= numX) || (n[1] < 0) || (n[1] >= numY) || (n[2] < 0) || (n[2] >= numZ) )
+                                continue;
+                            uint8_t flag = flags[(n[0] * numY + n[1]) * numZ + n[2]];
+                            if (flag & yapfs::VOXEL_FLUID)
+                                mask |= yapfs::neighbourFluidBit(dir);
+                            if (flag & yapfs::VOXEL_NON_SOLID)
+                                mask |= yapfs::neighbourNonSolidBit(dir);
+                        }
+                        int row = serial.addFluidVoxel(i, j, k);
+                        serial.mMask[row] = mask;
+                    }
+
+            yapfs::LaplacianOperator laplacian(numX, numY, numZ);
+            laplacian.build(flags.data());
+            CPPUNIT_ASSERT( laplacian.mVoxelOfRow == serial.mVoxelOfRow );
+            CPPUNIT_ASSERT( laplacian.mRowOfVoxel == serial.mRowOfVoxel );
+            CPPUNIT_ASSERT( laplacian.mMask == serial.mMask );
+
+            // parallel CSR assembly: same product of the matrix-free operator
+            int N = laplacian.size();
+            int nz = laplacian.getNumNonZero();
+            vector<int> I(N+1), J(nz);
+            vector<float> val(nz);
+            CPPUNIT_ASSERT( laplacian.toCSR(I.data(), J.data(), val.data()) == nz );
+            CPPUNIT_ASSERT( I[N] == nz );
+            yapfs::CSRMatrix A(I.data(), J.data(), val.data(), N, nz);
+            vector<float> x(N), y(N), yCSR(N);
+            for(int row = 0; row < N; ++row)
+            {
+                x[row] = yapfs::getRnd_0_1();
+            }
+            laplacian.apply(x.data(), y.data());
+            A.apply(x.data(), yCSR.data());
+            for(int row = 0; row < N; ++row)
+            {
+                CPPUNIT_ASSERT( fabs(y[row] - yCSR[row]) < 1e-5 );
+            }
+        }
+
+        void testRowOrdering()
+        {
+            int64_t gridDim = 24;
+            yapfs::LaplacianOperator lexicographic(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim * 3 / 4, lexicographic);
+            int N = lexicographic.size();
+
+            // rhs of each voxel, the same in all the orderings
+            vector<float> voxelRhs(gridDim * gridDim * gridDim);
+            for(size_t voxel = 0; voxel < voxelRhs.size(); ++voxel)
+            {
+                voxelRhs[voxel] = yapfs::getRnd_0_1() - 0.5;
+            }
+
+            yapfs::RowOrdering orderings[3] = { yapfs::ROW_ORDER_LEXICOGRAPHIC, yapfs::ROW_ORDER_MORTON, yapfs::ROW_ORDER_RCM };
+            vector<float> voxelX[3];
+            for (int idx = 0; idx < 3; idx++)
+            {
+                yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+                buildFluidLaplacian(gridDim, gridDim * 3 / 4, laplacian);
+                laplacian.reorder(orderings[idx]);
+                CPPUNIT_ASSERT( laplacian.size() == N );
+
+                // CSR columns sorted, symmetric CSR product equal to the matrix-free one
+                int nz = laplacian.getNumNonZero();
+                vector<int> I(N+1), J(nz);
+                vector<float> val(nz);
+                laplacian.toCSR(I.data(), J.data(), val.data());
+                bool sorted = true;
+                for(int row = 0; row < N; ++row)
+                {
+                    CPPUNIT_ASSERT( laplacian.mRowOfVoxel[laplacian.mVoxelOfRow[row]] == row );
+                    for(int idxJ = I[row] + 1; idxJ < I[row+1]; ++idxJ)
+                    {
+                        sorted &= J[idxJ - 1] < J[idxJ];
+                    }
+                }
+                CPPUNIT_ASSERT( sorted );
+
+                vector<float> rhs(N), y(N), ySymmetric(N);
+                for(int row = 0; row < N; ++row)
+                {
+                    rhs[row] = voxelRhs[laplacian.mVoxelOfRow[row]];
+                }
+                yapfs::SymmetricCSRMatrix symmetric;
+                laplacian.toSymmetricCSR(symmetric);
+                laplacian.apply(rhs.data(), y.data());
+                symmetric.apply(rhs.data(), ySymmetric.data());
+                for(int row = 0; row < N; ++row)
+                {
+                    CPPUNIT_ASSERT( fabs(y[row] - ySymmetric[row]) < 1e-5 );
+                }
+
+                // the sequential MIC(0) sweeps in a valid order for rcm too
+                yapfs::MICPreconditioner mic(laplacian, false);
+                vector<float> x(N, 0.0f);
+                float residual;
+                int iterations = yapfs::conjugateGradientCPU(laplacian, &mic, x.data(), rhs.data(), 1e-5f, 10000, residual);
+                L_LOG_INFO("Ordering " + to_string(idx) + " MIC(0) iterations: " + to_string(iterations));
+                CPPUNIT_ASSERT( residual < 1e-5 );
+
+                voxelX[idx].assign(voxelRhs.size(), 0.0f);
+                for(int row = 0; row < N; ++row)
+                {
+                    voxelX[idx][laplacian.mVoxelOfRow[row]] = x[row];
+                }
+            }
+
+            // same pressure in every voxel
+            for(size_t voxel = 0; voxel < voxelRhs.size(); ++voxel)
+            {
+                CPPUNIT_ASSERT( fabs(voxelX[1][voxel] - voxelX[0][voxel]) < 1e-3 );
+                CPPUNIT_ASSERT( fabs(voxelX[2][voxel] - voxelX[0][voxel]) < 1e-3 );
+            }
+        }
+
+        void testSymmetricCSR()
+        {
+            int64_t gridDim = 30;
+            int N = gridDim * gridDim * gridDim;
+            vector<int> I(N+1), J(N*7);
+            vector<float> val(N*7), x(N), y(N), ySymmetric(N);
+
+            int nz = buildFluidPoisson(gridDim, gridDim / 2, I.data(), J.data(), val.data(), x.data());
+            yapfs::CSRMatrix A(I.data(), J.data(), val.data(), N, nz);
+            yapfs::SymmetricCSRMatrix symmetricA;
+            symmetricA.assemble(A);
+
+            // upper triangle: the diagonal and half of the off diagonal values
+            int numDiagonal = 0;
+            for(int i = 0; i < N; ++i)
+            {
+                numDiagonal += (I[i+1] > I[i]) ? 1 : 0;
+            }
+            CPPUNIT_ASSERT( symmetricA.getNumNonZero() == (nz + numDiagonal) / 2 );
+            CPPUNIT_ASSERT( symmetricA.mBlockStart.size() > 2 );
+
+            A.apply(x.data(), y.data());
+            symmetricA.apply(x.data(), ySymmetric.data());
+            float maxDiff = 0.0;
+            for(int i = 0; i < N; ++i)
+            {
+                maxDiff = std::max(maxDiff, (float)fabs(y[i] - ySymmetric[i]));
+            }
+            CPPUNIT_ASSERT( maxDiff < 1e-5 );
+
+            // the upper triangle assembled from the neighbour masks gives the same product of the matrix-free operator
+            yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2, laplacian);
+            yapfs::SymmetricCSRMatrix symmetricLaplacian;
+            laplacian.toSymmetricCSR(symmetricLaplacian);
+            int numFluid = laplacian.size();
+            vector<float> laplacianX(numFluid), laplacianY(numFluid), symmetricY(numFluid);
+            for(int row = 0; row < numFluid; ++row)
+            {
+                laplacianX[row] = x[laplacian.mVoxelOfRow[row]];
+            }
+            laplacian.apply(laplacianX.data(), laplacianY.data());
+            symmetricLaplacian.apply(laplacianX.data(), symmetricY.data());
+            maxDiff = 0.0;
+            for(int row = 0; row < numFluid; ++row)
+            {
+                maxDiff = std::max(maxDiff, (float)fabs(laplacianY[row] - symmetricY[row]));
+            }
+            CPPUNIT_ASSERT( maxDiff < 1e-5 );
+        }
+
+        void testSellCSMatrix()
+        {
+            int64_t gridDim = 30;
+            int N = gridDim * gridDim * gridDim;
+            vector<int> I(N+1), J(N*7);
+            vector<float> val(N*7), x(N), y(N), ySell(N), d(N), dSell(N);
+
+            // half full box: rows of different lengths and empty rows
+            int nz = buildFluidPoisson(gridDim, gridDim / 2, I.data(), J.data(), val.data(), x.data());
+            yapfs::CSRMatrix A(I.data(), J.data(), val.data(), N, nz);
+            yapfs::SellCSMatrix sellA;
+            sellA.assemble(A, 100);
+            CPPUNIT_ASSERT( sellA.size() == N );
+            CPPUNIT_ASSERT( sellA.getNumStored() >= nz );
+            CPPUNIT_ASSERT( sellA.getNumStored() % SELL_SLICE_SIZE == 0 );
+
+            A.apply(x.data(), y.data());
+            sellA.apply(x.data(), ySell.data());
+            float maxDiff = 0.0;
+            for(int i = 0; i < N; ++i)
+            {
+                maxDiff = std::max(maxDiff, (float)fabs(y[i] - ySell[i]));
+            }
+            CPPUNIT_ASSERT( maxDiff < 1e-5 );
+
+            vector<double> xDouble(x.begin(), x.end()), yDouble(N);
+            sellA.apply(xDouble.data(), yDouble.data());
+            double maxDiffDouble = 0.0;
+            for(int i = 0; i < N; ++i)
+            {
+                maxDiffDouble = std::max(maxDiffDouble, fabs(y[i] - yDouble[i]));
+            }
+            CPPUNIT_ASSERT( maxDiffDouble < 1e-4 );
+
+            A.diagonal(d.data());
+            sellA.diagonal(dSell.data());
+            CPPUNIT_ASSERT( d == dSell );
+
+            // the solver gets the same solution of the CSR matrix
+            vector<float> xSolve(N, 0.0f), xSellSolve(N, 0.0f), rhs(x);
+            yapfs::spareSolverConjugateGradientCPU(A, xSolve.data(), rhs.data());
+            yapfs::spareSolverConjugateGradientCPU(sellA, xSellSolve.data(), rhs.data());
+            maxDiff = 0.0;
+            for(int i = 0; i < N; ++i)
+            {
+                maxDiff = std::max(maxDiff, (float)fabs(xSolve[i] - xSellSolve[i]));
+            }
+            CPPUNIT_ASSERT( maxDiff < 1e-3 );
+        }
+
+        void testMICPreconditioner()
+        {
+            int64_t gridDim = 40;
+            yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim - 2, laplacian);
+            int N = laplacian.size();
+
+            vector<float> rhs(N);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+
+            yapfs::JacobiPreconditioner jacobi(laplacian);
+            yapfs::MICPreconditioner micSerial(laplacian, false);
+            yapfs::MICPreconditioner micParallel(laplacian, true);
+
+            // level scheduling gives the same preconditioner of the sequential sweep
+            vector<float> zSerial(N), zParallel(N);
+            micSerial.apply(rhs.data(), zSerial.data());
+            micParallel.apply(rhs.data(), zParallel.data());
+            float maxDiff = 0.0;
+            for(int row = 0; row < N; ++row)
+            {
+                maxDiff = std::max(maxDiff, (float)fabs(zSerial[row] - zParallel[row]));
+            }
+            CPPUNIT_ASSERT( maxDiff < 1e-5 );
+
+            float residual;
+            vector<float> x(N, 0.0f);
+            int jacobiIterations = yapfs::conjugateGradientCPU(laplacian, &jacobi, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            CPPUNIT_ASSERT( residual < 1e-4 );
+            std::fill(x.begin(), x.end(), 0.0f);
+            int micIterations = yapfs::conjugateGradientCPU(laplacian, &micParallel, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            CPPUNIT_ASSERT( residual < 1e-4 );
+            L_LOG_INFO("Iterations Jacobi: " + to_string(jacobiIterations) + " MIC(0): " + to_string(micIterations));
+
+            CPPUNIT_ASSERT( 2 * micIterations < jacobiIterations );
+
+        }
+
+        void testSingleReductionCG()
+        {
+            int64_t gridDim = 40;
+            yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim - 2, laplacian);
+            int N = laplacian.size();
+
+            vector<float> rhs(N), Ax(N);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+
+            yapfs::JacobiPreconditioner jacobi(laplacian);
+            yapfs::MICPreconditioner mic(laplacian, true);
+            yapfs::Preconditioner *preconditioners[2] = { &jacobi, &mic };
+            for (int idx = 0; idx < 2; idx++)
+            {
+                float residual, singleResidual;
+                vector<float> x(N, 0.0f), xSingle(N, 0.0f);
+                int iterations = yapfs::conjugateGradientCPU(laplacian, preconditioners[idx], x.data(), rhs.data(), 1e-5f, 10000, residual);
+                int singleIterations = yapfs::singleReductionConjugateGradientCPU(laplacian, preconditioners[idx], xSingle.data(), rhs.data(), 1e-5f, 10000, singleResidual);
+                L_LOG_INFO("Iterations CG: " + to_string(iterations) + " single reduction CG: " + to_string(singleIterations));
+
+                // same Krylov space: the iterations can differ only by the rounding of the recurrences
+                CPPUNIT_ASSERT( singleResidual < 1e-4 );
+                CPPUNIT_ASSERT( abs(singleIterations - iterations) <= iterations / 10 + 2 );
+
+                // the recurrence residual is close to the true one
+                laplacian.apply(xSingle.data(), Ax.data());
+                double trueResidual = 0.0;
+                for(int row = 0; row < N; ++row)
+                {
+                    trueResidual += (double)(rhs[row] - Ax[row]) * (rhs[row] - Ax[row]);
+                }
+                CPPUNIT_ASSERT( sqrt(trueResidual) < 1e-3 );
+            }
+        }
+
+        // returns the iterations of the conjugate gradient with multigrid preconditioner
+        int runMultigrid(int64_t gridDim)
+        {
+            yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim * 3 / 4, laplacian);
+            int N = laplacian.size();
+
+            vector<float> rhs(N), x(N, 0.0f);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+
+            yapfs::MultigridPreconditioner multigrid(laplacian);
+            float residual;
+            int iterations = yapfs::conjugateGradientCPU(laplacian, &multigrid, x.data(), rhs.data(), 1e-4f, 10000, residual);
+            CPPUNIT_ASSERT( residual < 1e-4 );
+            L_LOG_INFO("Multigrid iterations on grid " + to_string(gridDim) + "^3: " + to_string(iterations));
+            return iterations;
+        }
+
+        void testMultigridPreconditioner()
+        {
+            int coarseIterations = runMultigrid(16);
+            int fineIterations = runMultigrid(64);
+
+            // iterations almost independent of the resolution
+            CPPUNIT_ASSERT( fineIterations <= 2 * coarseIterations );
+        }
+
+        void testPreconditionerUpdate()
+        {
+            int64_t gridDim = 40;
+            yapfs::SolverContext context;
+
+            context.reset(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2, context.mLaplacian);
+            context.compareTopology();
+            CPPUNIT_ASSERT( context.mTopologyChanged );
+            context.setPreconditioner(new yapfs::MICPreconditioner(context.mLaplacian, true));
+
+            // same fluid voxels: nothing to update
+            context.reset(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2, context.mLaplacian);
+            context.compareTopology();
+            CPPUNIT_ASSERT( !context.mTopologyChanged );
+
+            // one more layer of fluid: the new rows and the rows of the previous surface change
+            context.reset(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2 + 1, context.mLaplacian);
+            context.compareTopology();
+            CPPUNIT_ASSERT( context.mTopologyChanged );
+            CPPUNIT_ASSERT( context.mChangedRows.size() == 2 * gridDim * gridDim );
+            yapfs::Preconditioner *precond = context.mPreconditioner;
+            yapfs::PreconditionerFactory createMIC = [](const yapfs::LaplacianOperator &A) -> yapfs::Preconditioner * { return new yapfs::MICPreconditioner(A, true); };
+            CPPUNIT_ASSERT( context.getPreconditioner(createMIC, 0.1) == precond );
+            CPPUNIT_ASSERT( context.mNumUpdatedRows == 2 * gridDim * gridDim );
+            // the change is applied once, a second call in the same step reuses the updated preconditioner
+            CPPUNIT_ASSERT( !context.mTopologyChanged && context.mChangedRows.empty() );
+            CPPUNIT_ASSERT( context.getPreconditioner(createMIC, 0.1) == precond );
+            CPPUNIT_ASSERT( context.mNumUpdatedRows == 2 * gridDim * gridDim );
+
+            int N = context.mLaplacian.size();
+            vector<float> rhs(N), x(N, 0.0f);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+
+            float residual;
+            int updatedIterations = yapfs::conjugateGradientCPU(context.mLaplacian, context.mPreconditioner, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            CPPUNIT_ASSERT( residual < 1e-4 );
+            yapfs::MICPreconditioner mic(context.mLaplacian, true);
+            std::fill(x.begin(), x.end(), 0.0f);
+            int builtIterations = yapfs::conjugateGradientCPU(context.mLaplacian, &mic, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            L_LOG_INFO("Iterations MIC(0) updated: " + to_string(updatedIterations) + " built: " + to_string(builtIterations));
+
+            CPPUNIT_ASSERT( updatedIterations <= builtIterations + 2 );
+        }
+
+        // A step whose solve is skipped doesn't apply its change to the preconditioner: the next step with
+        // the same fluid voxels must still update it from the topology it was built on
+        void testPreconditionerSkippedStep()
+        {
+            int64_t gridDim = 30;
+            yapfs::SolverContext context;
+            yapfs::PreconditionerFactory createMIC = [](const yapfs::LaplacianOperator &A) -> yapfs::Preconditioner * { return new yapfs::MICPreconditioner(A, true); };
+
+            context.reset(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2, context.mLaplacian);
+            context.compareTopology();
+            yapfs::Preconditioner *precond = context.getPreconditioner(createMIC, 0.5);
+
+            // three more layers of fluid, the solve is skipped
+            context.reset(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2 + 3, context.mLaplacian);
+            context.compareTopology();
+            CPPUNIT_ASSERT( context.mTopologyChanged );
+
+            // same fluid voxels of the skipped step, changed for the preconditioner
+            context.reset(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2 + 3, context.mLaplacian);
+            context.compareTopology();
+            CPPUNIT_ASSERT( context.mTopologyChanged );
+            CPPUNIT_ASSERT( context.mChangedRows.size() == 4 * gridDim * gridDim );
+            CPPUNIT_ASSERT( context.getPreconditioner(createMIC, 0.5) == precond );
+            CPPUNIT_ASSERT( context.mNumUpdatedRows == 4 * gridDim * gridDim );
+
+            int N = context.mLaplacian.size();
+            vector<float> rhs(N), x(N, 0.0f);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+
+            float residual;
+            yapfs::conjugateGradientCPU(context.mLaplacian, precond, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            CPPUNIT_ASSERT( residual < 1e-4 );
+        }
+
+        template<typename T>
+        void setConfig(const std::string &name, const T &value)
+        {
+            boost::program_options::variables_map &configs = yapfs::getConfigVariablesMap();
+            configs.erase(name);
+            configs.insert(std::make_pair(name, boost::program_options::variable_value(value, false)));
+        }
+
+        // Solver box with solid walls on its border: fluid in the voxels with j < fluidHeight and air above,
+        // random velocities on the faces between two fluid voxels when moving, at rest otherwise
+        void setFluid(yapfs::Solver &solver, int64_t fluidHeight, bool moving)
+        {
+            openvdb::Vec3i minN = solver.mMinN;
+            openvdb::Vec3i maxN = solver.mMaxN;
+            solver.mGTypeVoxel->clear();
+            for(int64_t i = minN.x(); i < maxN.x(); ++i)
+                for(int64_t j = minN.y(); j < maxN.y(); ++j)
+                    for(int64_t k = minN.z(); k < maxN.z(); ++k)
+                    {
+                        bool wall = (i == minN.x()) || (j == minN.y()) || (k == minN.z()) ||
+                            (i == maxN.x() - 1) || (j == maxN.y() - 1) || (k == maxN.z() - 1);
+                        int32_t type = (j - minN.y() < fluidHeight) ? yapfs::VoxelType::FLUID : yapfs::VoxelType::AIR;
+                        solver.mGTypeVoxel->setValue(wall ? yapfs::VoxelType::SOLID : type, i, j, k);
+                    }
+
+            for (int c = 0; c < 3; ++c)
+            {
+                openvdb::Vec3i offset(c == 0, c == 1, c == 2);
+                solver.mGVel->getFace(c)->clear();
+                for(int64_t i = minN.x(); (i < maxN.x()) && moving; ++i)
+                    for(int64_t j = minN.y(); j < maxN.y(); ++j)
+                        for(int64_t k = minN.z(); k < maxN.z(); ++k)
+                        {
+                            if ( (solver.mGTypeVoxel->getValue(i, j, k) == yapfs::VoxelType::FLUID) &&
+                                 (solver.mGTypeVoxel->getValue(i - offset.x(), j - offset.y(), k - offset.z()) == yapfs::VoxelType::FLUID) )
+                            {
+                                solver.mGVel->getFace(c)->setValue(yapfs::getRnd_0_1() - 0.5, i, j, k);
+                            }
+                        }
+            }
+        }
+
+        // A step already divergence free skips the solve and leaves its change of the fluid to the next
+        // solve: the preconditioner of the solved step must be updated by the next one, with the same fluid
+        void testSkippedPressureSolve()
+        {
+            boost::program_options::variables_map savedConfigs = yapfs::getConfigVariablesMap();
+            int64_t gridDim = 16;
+            setConfig("gravity", (LReal)9.81);
+            setConfig("voxel_size", (LReal)0.1);
+            setConfig("min_x", (LReal)0.0);
+            setConfig("min_y", (LReal)0.0);
+            setConfig("min_z", (LReal)0.0);
+            setConfig("max_x", (LReal)(0.1 * gridDim));
+            setConfig("max_y", (LReal)(0.1 * gridDim));
+            setConfig("max_z", (LReal)(0.1 * gridDim));
+            setConfig("frames_per_sec", (uint32_t)24);
+            setConfig("num_frames", (uint32_t)1);
+            setConfig("pressure_solver", std::string("cpu"));
+            setConfig("pressure_preconditioner", std::string("mic"));
+            setConfig("pressure_warm_start", false);
+            setConfig("pressure_refactor_threshold", (LReal)0.5);
+            setConfig("pressure_precision", std::string("float"));
+            setConfig("pressure_relaxation_omega", (LReal)0.0);
+            setConfig("pressure_relaxation_sweeps", (uint32_t)200);
+            setConfig("pressure_relaxation_tol", (LReal)0.0);
+            setConfig("pressure_cg", std::string("standard"));
+            setConfig("pressure_operator", std::string("matrix_free"));
+            setConfig("pressure_ordering", std::string("lexicographic"));
+            setConfig("pressure_components", false);
+            setConfig("pressure_refinement_tol", (LReal)1e-10);
+            setConfig("pressure_verify", false);
+            setConfig("pressure_tol_relative", (LReal)1e-6);
+            setConfig("pressure_tol_divergence", (LReal)1e-4);
+            setConfig("pressure_max_iterations", (uint32_t)10000);
+            setConfig("pressure_metrics_file", std::string(""));
+
+            {
+                yapfs::Solver solver;
+                yapfs::SolverContext *context = solver.mSolverContext;
+
+                setFluid(solver, gridDim / 2, true);
+                solver.solvePressure();
+                yapfs::Preconditioner *precond = context->mPreconditioner;
+                CPPUNIT_ASSERT( precond != NULL );
+
+                // more fluid at rest: nothing to solve, the change stays pending
+                setFluid(solver, gridDim / 2 + 3, false);
+                solver.solvePressure();
+                CPPUNIT_ASSERT( context->mTopologyChanged );
+                CPPUNIT_ASSERT( context->mPreconditioner == precond );
+
+                // same fluid voxels moving: the preconditioner is updated from its own topology
+                setFluid(solver, gridDim / 2 + 3, true);
+                LReal initialDivergence = solver.getMaxDivergence();
+                solver.solvePressure();
+                CPPUNIT_ASSERT( !context->mTopologyChanged );
+                CPPUNIT_ASSERT( context->mPreconditioner == precond );
+                CPPUNIT_ASSERT( context->mNumUpdatedRows == 4 * (gridDim - 2) * (gridDim - 2) );
+                CPPUNIT_ASSERT( solver.getMaxDivergence() <= 1e-2 * initialDivergence );
+            }
+
+            yapfs::getConfigVariablesMap() = savedConfigs;
+        }
+
+        void testMixedPrecision()
+        {
+            int64_t gridDim = 30;
+            yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2, laplacian);
+            int N = laplacian.size();
+
+            vector<double> rhs(N), x(N, 0.0), r(N);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+            double rhsNorm = sqrt(yapfs::cpuDot(rhs.data(), rhs.data(), N));
+
+            yapfs::MICPreconditioner mic(laplacian, true);
+            vector<float> d(N), rhsFloat(N);
+            int iterations;
+            double residual;
+            int refinements = yapfs::iterativeRefinementCPU(laplacian,
+                [&](float *x, float *b) -> int
+                {
+                    float floatResidual;
+                    return yapfs::conjugateGradientCPU(laplacian, &mic, x, b, 1e-5f, 10000, floatResidual);
+                },
+                x.data(), rhs.data(), 1e-10, 8, d.data(), rhsFloat.data(), r.data(), iterations, residual);
+            L_LOG_INFO("Mixed precision: refinements " + to_string(refinements) + " iterations " + to_string(iterations) + " residual " + to_string(residual / rhsNorm));
+
+            // double precision residual, far below the float limit of the single solve
+            CPPUNIT_ASSERT( residual <= 1e-10 * rhsNorm );
+            CPPUNIT_ASSERT( fabs(yapfs::cpuResidual(laplacian, x.data(), rhs.data(), r.data()) - residual) <= 1e-12 * rhsNorm );
+            CPPUNIT_ASSERT( refinements <= 4 );
+        }
+
+        // Mixed precision steps as Solver::solvePressureMixed: every refinement asks the context for the
+        // preconditioner, the change of the fluid between the steps is applied to it only in the first one
+        void runMixedPrecisionSteps(yapfs::PreconditionerFactory createPreconditioner)
+        {
+            int64_t gridDim = 30;
+            int64_t fluidHeights[3] = { gridDim / 2, gridDim / 2 - 2, gridDim / 2 + 1 }; // shrinks, then grows
+            yapfs::SolverContext context;
+            int numUpdatedRows = 0;
+            for (int step = 0; step < 3; ++step)
+            {
+                context.reset(gridDim, gridDim, gridDim);
+                buildFluidLaplacian(gridDim, fluidHeights[step], context.mLaplacian);
+                context.compareTopology();
+                numUpdatedRows += (step > 0) ? (int)context.mChangedRows.size() : 0;
+                int N = context.mLaplacian.size();
+
+                vector<double> rhs(N), x(N, 0.0), r(N);
+                for(int row = 0; row < N; ++row)
+                {
+                    rhs[row] = yapfs::getRnd_0_1() - 0.5;
+                }
+                double rhsNorm = sqrt(yapfs::cpuDot(rhs.data(), rhs.data(), N));
+                vector<float> d(N), rhsFloat(N);
+                int iterations;
+                double residual;
+                int refinements = yapfs::iterativeRefinementCPU(context.mLaplacian,
+                    [&](float *x, float *b) -> int
+                    {
+                        float floatResidual;
+                        yapfs::Preconditioner *precond = context.getPreconditioner(createPreconditioner, 0.5);
+                        return yapfs::conjugateGradientCPU(context.mLaplacian, precond, x, b, 1e-5f, 10000, floatResidual);
+                    },
+                    x.data(), rhs.data(), 1e-10, 8, d.data(), rhsFloat.data(), r.data(), iterations, residual);
+
+                CPPUNIT_ASSERT( refinements > 1 );
+                CPPUNIT_ASSERT( residual <= 1e-10 * rhsNorm );
+                CPPUNIT_ASSERT( context.mNumUpdatedRows == numUpdatedRows );
+            }
+        }
+
+        void testMixedPrecisionSteps()
+        {
+            runMixedPrecisionSteps([](const yapfs::LaplacianOperator &A) -> yapfs::Preconditioner * { return new yapfs::MICPreconditioner(A, true); });
+            runMixedPrecisionSteps([](const yapfs::LaplacianOperator &A) -> yapfs::Preconditioner * { return new yapfs::AMGPreconditioner(A); });
+        }
+
+        void testRelaxationSolver()
+        {
+            int64_t gridDim = 30;
+            yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim - 2, laplacian);
+            int N = laplacian.size();
+
+            vector<float> rhs(N);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+            float rhsNorm = sqrt(yapfs::cpuDot(rhs.data(), rhs.data(), N));
+
+            yapfs::RelaxationSolver sor(laplacian, yapfs::RELAXATION_SOR, RELAXATION_SOR_OMEGA);
+            yapfs::RelaxationSolver jacobi(laplacian, yapfs::RELAXATION_JACOBI, RELAXATION_JACOBI_OMEGA);
+            CPPUNIT_ASSERT( (int)(sor.mColorRows[0].size() + sor.mColorRows[1].size()) == N );
+
+            // fixed budget: all the sweeps are done
+            float sorResidual, jacobiResidual;
+            vector<float> xSor(N, 0.0f), xJacobi(N, 0.0f);
+            CPPUNIT_ASSERT( sor.solve(xSor.data(), rhs.data(), 0.0f, 500, sorResidual) == 500 );
+            CPPUNIT_ASSERT( jacobi.solve(xJacobi.data(), rhs.data(), 0.0f, 500, jacobiResidual) == 500 );
+            L_LOG_INFO("Relaxation residual after 500 sweeps: SOR " + to_string(sorResidual / rhsNorm) + " Jacobi " + to_string(jacobiResidual / rhsNorm));
+            CPPUNIT_ASSERT( jacobiResidual < 0.1f * rhsNorm );
+            CPPUNIT_ASSERT( sorResidual < 0.5f * jacobiResidual );
+
+            // residual budget: stops at the first check under the tolerance
+            float tol = 1e-3f * rhsNorm;
+            std::fill(xSor.begin(), xSor.end(), 0.0f);
+            int sweeps = sor.solve(xSor.data(), rhs.data(), tol, 10000, sorResidual);
+            CPPUNIT_ASSERT( sweeps < 10000 );
+            CPPUNIT_ASSERT( sweeps % RELAXATION_CHECK_INTERVAL == 0 );
+            CPPUNIT_ASSERT( sorResidual <= tol );
+        }
+
+        void testSolverStats()
+        {
+            int64_t gridDim = 30;
+            yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim - 2, laplacian);
+            int N = laplacian.size();
+
+            vector<float> rhs(N), x(N, 0.0f);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+
+            yapfs::SolverStats stats;
+            float err = yapfs::spareSolverConjugateGradientCPU(laplacian, x.data(), rhs.data(), NULL, &stats);
+            CPPUNIT_ASSERT( stats.mSolver == "cpu" );
+            CPPUNIT_ASSERT( stats.mN == N );
+            CPPUNIT_ASSERT( stats.mStopReason == yapfs::SOLVER_CONVERGED );
+            CPPUNIT_ASSERT( (int)stats.mResidualHistory.size() == stats.mIterations + 1 );
+            CPPUNIT_ASSERT( stats.mResidualHistory.front() == (float)stats.mInitialResidual );
+            CPPUNIT_ASSERT( stats.mResidualHistory.back() == (float)stats.mFinalResidual );
+            CPPUNIT_ASSERT( stats.mFinalResidual < 1e-4 );
+            CPPUNIT_ASSERT( (stats.mError >= 0.0f) && (stats.mError == err) );
+
+            // zero rhs from x = 0: nothing to do, and no verification
+            std::fill(x.begin(), x.end(), 0.0f);
+            std::fill(rhs.begin(), rhs.end(), 0.0f);
+            stats.reset();
+            err = yapfs::spareSolverConjugateGradientCPU(laplacian, x.data(), rhs.data(), NULL, &stats, NULL, false, false);
+            CPPUNIT_ASSERT( stats.mStopReason == yapfs::SOLVER_CONVERGED_INITIAL );
+            CPPUNIT_ASSERT( stats.mIterations == 0 );
+            CPPUNIT_ASSERT( stats.mError < 0.0f );
+            CPPUNIT_ASSERT( err == stats.mError );
+        }
+
+        void testRelativeTolerance()
+        {
+            int64_t gridDim = 30;
+            yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim - 2, laplacian);
+            int N = laplacian.size();
+
+            vector<float> rhs(N), rhsSmall(N);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+                rhsSmall[row] = 1e-3f * rhs[row];
+            }
+
+            // relative: the same iterations whatever the scale of the divergence
+            yapfs::SolverTolerance relative(1e-4f, 0.0f, 10000);
+            yapfs::SolverStats stats, statsSmall;
+            vector<float> x(N, 0.0f), xSmall(N, 0.0f);
+            yapfs::spareSolverConjugateGradientCPU(laplacian, x.data(), rhs.data(), NULL, &stats, NULL, false, false, relative);
+            yapfs::spareSolverConjugateGradientCPU(laplacian, xSmall.data(), rhsSmall.data(), NULL, &statsSmall, NULL, false, false, relative);
+            L_LOG_INFO("Relative tolerance iterations: " + to_string(stats.mIterations) + " small rhs: " + to_string(statsSmall.mIterations));
+            CPPUNIT_ASSERT( stats.mStopReason == yapfs::SOLVER_CONVERGED );
+            CPPUNIT_ASSERT( abs(stats.mIterations - statsSmall.mIterations) <= 2 );
+            CPPUNIT_ASSERT( statsSmall.mFinalResidual <= 1e-4 * sqrt(yapfs::cpuDot(rhsSmall.data(), rhsSmall.data(), N)) );
+
+            // the absolute floor stops the small rhs earlier
+            yapfs::SolverTolerance withFloor(1e-4f, 1e-2f * (float)stats.mFinalResidual, 10000);
+            statsSmall.reset();
+            std::fill(xSmall.begin(), xSmall.end(), 0.0f);
+            yapfs::spareSolverConjugateGradientCPU(laplacian, xSmall.data(), rhsSmall.data(), NULL, &statsSmall, NULL, false, false, withFloor);
+            CPPUNIT_ASSERT( statsSmall.mIterations < stats.mIterations );
+
+            // iteration budget
+            yapfs::SolverTolerance budget(0.0f, 0.0f, 20);
+            stats.reset();
+            std::fill(x.begin(), x.end(), 0.0f);
+            yapfs::spareSolverConjugateGradientCPU(laplacian, x.data(), rhs.data(), NULL, &stats, NULL, false, false, budget);
+            CPPUNIT_ASSERT( stats.mStopReason == yapfs::SOLVER_MAX_ITERATIONS );
+            CPPUNIT_ASSERT( stats.mIterations == 20 );
+        }
+
+        void testDCTPreconditioner()
+        {
+            // orthonormal DCT-II against the direct sum, power of two and Bluestein lengths
+            int lengths[4] = { 1, 7, 16, 30 };
+            for (int idx = 0; idx < 4; idx++)
+            {
+                int n = lengths[idx];
+                yapfs::DCTPlan plan(n);
+                vector<std::complex<double> > work(plan.getWorkSize());
+                vector<double> x(n), y(n);
+                for (int m = 0; m < n; m++)
+                {
+                    x[m] = y[m] = yapfs::getRnd_0_1();
+                }
+                plan.forward(y.data(), 1, work.data());
+                for (int k = 0; k < n; k++)
+                {
+                    double sum = 0.0;
+                    for (int m = 0; m < n; m++)
+                    {
+                        sum += x[m] * cos(M_PI * (m + 0.5) * k / n);
+                    }
+                    CPPUNIT_ASSERT( fabs(sum * sqrt((k == 0 ? 1.0 : 2.0) / n) - y[k]) < 1e-10 );
+                }
+                plan.inverse(y.data(), 1, work.data());
+                for (int m = 0; m < n; m++)
+                {
+                    CPPUNIT_ASSERT( fabs(x[m] - y[m]) < 1e-10 );
+                }
+            }
+
+            // closed box full of fluid: direct solve
+            int64_t gridDim = 20;
+            yapfs::LaplacianOperator closed(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim, closed);
+            int N = closed.size();
+            yapfs::DCTPreconditioner closedDCT(closed);
+            CPPUNIT_ASSERT( closedDCT.isExact() );
+            vector<float> rhs(N), x(N, 0.0f);
+            double mean = 0.0;
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+                mean += rhs[row];
+            }
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] -= mean / N;
+            }
+            float residual;
+            int iterations = yapfs::conjugateGradientCPU(closed, &closedDCT, x.data(), rhs.data(), 1e-4f, 1000, residual);
+            CPPUNIT_ASSERT( iterations <= 2 );
+            CPPUNIT_ASSERT( residual < 1e-4 );
+
+            // tank with air on top: fewer iterations than jacobi
+            yapfs::LaplacianOperator tank(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim * 3 / 4, tank);
+            N = tank.size();
+            rhs.resize(N);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+            yapfs::DCTPreconditioner tankDCT(tank);
+            yapfs::JacobiPreconditioner jacobi(tank);
+            CPPUNIT_ASSERT( !tankDCT.isExact() );
+            x.assign(N, 0.0f);
+            int iterationsDCT = yapfs::conjugateGradientCPU(tank, &tankDCT, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            CPPUNIT_ASSERT( residual < 1e-5 );
+            x.assign(N, 0.0f);
+            int iterationsJacobi = yapfs::conjugateGradientCPU(tank, &jacobi, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            L_LOG_INFO("DCT iterations: " + to_string(iterationsDCT) + " jacobi: " + to_string(iterationsJacobi));
+            CPPUNIT_ASSERT( iterationsDCT < iterationsJacobi );
+        }
+
+        void testAMGPreconditioner()
+        {
+            // splash: a pool and blocks of droplets, many disconnected components
+            int64_t gridDim = 32;
+            vector<uint8_t> flags(gridDim * gridDim * gridDim);
+            for(int64_t i = 0; i < gridDim; ++i)
+                for(int64_t j = 0; j < gridDim; ++j)
+                    for(int64_t k = 0; k < gridDim; ++k)
+                    {
+                        bool fluid = (j < gridDim / 8) || ( ((i/3 + j/3 + k/3) % 2 == 0) && (yapfs::getRnd_0_1() < 0.8) );
+                        flags[(i*gridDim + j)*gridDim + k] = fluid ? (yapfs::VOXEL_FLUID | yapfs::VOXEL_NON_SOLID) : yapfs::VOXEL_NON_SOLID;
+                    }
+            yapfs::LaplacianOperator splash(gridDim, gridDim, gridDim);
+            splash.build(flags.data());
+            int N = splash.size();
+            vector<float> rhs(N), x(N, 0.0f);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+
+            yapfs::AMGPreconditioner amg(splash);
+            yapfs::MICPreconditioner mic(splash, true);
+            CPPUNIT_ASSERT( amg.getNumLevels() > 1 );
+            CPPUNIT_ASSERT( amg.getOperatorComplexity() < 2.0f );
+            float residual;
+            int iterationsAMG = yapfs::conjugateGradientCPU(splash, &amg, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            CPPUNIT_ASSERT( residual < 1e-5 );
+            x.assign(N, 0.0f);
+            int iterationsMIC = yapfs::conjugateGradientCPU(splash, &mic, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            L_LOG_INFO("AMG levels: " + to_string(amg.getNumLevels()) + " iterations: " + to_string(iterationsAMG) + " mic: " + to_string(iterationsMIC));
+            CPPUNIT_ASSERT( iterationsAMG < iterationsMIC );
+
+            // closed box full of fluid, singular
+            yapfs::LaplacianOperator closed(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim, closed);
+            N = closed.size();
+            rhs.resize(N);
+            double mean = 0.0;
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+                mean += rhs[row];
+            }
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] -= mean / N;
+            }
+            yapfs::AMGPreconditioner closedAMG(closed);
+            CPPUNIT_ASSERT( closedAMG.mClosedComponentSize.size() == 1 );
+            x.assign(N, 0.0f);
+            iterationsAMG = yapfs::conjugateGradientCPU(closed, &closedAMG, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            CPPUNIT_ASSERT( residual < 1e-5 );
+            CPPUNIT_ASSERT( iterationsAMG < 30 );
+
+            // update after the pool rises by one layer: same hierarchy, Galerkin products of the new matrix
+            yapfs::LaplacianOperator tank(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2, tank);
+            yapfs::AMGPreconditioner tankAMG(tank);
+            vector<int64_t> prevVoxelOfRow = tank.mVoxelOfRow;
+            tank.reset(gridDim, gridDim, gridDim);
+            buildFluidLaplacian(gridDim, gridDim / 2 + 1, tank);
+            N = tank.size();
+            vector<int> oldRowOfRow(N, -1), changedRows;
+            for(size_t oldRow = 0; oldRow < prevVoxelOfRow.size(); ++oldRow)
+            {
+                oldRowOfRow[tank.mRowOfVoxel[prevVoxelOfRow[oldRow]]] = (int)oldRow;
+            }
+            CPPUNIT_ASSERT( tankAMG.update(oldRowOfRow, changedRows) );
+            rhs.resize(N);
+            for(int row = 0; row < N; ++row)
+            {
+                rhs[row] = yapfs::getRnd_0_1() - 0.5;
+            }
+            x.assign(N, 0.0f);
+            iterationsAMG = yapfs::conjugateGradientCPU(tank, &tankAMG, x.data(), rhs.data(), 1e-5f, 10000, residual);
+            CPPUNIT_ASSERT( residual < 1e-5 );
+            CPPUNIT_ASSERT( iterationsAMG < 30 );
+        }
+
+        void testComponentSolver()
+        {
+            // a pool and a grid of droplets of 2x2x2 voxels, one voxel of air between them
+            int64_t gridDim = 32;
+            auto isDroplet = [&](int64_t i, int64_t j, int64_t k) { return (j > gridDim / 2) && (i % 3 != 2) && (j % 3 != 2) && (k % 3 != 2); };
+            vector<uint8_t> flags(gridDim * gridDim * gridDim);
+            for(int64_t i = 0; i < gridDim; ++i)
+                for(int64_t j = 0; j < gridDim; ++j)
+                    for(int64_t k = 0; k < gridDim; ++k)
+                    {
+                        bool fluid = (j < gridDim / 4) || isDroplet(i, j, k);
+                        flags[(i*gridDim + j)*gridDim + k] = fluid ? (yapfs::VOXEL_FLUID | yapfs::VOXEL_NON_SOLID) : yapfs::VOXEL_NON_SOLID;
+                    }
+            yapfs::LaplacianOperator laplacian(gridDim, gridDim, gridDim);
+            laplacian.build(flags.data());
+            int N = laplacian.size();
+
+            // components: the pool and the droplets
+            yapfs::FluidComponents components;
+            components.build(laplacian);
+            int numDroplets = 0;
+            for(int64_t i = 0; i < gridDim; i += 3)
+                for(int64_t j = 0; j < gridDim; ++j)
+                    for(int64_t k = 0; k < gridDim; k += 3)
+                    {
+                        // the lower corner of a droplet
+                        numDroplets += ( isDroplet(i, j, k) && !isDroplet(i, j - 1, k) ) ? 1 : 0;
+                    }
+            CPPUNIT_ASSERT( components.size() == 1 + numDroplets );
+            CPPUNIT_ASSERT( components.getNumRows(0) == gridDim * gridDim * (gridDim / 4) );
+            for(int row = 0; row < N; ++row)
+            {
+                // every fluid neighbour in the same component
+                for (int dir = 0; dir < 6; dir++)
+                {
+                    if (laplacian.mMask[row] & yapfs::neighbourFluidBit(dir))
+                    {
+                        int neighbour = laplacian.mRowOfVoxel[laplacian.mVoxelOfRow[row] + laplacian.mOffset[dir]];
+                        CPPUNIT_ASSERT( components.mComponentOfRow[neighbour] == components.mComponentOfRow[row] );
+                    }
+                }
+            }
+
+            // divergence in the pool and in half of the droplets
+            vector<float> rhs(N, 0.0f), x(N, 0.0f), r(N);
+            for(int row = 0; row < N; ++row)
+            {
+                int component = components.mComponentOfRow[row];
+                if ( (component == 0) || (component % 2 == 1) )
+                {
+                    rhs[row] = yapfs::getRnd_0_1() - 0.5;
+                }
+            }
+            yapfs::SolverTolerance tolerance(1e-5f, 0.0f, 10000);
+            yapfs::SolverStats stats;
+            int numSolved = yapfs::solveComponentsCPU(laplacian, components, x.data(), rhs.data(),
+                [](const yapfs::LaplacianOperator &A) -> yapfs::Preconditioner * { return new yapfs::MICPreconditioner(A, true); },
+                tolerance, false, true, &stats);
+            L_LOG_INFO("Components: " + to_string(components.size()) + " solved: " + to_string(numSolved) + " iterations: " + to_string(stats.mIterations));
+            CPPUNIT_ASSERT( numSolved == 1 + components.size() / 2 );
+            CPPUNIT_ASSERT( stats.mStopReason == yapfs::SOLVER_CONVERGED );
+
+            // the residual of the whole system
+            laplacian.apply(x.data(), r.data());
+            for(int row = 0; row < N; ++row)
+            {
+                r[row] = rhs[row] - r[row];
+            }
+            double residual = sqrt(yapfs::cpuDot(r.data(), r.data(), N));
+            CPPUNIT_ASSERT( fabs(residual - stats.mFinalResidual) <= 0.05 * residual );
+            CPPUNIT_ASSERT( residual <= sqrt(2.0) * 1e-5 * sqrt(yapfs::cpuDot(rhs.data(), rhs.data(), N)) );
+
+            // kept systems: the preconditioners of the solved components are built by the first solve only
+            yapfs::ComponentSystems systems;
+            std::atomic<int> numBuilt(0);
+            yapfs::PreconditionerFactory createCounted = [&](const yapfs::LaplacianOperator &A) -> yapfs::Preconditioner *
+                {
+                    numBuilt++;
+                    return new yapfs::MICPreconditioner(A, true);
+                };
+            for (int solve = 0; solve < 3; ++solve)
+            {
+                vector<float> xKept(N, 0.0f);
+                yapfs::SolverStats keptStats;
+                CPPUNIT_ASSERT( yapfs::solveComponentsCPU(laplacian, components, xKept.data(), rhs.data(), createCounted, tolerance, false, true, &keptStats, &systems) == numSolved );
+                CPPUNIT_ASSERT( numBuilt == numSolved );
+                CPPUNIT_ASSERT( keptStats.mIterations == stats.mIterations );
+            }
+        }
+
+
+        void testGridAccessors()
+        {
+            int64_t n = 40;
+            yapfs::Grid<openvdb::DoubleGrid> grid(0.1);
+            yapfs::Grid<openvdb::DoubleGrid>::Accessor accessor = grid.getAccessor();
+            for(int64_t i = 0; i < n; ++i)
+                for(int64_t j = 0; j < n; ++j)
+                    for(int64_t k = 0; k < n; ++k)
+                    {
+                        accessor.setValue(i * n * n + j * n + k, i, j, k);
+                    }
+
+            // the accessors cached for the threads of a parallel loop, and a handle for each task
+            tbb::parallel_for(tbb::blocked_range<int64_t>(0, n, 1),
+                [&](const tbb::blocked_range<int64_t> &range)
+                {
+                    yapfs::Grid<openvdb::DoubleGrid>::ConstAccessor constAccessor = grid.getConstAccessor();
+                    for(int64_t i = range.begin(); i != range.end(); ++i)
+                        for(int64_t j = 0; j < n; ++j)
+                            for(int64_t k = 0; k < n; ++k)
+                            {
+                                CPPUNIT_ASSERT( grid.getValue(i, j, k) == i * n * n + j * n + k );
+                                CPPUNIT_ASSERT( constAccessor.getValue(i, j, k) == i * n * n + j * n + k );
+                            }
+                });
+
+            // writes of several threads, and the cached accessors follow the copy and the clear of the tree
+            tbb::parallel_for(tbb::blocked_range<int64_t>(0, n, 1),
+                [&](const tbb::blocked_range<int64_t> &range)
+                {
+                    for(int64_t i = range.begin(); i != range.end(); ++i)
+                    {
+                        grid.setValue(-1.0, i, n + i, 0);
+                    }
+                });
+            yapfs::Grid<openvdb::DoubleGrid> copy(0.1);
+            copy.getValue(0, 0, 0);
+            copy.deepCopyFromGrid(&grid);
+            grid.clear();
+            for(int64_t i = 0; i < n; ++i)
+            {
+                CPPUNIT_ASSERT( copy.getValue(i, n + i, 0) == -1.0 );
+                CPPUNIT_ASSERT( copy.getValue(i, i, i) == i * n * n + i * n + i );
+                CPPUNIT_ASSERT( grid.getValue(i, i, i) == 0.0 );
+            }
+        }
+
+        // the dense storage against the OpenVDB grid: values, interpolation and the conversions of the export
+        void testDenseGrid()
+        {
+            openvdb::Vec3i minN(-3, 0, 2);
+            openvdb::Vec3i maxN(9, 7, 15);
+            yapfs::Grid<openvdb::Vec3DGrid> sparse(0.1);
+            yapfs::Grid<openvdb::Vec3DGrid, yapfs::DenseStorage> dense(0.1, minN, maxN);
+            yapfs::Grid<openvdb::Vec3DGrid, yapfs::DenseStorage>::Accessor accessor = dense.getAccessor();
+            for(int64_t i = minN.x() - 1; i <= maxN.x() + 1; ++i)
+                for(int64_t j = minN.y() - 1; j <= maxN.y() + 1; ++j)
+                    for(int64_t k = minN.z() - 1; k <= maxN.z() + 1; ++k)
+                    {
+                        openvdb::Vec3d value(yapfs::getRnd_0_1(), yapfs::getRnd_0_1() - 0.5, i + j * k);
+                        sparse.setValue(value, i, j, k);
+                        accessor.setValue(value, i, j, k);
+                    }
+            CPPUNIT_ASSERT( dense.getData(1)[dense.getIndex(minN.x(), minN.y(), minN.z() + 1)] == dense.getValue(minN.x(), minN.y(), minN.z() + 1).y() );
+            CPPUNIT_ASSERT( dense.getValue(maxN.x() + DENSE_GRID_PADDING + 1, 0, 0) == openvdb::Vec3d(0.0, 0.0, 0.0) );
+
+            for(int sample = 0; sample < 1000; ++sample)
+            {
+                openvdb::Vec3d point(minN.x() - 2 + (maxN.x() - minN.x() + 4) * yapfs::getRnd_0_1(),
+                                     minN.y() - 2 + (maxN.y() - minN.y() + 4) * yapfs::getRnd_0_1(),
+                                     minN.z() - 2 + (maxN.z() - minN.z() + 4) * yapfs::getRnd_0_1());
+                openvdb::Vec3d difference = sparse.sample(point) - dense.sample(point);
+                CPPUNIT_ASSERT( fabs(difference.x()) + fabs(difference.y()) + fabs(difference.z()) < 1e-9 );
+            }
+
+            yapfs::Grid<openvdb::Vec3DGrid> exported(0.1);
+            dense.exportToGrid(exported);
+            yapfs::Grid<openvdb::Vec3DGrid, yapfs::DenseStorage> imported(0.1, minN, maxN);
+            imported.importFromGrid(exported);
+            yapfs::Grid<openvdb::Vec3DGrid, yapfs::DenseStorage> copy(0.1, minN, minN);
+            copy.deepCopyFromGrid(&imported);
+            dense.clear();
+            for(int64_t i = minN.x() - 1; i <= maxN.x() + 1; ++i)
+                for(int64_t j = minN.y() - 1; j <= maxN.y() + 1; ++j)
+                    for(int64_t k = minN.z() - 1; k <= maxN.z() + 1; ++k)
+                    {
+                        CPPUNIT_ASSERT( exported.getValue(i, j, k) == sparse.getValue(i, j, k) );
+                        CPPUNIT_ASSERT( copy.getValue(i, j, k) == sparse.getValue(i, j, k) );
+                        CPPUNIT_ASSERT( dense.getValue(i, j, k) == openvdb::Vec3d(0.0, 0.0, 0.0) );
+                    }
+        }
+
+        // a divergence kernel run by forEachBlock on the two storages, against the serial loop
+        template<typename Storage>
+        void runDivergenceBlocks(const openvdb::Vec3i &minN, const openvdb::Vec3i &maxN)
+        {
+            yapfs::Grid<openvdb::Vec3DGrid, Storage> velocity(0.1, minN, maxN);
+            yapfs::Grid<openvdb::DoubleGrid, Storage> divergence(0.1, minN, maxN);
+            for(int64_t i = minN.x(); i <= maxN.x(); ++i)
+                for(int64_t j = minN.y(); j <= maxN.y(); ++j)
+                    for(int64_t k = minN.z(); k <= maxN.z(); ++k)
+                    {
+                        velocity.setValue(openvdb::Vec3d(yapfs::getRnd_0_1(), yapfs::getRnd_0_1(), yapfs::getRnd_0_1()), i, j, k);
+                    }
+
+            divergence.forEachBlock(minN, maxN,
+                [&](typename yapfs::Grid<openvdb::DoubleGrid, Storage>::Block &block)
+                {
+                    typename yapfs::Grid<openvdb::Vec3DGrid, Storage>::ConstAccessor velAccessor = velocity.getConstAccessor();
+                    for(int64_t i = block.getBegin().x(); i < block.getEnd().x(); ++i)
+                        for(int64_t j = block.getBegin().y(); j < block.getEnd().y(); ++j)
+                            for(int64_t k = block.getBegin().z(); k < block.getEnd().z(); ++k)
+                            {
+                                openvdb::Vec3d velV = velAccessor.getValue(i, j, k);
+                                block.setValue(velAccessor.getValue(i+1, j, k).x() - velV.x() + velAccessor.getValue(i, j+1, k).y() - velV.y()
+                                    + velAccessor.getValue(i, j, k+1).z() - velV.z(), i, j, k);
+                            }
+                });
+            velocity.forEachBlock(minN, maxN + openvdb::Vec3i(1, 1, 1),
+                [&](typename yapfs::Grid<openvdb::Vec3DGrid, Storage>::Block &block)
+                {
+                    for(int64_t i = block.getBegin().x(); i < block.getEnd().x(); ++i)
+                        for(int64_t j = block.getBegin().y(); j < block.getEnd().y(); ++j)
+                            for(int64_t k = block.getBegin().z(); k < block.getEnd().z(); ++k)
+                            {
+                                block.setValue(block.getValue(i, j, k) + openvdb::Vec3d(i, j, k), i, j, k);
+                            }
+                });
+
+            for(int64_t i = minN.x(); i <= maxN.x(); ++i)
+                for(int64_t j = minN.y(); j <= maxN.y(); ++j)
+                    for(int64_t k = minN.z(); k <= maxN.z(); ++k)
+                    {
+                        openvdb::Vec3d velV = velocity.getValue(i, j, k) - openvdb::Vec3d(i, j, k);
+                        if ( (i < maxN.x()) && (j < maxN.y()) && (k < maxN.z()) )
+                        {
+                            double expected = velocity.getValue(i+1, j, k).x() - (i + 1) - velV.x() + velocity.getValue(i, j+1, k).y() - (j + 1) - velV.y()
+                                + velocity.getValue(i, j, k+1).z() - (k + 1) - velV.z();
+                            CPPUNIT_ASSERT( fabs(divergence.getValue(i, j, k) - expected) < 1e-9 );
+                        }
+                        else
+                        {
+                            CPPUNIT_ASSERT( divergence.getValue(i, j, k) == 0.0 );
+                        }
+                        CPPUNIT_ASSERT( (velV.x() >= 0.0) && (velV.x() <= 1.0) && (velV.z() >= 0.0) && (velV.z() <= 1.0) );
+                    }
+        }
+
+        void testGridBlocks()
+        {
+            // the box does not start at a leaf boundary of the OpenVDB tree
+            runDivergenceBlocks<yapfs::SparseStorage>(openvdb::Vec3i(-5, 3, 0), openvdb::Vec3i(20, 17, 9));
+            runDivergenceBlocks<yapfs::DenseStorage>(openvdb::Vec3i(-5, 3, 0), openvdb::Vec3i(20, 17, 9));
+        }
+
+        // a linear velocity field set on the faces, sampled back exactly at any point of the box
+        template<typename Storage, typename RealT>
+        void runMACGrid(const openvdb::Vec3i &minN, const openvdb::Vec3i &maxN, double tolerance)
+        {
+            typedef yapfs::MACGrid<Storage, RealT> MACGridT;
+            openvdb::Vec3d gradient[3] = { openvdb::Vec3d(0.3, -1.2, 2.0), openvdb::Vec3d(1.5, 0.7, -0.4), openvdb::Vec3d(-0.8, 0.1, 1.1) };
+            MACGridT velocity(0.1, minN, maxN);
+            for(int c = 0; c < 3; ++c)
+            {
+                typename MACGridT::FaceGrid::Accessor accessor = velocity.getFace(c)->getAccessor();
+                for(int64_t i = minN.x() - 1; i <= maxN.x() + 1; ++i)
+                    for(int64_t j = minN.y() - 1; j <= maxN.y() + 1; ++j)
+                        for(int64_t k = minN.z() - 1; k <= maxN.z() + 1; ++k)
+                        {
+                            // the face of the component c of the voxel (i, j, k) is in its middle in the other directions
+                            openvdb::Vec3d facePoint(i + 0.5, j + 0.5, k + 0.5);
+                            facePoint[c] -= 0.5;
+                            accessor.setValue(gradient[c].dot(facePoint) + c, i, j, k);
+                        }
+            }
+
+            for(int sample = 0; sample < 1000; ++sample)
+            {
+                openvdb::Vec3d point(minN.x() + (maxN.x() - minN.x()) * yapfs::getRnd_0_1(),
+                                     minN.y() + (maxN.y() - minN.y()) * yapfs::getRnd_0_1(),
+                                     minN.z() + (maxN.z() - minN.z()) * yapfs::getRnd_0_1());
+                openvdb::Vec3d value = velocity.sample(point);
+                for(int c = 0; c < 3; ++c)
+                {
+                    CPPUNIT_ASSERT( fabs(value[c] - gradient[c].dot(point) - c) < tolerance );
+                }
+            }
+
+            MACGridT copy(0.1, minN, maxN);
+            copy.deepCopyFromGrid(&velocity);
+            velocity.clear();
+            yapfs::Grid<openvdb::Vec3DGrid> exported(0.1);
+            copy.exportToGrid(exported);
+            for(int64_t i = minN.x(); i <= maxN.x(); ++i)
+                for(int64_t j = minN.y(); j <= maxN.y(); ++j)
+                    for(int64_t k = minN.z(); k <= maxN.z(); ++k)
+                    {
+                        openvdb::Vec3d value = copy.getValue(i, j, k);
+                        CPPUNIT_ASSERT( fabs(value.x() - gradient[0].dot(openvdb::Vec3d(i, j + 0.5, k + 0.5))) < tolerance );
+                        CPPUNIT_ASSERT( fabs(value.z() - gradient[2].dot(openvdb::Vec3d(i + 0.5, j + 0.5, k)) - 2) < tolerance );
+                        CPPUNIT_ASSERT( exported.getValue(i, j, k) == value );
+                        CPPUNIT_ASSERT( velocity.getValue(i, j, k) == openvdb::Vec3d(0.0, 0.0, 0.0) );
+                    }
+        }
+
+        void testMACGrid()
+        {
+            runMACGrid<yapfs::SparseStorage, double>(openvdb::Vec3i(-5, 3, 0), openvdb::Vec3i(20, 17, 9), 1e-9);
+            runMACGrid<yapfs::DenseStorage, double>(openvdb::Vec3i(-5, 3, 0), openvdb::Vec3i(20, 17, 9), 1e-9);
+        }
+
+        void testGradientFaces()
+        {
+            // the same faces in the three directions: fluid-fluid and fluid-air in either order
+            const int32_t types[4] = { yapfs::VoxelType::NDF, yapfs::VoxelType::FLUID, yapfs::VoxelType::SOLID, yapfs::VoxelType::AIR };
+            for (int prev = 0; prev < 4; ++prev)
+                for (int idx = 0; idx < 4; ++idx)
+                {
+                    bool fluidPrev = (types[prev] == yapfs::VoxelType::FLUID);
+                    bool fluid = (types[idx] == yapfs::VoxelType::FLUID);
+                    bool expected = (fluidPrev && (fluid || (types[idx] == yapfs::VoxelType::AIR)))
+                        || (fluid && (types[prev] == yapfs::VoxelType::AIR));
+                    CPPUNIT_ASSERT( yapfs::isGradientFace(types[prev], types[idx]) == expected );
+                }
+            CPPUNIT_ASSERT( !yapfs::isGradientFace(yapfs::VoxelType::AIR, yapfs::VoxelType::AIR) );
+            CPPUNIT_ASSERT( !yapfs::isGradientFace(yapfs::VoxelType::SOLID, yapfs::VoxelType::FLUID) );
+        }
+
+        void testSinglePrecision()
+        {
+            // the face values rounded to float, the interpolation still in double
+            runMACGrid<yapfs::SparseStorage, float>(openvdb::Vec3i(-5, 3, 0), openvdb::Vec3i(20, 17, 9), 1e-4);
+            runMACGrid<yapfs::DenseStorage, float>(openvdb::Vec3i(-5, 3, 0), openvdb::Vec3i(20, 17, 9), 1e-4);
+
+            yapfs::Particles<float> particles(0.1);
+            openvdb::Vec3d center(0.35, -0.25, 1.05);
+            particles.addParticlesInVoxel(center);
+            CPPUNIT_ASSERT( particles.mPosition.size() == 8 );
+            for(size_t idx = 0; idx < particles.mPosition.size(); ++idx)
+            {
+                openvdb::Vec3d position(particles.mPosition[idx]);
+                CPPUNIT_ASSERT( (fabs(position.x() - center.x()) <= 0.05 + 1e-6) && (fabs(position.y() - center.y()) <= 0.05 + 1e-6)
+                    && (fabs(position.z() - center.z()) <= 0.05 + 1e-6) );
+            }
+        }
 
 };
 
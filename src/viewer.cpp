@@ -371,7 +371,7 @@ namespace yapfs {
             glBegin(GL_POINTS);
             for(int32_t i = 0; i < ((solverPtr->frameParticleP)[idFrame]).size(); ++i)
             {
-                Vec3d pPos = ((solverPtr->frameParticleP)[idFrame])[i]*scale_anim;
+                Vec3d pPos = Vec3d(((solverPtr->frameParticleP)[idFrame])[i])*scale_anim;
                 glVertex3f( pPos.x(), pPos.y(), pPos.z() );
             }
             glEnd();
@@ -382,8 +382,8 @@ namespace yapfs {
             glBegin(GL_LINES);
             for(int32_t i = 0; i < ((solverPtr->frameParticleP)[idFrame]).size(); i+=7)
             {
-                Vec3d pPos = ((solverPtr->frameParticleP)[idFrame])[i]*scale_anim;
-                Vec3d pPosVel = ((solverPtr->frameParticleV)[idFrame])[i];
+                Vec3d pPos = Vec3d(((solverPtr->frameParticleP)[idFrame])[i])*scale_anim;
+                Vec3d pPosVel(((solverPtr->frameParticleV)[idFrame])[i]);
                 glVertex3f( pPos.x(), pPos.y(), pPos.z() );
                 glVertex3f( pPos.x() + pPosVel.x(), pPos.y() + pPosVel.y(), pPos.z() + pPosVel.z() );
             }